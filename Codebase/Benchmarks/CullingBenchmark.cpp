@@ -0,0 +1,119 @@
+// Measures CPU frustum culling throughput (instances per ms) on a synthetic scene.
+//
+// Usage: CullingBenchmark [instanceCount] [iterations]
+// Scatters instances with random scales and bounding spheres around the camera, then
+// times InstanceCuller::Cull (SSE when available) against the scalar loop it replaces,
+// and InstanceBVH's build, traversal and refit.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include "../InstanceBVH.h"
+
+template<typename Func>
+static double BestSeconds(unsigned _iterations, Func _func)
+{
+	double best = 1e30;
+	for (unsigned i = 0; i < _iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		_func();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (elapsed.count() < best)
+			best = elapsed.count();
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned instanceCount = (argc > 1) ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 1000000;
+	unsigned iterations = (argc > 2) ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 20;
+
+	// Instances fill a cube twice the far plane across, so most of them are outside
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+	std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> radius(0.5f, 4.0f);
+	InstanceCuller culler;
+	culler.Create(instanceCount);
+	std::vector<GW::MATH::GSPHEREF> spheres(instanceCount);
+	for (unsigned i = 0; i < instanceCount; ++i) {
+		GW::MATH::GMATRIXF world = GW::MATH::GIdentityMatrixF;
+		world.data[0] = world.data[5] = world.data[10] = scale(rng);
+		world.data[12] = position(rng);
+		world.data[13] = position(rng);
+		world.data[14] = position(rng);
+		GW::MATH::GSPHEREF local = {};
+		local.x = offset(rng);
+		local.y = offset(rng);
+		local.z = offset(rng);
+		local.radius = radius(rng);
+		spheres[i] = InstanceCuller::TransformSphere(world, local);
+		culler.SetInstance(i, spheres[i]);
+	}
+
+	// The renderer's projection, looking down +z from the origin
+	GW::MATH::GMatrix matrixProxy;
+	matrixProxy.Create();
+	GW::MATH::GMATRIXF view, projection, viewProjection;
+	GW::MATH::GVECTORF eye = { 0.0f, 0.0f, 0.0f, 1.0f }, at = { 0.0f, 0.0f, 1.0f, 1.0f }, up = { 0.0f, 1.0f, 0.0f, 0.0f };
+	matrixProxy.LookAtLHF(eye, at, up, view);
+	matrixProxy.ProjectionVulkanLHF(65.0f * 3.14159265359f / 180.0f, 16.0f / 9.0f, 0.1f, 100.0f, projection);
+	matrixProxy.MultiplyMatrixF(view, projection, viewProjection);
+	float planes[6][4];
+	InstanceCuller::ExtractPlanes(viewProjection, planes);
+	std::cout << "Synthetic scene: " << instanceCount << " instances\n";
+
+	// Scalar baseline
+	std::vector<uint32_t> scalarVisible;
+	double scalar = BestSeconds(iterations, [&]() { culler.CullScalar(planes, scalarVisible); });
+	std::cout << "Scalar:  " << instanceCount / (scalar * 1000.0) << " instances/ms, " << scalar * 1000.0 << " ms\n";
+
+	// Batched
+	std::vector<uint32_t> visible;
+	double batched = BestSeconds(iterations, [&]() { culler.Cull(planes, visible); });
+#ifdef INSTANCE_CULLER_SSE
+	std::cout << "SSE:     ";
+#else
+	std::cout << "Batched: ";
+#endif
+	std::cout << instanceCount / (batched * 1000.0) << " instances/ms, " << batched * 1000.0 << " ms ("
+		<< scalar / batched << "x)\n";
+
+	bool matches = visible == scalarVisible;
+
+	// Hierarchy, its output is unordered
+	InstanceBVH bvh;
+	double build = BestSeconds(1, [&]() { bvh.Build(spheres); });
+	std::cout << "BVH build: " << bvh.GetNodeCount() << " nodes, " << build * 1000.0 << " ms\n";
+	std::vector<uint32_t> bvhVisible;
+	double hierarchical = BestSeconds(iterations, [&]() { bvh.Cull(planes, bvhVisible); });
+	std::cout << "BVH:     " << instanceCount / (hierarchical * 1000.0) << " instances/ms, " << hierarchical * 1000.0 << " ms ("
+		<< scalar / hierarchical << "x)\n";
+	std::sort(bvhVisible.begin(), bvhVisible.end());
+	matches = matches && bvhVisible == scalarVisible;
+
+	// Move a tenth of the instances a little, then refit
+	std::uniform_real_distribution<float> nudge(-2.0f, 2.0f);
+	for (unsigned i = 0; i < instanceCount; i += 10) {
+		spheres[i].x += nudge(rng);
+		spheres[i].z += nudge(rng);
+		bvh.SetInstance(i, spheres[i]);
+		culler.SetInstance(i, spheres[i]);
+	}
+	double refit = BestSeconds(1, [&]() { bvh.Refit(); });
+	std::cout << "BVH refit (" << (instanceCount + 9) / 10 << " moved): " << refit * 1000.0 << " ms\n";
+	bvh.Cull(planes, bvhVisible);
+	culler.CullScalar(planes, scalarVisible);
+	std::sort(bvhVisible.begin(), bvhVisible.end());
+	matches = matches && bvhVisible == scalarVisible;
+
+	std::cout << visible.size() << " visible, " << instanceCount - visible.size() << " culled\n";
+	std::cout << (matches ? "Results match\n" : "Results DO NOT match\n");
+	return matches ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Measures text level parsing throughput (MB/s) on a synthetic level.
+//
+// Usage: LevelParseBenchmark [instanceCount] [iterations]
+// Writes a generated level to the working directory, then times LevelFile::ReadText
+// against the old getline/substr/atof parser and LevelFile::ReadBinary on the compiled form.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include "../LevelFile.h"
+
+// The parser LevelFile::ReadText replaced, kept here as the baseline
+static bool LegacyReadText(const char* _path, std::vector<std::string>& _filenames, std::vector<GW::MATH::GMATRIXF>& _matrices)
+{
+	std::string line;
+	std::ifstream file(_path, std::ios::in);
+	if (!file.is_open())
+		return false;
+	while (std::getline(file, line)) {
+		if (line.compare("MESH") == 0) {
+			std::getline(file, line);
+			auto index = line.find(".");
+			if (index != std::string::npos)
+				line = line.substr(0, index);
+			_filenames.push_back(line);
+			GW::MATH::GMATRIXF m;
+			for (int row = 0; row < 4; ++row) {
+				std::string text;
+				std::getline(file, text);
+				std::string sub = text.substr(text.find("(") + 1, text.length() - 1);
+				m.data[row * 4 + 0] = std::atof(sub.c_str());
+				for (int col = 1; col < 4; ++col) {
+					sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
+					m.data[row * 4 + col] = std::atof(sub.c_str());
+				}
+			}
+			_matrices.push_back(m);
+		}
+	}
+	return true;
+}
+
+// Writes a level in the exporter's format with a light, nested meshes and a mix of mesh names.
+// The legacy parser only knows unindented meshes, _nested off writes every mesh that way.
+static size_t WriteSyntheticLevel(const char* _path, unsigned _instanceCount, bool _nested = true)
+{
+	const char* meshNames[] = { "House_1", "House_2", "Crate", "Fence", "Bench_1", "Cart", "Hay", "Well" };
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> value(-50.0f, 50.0f);
+	FILE* file = fopen(_path, "wb");
+	if (!file)
+		return 0;
+	fprintf(file, "# Game Level Exporter v1.0\nLIGHT\nSun\n");
+	fprintf(file, "<Matrix 4x4 (-0.4386,  0.0000, -0.8987, 0.0000)\n            ( 0.8480, -0.3312, -0.4138, 0.0000)\n"
+		"            (-0.2976, -0.9436,  0.1452, 0.0000)\n            ( 0.0000,  2.0200,  0.0000, 1.0000)>\n");
+	for (unsigned i = 0; i < _instanceCount; ++i) {
+		const char* indent = (_nested && i % 5 == 4) ? "  " : "";
+		fprintf(file, "%sMESH\n%s%s.%03u\n", indent, indent, meshNames[i % 8], i % 1000);
+		fprintf(file, "%s<Matrix 4x4 (%7.4f, %7.4f, %7.4f, 0.0000)\n", indent, value(rng), value(rng), value(rng));
+		fprintf(file, "%s            (%7.4f, %7.4f, %7.4f, 0.0000)\n", indent, value(rng), value(rng), value(rng));
+		fprintf(file, "%s            (%7.4f, %7.4f, %7.4f, 0.0000)\n", indent, value(rng), value(rng), value(rng));
+		fprintf(file, "%s            (%7.4f, %7.4f, %7.4f, 1.0000)>\n", indent, value(rng), value(rng), value(rng));
+	}
+	size_t size = static_cast<size_t>(ftell(file));
+	fclose(file);
+	return size;
+}
+
+// Floats at most one unit in the last place apart, atof rounds through double first
+static bool WithinOneUlp(float _a, float _b)
+{
+	if (_a == _b)
+		return true;
+	int32_t a, b;
+	memcpy(&a, &_a, sizeof(a));
+	memcpy(&b, &_b, sizeof(b));
+	if ((a < 0) != (b < 0))
+		return false;
+	return (a > b ? a - b : b - a) <= 1;
+}
+
+// Parses an unindented level with both text parsers and compares every name and matrix element
+static bool MatchesLegacy(const char* _path, unsigned _instanceCount)
+{
+	if (WriteSyntheticLevel(_path, _instanceCount, false) == 0)
+		return false;
+	LevelFile::Level level;
+	std::vector<std::string> filenames;
+	std::vector<GW::MATH::GMATRIXF> matrices;
+	bool read = LevelFile::ReadText(_path, level) && LegacyReadText(_path, filenames, matrices);
+	std::remove(_path);
+	if (!read || level.matrices.size() != matrices.size() || level.meshIds.size() != filenames.size())
+		return false;
+	for (size_t i = 0; i < matrices.size(); ++i) {
+		if (level.meshNames[level.meshIds[i]] != filenames[i])
+			return false;
+		for (int e = 0; e < 16; ++e)
+			if (!WithinOneUlp(level.matrices[i].data[e], matrices[i].data[e]))
+				return false;
+	}
+	return true;
+}
+
+template<typename Func>
+static double BestSeconds(unsigned _iterations, Func _func)
+{
+	double best = 1e30;
+	for (unsigned i = 0; i < _iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		_func();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (elapsed.count() < best)
+			best = elapsed.count();
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned instanceCount = (argc > 1) ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 200000;
+	unsigned iterations = (argc > 2) ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 5;
+	const char* textPath = "SyntheticLevel.txt";
+	const char* binaryPath = "SyntheticLevel.lvl";
+
+	size_t textBytes = WriteSyntheticLevel(textPath, instanceCount);
+	if (textBytes == 0) {
+		std::cout << "Could not write " << textPath << "\n";
+		return 1;
+	}
+	double megabytes = textBytes / (1024.0 * 1024.0);
+	std::cout << "Synthetic level: " << instanceCount << " instances, " << megabytes << " MB\n";
+
+	// Streaming tokenizer
+	LevelFile::Level level;
+	double streaming = BestSeconds(iterations, [&]() { LevelFile::ReadText(textPath, level); });
+	std::cout << "ReadText (from_chars):  " << megabytes / streaming << " MB/s, "
+		<< streaming * 1000.0 << " ms\n";
+
+	// Old parser
+	double legacy = BestSeconds(iterations, [&]() {
+		std::vector<std::string> filenames;
+		std::vector<GW::MATH::GMATRIXF> matrices;
+		LegacyReadText(textPath, filenames, matrices);
+	});
+	std::cout << "Legacy getline/atof:    " << megabytes / legacy << " MB/s, "
+		<< legacy * 1000.0 << " ms\n";
+
+	// Compiled level, for reference
+	LevelFile::WriteBinary(binaryPath, level);
+	LevelFile::Level compiled;
+	double binary = BestSeconds(iterations, [&]() { LevelFile::ReadBinary(binaryPath, compiled); });
+	std::cout << "ReadBinary (.lvl):      " << binary * 1000.0 << " ms\n";
+
+	bool matches = compiled.matrices.size() == level.matrices.size() && compiled.meshIds == level.meshIds &&
+		level.matrices.size() == instanceCount && level.lightMatrices.size() == 1 &&
+		memcmp(compiled.matrices.data(), level.matrices.data(), level.matrices.size() * sizeof(GW::MATH::GMATRIXF)) == 0 &&
+		MatchesLegacy("SyntheticLevelFlat.txt", std::min(instanceCount, 20000u));
+	std::cout << (matches ? "Results match\n" : "Results DO NOT match\n");
+
+	std::remove(textPath);
+	std::remove(binaryPath);
+	return matches ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "GvkAllocator.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// Hierarchical depth for occlusion culling. Gateware keeps its depth attachment to itself,
+// so the renderer draws into a depth only pass of its own here, then RecordReduce folds
+// that depth into a mip chain where every texel holds the farthest depth under it. Level 0
+// is half the pass size and each level halves again down to 1x1, odd sizes folding their
+// last row and column into the last texel. One set of images is shared by every frame,
+// the barriers order each frame's use after the previous one's.
+class DepthPyramid
+{
+	// Matches REDUCE_DATA in Shaders::depthReduceShader
+	struct PushConstants {
+		uint32_t sourceSize[2];
+		uint32_t destinationSize[2];
+	};
+
+	static const uint32_t maxLevels = 16;	// 64k pixels across
+
+	VkPhysicalDevice physicalDevice = nullptr;
+	VkDevice device = nullptr;
+	GvkAllocator* allocator = nullptr;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	VkRenderPass renderPass = nullptr;
+	VkImage depthImage = nullptr;
+	GvkAllocator::Allocation depthMemory;
+	VkImageView depthView = nullptr;
+	VkFramebuffer framebuffer = nullptr;
+	VkImage pyramidImage = nullptr;
+	GvkAllocator::Allocation pyramidMemory;
+	VkImageView pyramidView = nullptr;		// every level, what the cull shader reads
+	std::vector<VkImageView> levelViews;	// one level each, what the reduce writes
+	VkDescriptorSetLayout setLayout = nullptr;
+	VkDescriptorPool descriptorPool = nullptr;
+	std::vector<VkDescriptorSet> descriptorSets;	// per level: the level above (or the depth) in, this level out
+	VkPipelineLayout pipelineLayout = nullptr;
+	VkPipeline pipeline = nullptr;
+	uint32_t width = 0, height = 0, levelCount = 0;
+	bool firstUse = false;	// the pyramid is still UNDEFINED since the last Resize
+
+public:
+	// First depth format that can be both rendered to and sampled, VK_FORMAT_UNDEFINED if none
+	static VkFormat FindDepthFormat(VkPhysicalDevice _physicalDevice)
+	{
+		const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
+		VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+		for (VkFormat format : candidates) {
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &properties);
+			if ((properties.optimalTilingFeatures & needed) == needed)
+				return format;
+		}
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	// Builds the depth pass and the reduce pipeline from _reduceShader (Shaders::depthReduceShader).
+	// The images come with the first Resize.
+	bool Create(VkPhysicalDevice _physicalDevice, VkDevice _device, GvkAllocator* _allocator, VkShaderModule _reduceShader,
+		VkPipelineCache _pipelineCache)
+	{
+		physicalDevice = _physicalDevice;
+		device = _device;
+		allocator = _allocator;
+		depthFormat = FindDepthFormat(_physicalDevice);
+		if (depthFormat == VK_FORMAT_UNDEFINED)
+			return false;
+
+		// Depth only, cleared to the far plane and left readable for the reduce
+		VkAttachmentDescription attachment = {};
+		attachment.format = depthFormat;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		VkAttachmentReference depth_reference = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.pDepthStencilAttachment = &depth_reference;
+		VkSubpassDependency dependencies[2] = {
+			// after the previous frame's reduce is done reading
+			{ VK_SUBPASS_EXTERNAL, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, 0 },
+			// before this frame's reduce and late cull
+			{ 0, VK_SUBPASS_EXTERNAL, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0 } };
+		VkRenderPassCreateInfo render_pass_info = {};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		render_pass_info.attachmentCount = 1;
+		render_pass_info.pAttachments = &attachment;
+		render_pass_info.subpassCount = 1;
+		render_pass_info.pSubpasses = &subpass;
+		render_pass_info.dependencyCount = 2;
+		render_pass_info.pDependencies = dependencies;
+		if (vkCreateRenderPass(device, &render_pass_info, nullptr, &renderPass) != VK_SUCCESS)
+			return false;
+
+		// Binding 0 reads the level above, binding 1 writes this one
+		VkDescriptorSetLayoutBinding bindings[2] = {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorCount = 1;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[1] = bindings[0];
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		VkDescriptorSetLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 2;
+		layout_info.pBindings = bindings;
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &setLayout) != VK_SUCCESS)
+			return false;
+		VkDescriptorPoolSize pool_sizes[2] = { { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxLevels }, { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxLevels } };
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.maxSets = maxLevels;
+		pool_info.poolSizeCount = 2;
+		pool_info.pPoolSizes = pool_sizes;
+		if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptorPool) != VK_SUCCESS)
+			return false;
+
+		VkPushConstantRange push_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants) };
+		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &setLayout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_range;
+		if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipelineLayout) != VK_SUCCESS)
+			return false;
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = _reduceShader;
+		pipeline_info.stage.pName = "main";
+		pipeline_info.layout = pipelineLayout;
+		return vkCreateComputePipelines(device, _pipelineCache, 1, &pipeline_info, nullptr, &pipeline) == VK_SUCCESS;
+	}
+
+	// (Re)creates the images for a _width x _height pass. Nothing may be using the old ones,
+	// and descriptors pointing at GetPyramidView have to be rewritten afterwards.
+	bool Resize(uint32_t _width, uint32_t _height)
+	{
+		_width = std::max(_width, 1u);
+		_height = std::max(_height, 1u);
+		if (depthImage != nullptr && _width == width && _height == height)
+			return true;
+		DestroyImages();
+		width = _width;
+		height = _height;
+		levelCount = 1;
+		while (levelCount < maxLevels && (std::max(width, height) >> (levelCount + 1)) > 0)
+			++levelCount;
+
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = depthFormat;
+		image_info.extent = { width, height, 1 };
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (allocator->CreateImage(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthImage, &depthMemory) != VK_SUCCESS)
+			return false;
+		image_info.format = VK_FORMAT_R32_SFLOAT;
+		image_info.extent = { GetLevelWidth(0), GetLevelHeight(0), 1 };
+		image_info.mipLevels = levelCount;
+		image_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		if (allocator->CreateImage(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pyramidImage, &pyramidMemory) != VK_SUCCESS)
+			return false;
+
+		VkImageViewCreateInfo view_info = {};
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.image = depthImage;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = depthFormat;
+		view_info.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+		if (vkCreateImageView(device, &view_info, nullptr, &depthView) != VK_SUCCESS)
+			return false;
+		view_info.image = pyramidImage;
+		view_info.format = VK_FORMAT_R32_SFLOAT;
+		view_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+		if (vkCreateImageView(device, &view_info, nullptr, &pyramidView) != VK_SUCCESS)
+			return false;
+		levelViews.assign(levelCount, nullptr);
+		for (uint32_t level = 0; level < levelCount; ++level) {
+			view_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+			if (vkCreateImageView(device, &view_info, nullptr, &levelViews[level]) != VK_SUCCESS)
+				return false;
+		}
+
+		VkFramebufferCreateInfo framebuffer_info = {};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = renderPass;
+		framebuffer_info.attachmentCount = 1;
+		framebuffer_info.pAttachments = &depthView;
+		framebuffer_info.width = width;
+		framebuffer_info.height = height;
+		framebuffer_info.layers = 1;
+		if (vkCreateFramebuffer(device, &framebuffer_info, nullptr, &framebuffer) != VK_SUCCESS)
+			return false;
+
+		// The pyramid stays in GENERAL, the reduce both reads and writes it
+		std::vector<VkDescriptorSetLayout> layouts(levelCount, setLayout);
+		descriptorSets.resize(levelCount);
+		VkDescriptorSetAllocateInfo allocate_info = {};
+		allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocate_info.descriptorPool = descriptorPool;
+		allocate_info.descriptorSetCount = levelCount;
+		allocate_info.pSetLayouts = layouts.data();
+		if (vkAllocateDescriptorSets(device, &allocate_info, descriptorSets.data()) != VK_SUCCESS)
+			return false;
+		for (uint32_t level = 0; level < levelCount; ++level) {
+			VkDescriptorImageInfo infos[2] = {
+				{ nullptr, level == 0 ? depthView : levelViews[level - 1],
+					level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL },
+				{ nullptr, levelViews[level], VK_IMAGE_LAYOUT_GENERAL } };
+			VkWriteDescriptorSet writes[2] = {};
+			for (uint32_t i = 0; i < 2; ++i) {
+				writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i].dstSet = descriptorSets[level];
+				writes[i].dstBinding = i;
+				writes[i].descriptorCount = 1;
+				writes[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+				writes[i].pImageInfo = &infos[i];
+			}
+			vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+		}
+		firstUse = true;
+		return true;
+	}
+
+	// The cull pipeline binds the pyramid in its first phase, before this frame's reduce, so
+	// new images are moved to GENERAL once up front. Returns true if a barrier was recorded.
+	bool RecordFirstUse(VkCommandBuffer _commandBuffer)
+	{
+		if (!firstUse)
+			return false;
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = pyramidImage;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+		firstUse = false;
+		return true;
+	}
+
+	// Starts the depth pass with the far plane cleared, the viewport covering all of it.
+	// The caller binds a pipeline made for GetRenderPass and draws the occluders.
+	void BeginDepthPass(VkCommandBuffer _commandBuffer)
+	{
+		VkClearValue clear = {};
+		clear.depthStencil = { 1.0f, 0u };
+		VkRenderPassBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		begin_info.renderPass = renderPass;
+		begin_info.framebuffer = framebuffer;
+		begin_info.renderArea = { { 0, 0 }, { width, height } };
+		begin_info.clearValueCount = 1;
+		begin_info.pClearValues = &clear;
+		vkCmdBeginRenderPass(_commandBuffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		VkViewport viewport = { 0, 0, static_cast<float>(width), static_cast<float>(height), 0, 1 };
+		VkRect2D scissor = { { 0, 0 }, { width, height } };
+		vkCmdSetViewport(_commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(_commandBuffer, 0, 1, &scissor);
+	}
+
+	void EndDepthPass(VkCommandBuffer _commandBuffer)
+	{
+		vkCmdEndRenderPass(_commandBuffer);
+	}
+
+	// Builds every level from the depth pass, one dispatch per level. Compute shaders
+	// recorded after this can read GetPyramidView.
+	void RecordReduce(VkCommandBuffer _commandBuffer)
+	{
+		// Last frame's levels are dropped, the culls reading them are done once compute is
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = pyramidImage;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		for (uint32_t level = 0; level < levelCount; ++level)
+		{
+			PushConstants constants = {
+				{ level == 0 ? width : GetLevelWidth(level - 1), level == 0 ? height : GetLevelHeight(level - 1) },
+				{ GetLevelWidth(level), GetLevelHeight(level) } };
+			vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[level], 0, nullptr);
+			vkCmdPushConstants(_commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+			vkCmdDispatch(_commandBuffer, (constants.destinationSize[0] + 7) / 8, (constants.destinationSize[1] + 7) / 8, 1);
+
+			// Read by the next level, and by the cull after the last one
+			barrier.subresourceRange.baseMipLevel = level;
+			barrier.subresourceRange.levelCount = 1;
+			vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+	}
+
+	VkRenderPass GetRenderPass() const { return renderPass; }
+	VkImageView GetPyramidView() const { return pyramidView; }
+	uint32_t GetWidth() const { return width; }
+	uint32_t GetHeight() const { return height; }
+	uint32_t GetLevelCount() const { return levelCount; }
+	uint32_t GetLevelWidth(uint32_t _level) const { return std::max(width >> (_level + 1), 1u); }
+	uint32_t GetLevelHeight(uint32_t _level) const { return std::max(height >> (_level + 1), 1u); }
+
+	void Destroy()
+	{
+		if (device == nullptr)
+			return;
+		DestroyImages();
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+		vkDestroyRenderPass(device, renderPass, nullptr);
+		device = nullptr;
+	}
+
+private:
+	void DestroyImages()
+	{
+		if (descriptorPool != nullptr)
+			vkResetDescriptorPool(device, descriptorPool, 0);
+		descriptorSets.clear();
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+		framebuffer = nullptr;
+		for (VkImageView view : levelViews)
+			vkDestroyImageView(device, view, nullptr);
+		levelViews.clear();
+		vkDestroyImageView(device, pyramidView, nullptr);
+		vkDestroyImageView(device, depthView, nullptr);
+		pyramidView = depthView = nullptr;
+		allocator->DestroyImage(pyramidImage, pyramidMemory);
+		allocator->DestroyImage(depthImage, depthMemory);
+		width = height = levelCount = 0;
+		firstUse = false;
+	}
+};
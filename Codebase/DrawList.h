@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "GvkAllocator.h"
+#include "GvkUploader.h"
+#include "GvkRingBuffer.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// The scene as a list of indexed draws, one per unique mesh, ready for a single
+// vkCmdDrawIndexedIndirect. Shaders find a draw's DrawData (transform offset, material,
+// quantization) through a per instance vertex stream holding {transform index, draw
+// index}; each draw's firstInstance points at its instances in that stream, so neither
+// push constants nor gl_DrawID are needed. The commands only change when geometry pages
+// in or out. They live in a DEVICE_LOCAL buffer with a slice per frame in flight and a
+// slice is only re-uploaded when it is out of date.
+class DrawList
+{
+public:
+	// Matches DRAW_DATA in shaders.h
+	struct DrawData {
+		uint32_t transformOffset;
+		uint32_t materialIndex;
+		uint32_t padding[2];
+		float quantOffset[4];	// packed positions: pos = unorm * quantScale + quantOffset
+		float quantScale[4];
+		float bounds[4];		// bounding sphere in model space: center xyz, radius w
+	};
+
+	// Vertex binding 1, one per instance
+	struct InstanceData {
+		uint32_t transformIndex;
+		uint32_t drawIndex;
+	};
+
+private:
+	GvkAllocator* allocator = nullptr;
+	VkBuffer commandBuffer = nullptr;
+	GvkAllocator::Allocation commandMemory;
+	VkBuffer drawDataBuffer = nullptr;
+	GvkAllocator::Allocation drawDataMemory;
+	VkBuffer instanceBuffer = nullptr;
+	GvkAllocator::Allocation instanceMemory;
+	std::vector<VkDrawIndexedIndirectCommand> commands;	// CPU copy, always current
+	std::vector<char> dirty;	// per slice
+	VkDeviceSize sliceSize = 0;
+	unsigned int frameCount = 0;
+	uint32_t instanceCount = 0;
+
+	// Counters since Create
+	VkDeviceSize bytesUploaded = 0;
+	unsigned int slicesUploaded = 0;
+
+public:
+	// Uploads the static per draw data and instance stream through _uploader. Commands
+	// start with no instances until SetCommand fills them in. Every buffer can also be
+	// bound as a storage buffer, so compute passes can read the draws.
+	bool Create(VkPhysicalDevice _physicalDevice, GvkAllocator* _allocator, GvkUploader& _uploader,
+		const std::vector<DrawData>& _draws, const std::vector<InstanceData>& _instances, unsigned int _frameCount)
+	{
+		allocator = _allocator;
+		frameCount = _frameCount;
+		instanceCount = static_cast<uint32_t>(_instances.size());
+		commands.assign(_draws.size(), VkDrawIndexedIndirectCommand{ 0, 0, 0, 0, 0 });
+		dirty.assign(frameCount, 1);
+
+		// Slices are bound as storage buffers at their offsets
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		VkDeviceSize alignment = std::max(properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize(16));
+		VkDeviceSize bytes = std::max<VkDeviceSize>(GetCommandBytes(), sizeof(VkDrawIndexedIndirectCommand));
+		sliceSize = (bytes + alignment - 1) / alignment * alignment;
+
+		if (!_uploader.CreateBuffer(sliceSize * frameCount, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			nullptr, &commandBuffer, &commandMemory, GvkAllocator::CATEGORY_DRAW))
+			return false;
+		if (!_uploader.CreateBuffer(std::max<VkDeviceSize>(_draws.size() * sizeof(DrawData), sizeof(DrawData)),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, _draws.empty() ? nullptr : _draws.data(),
+			&drawDataBuffer, &drawDataMemory, GvkAllocator::CATEGORY_DRAW))
+			return false;
+		return _uploader.CreateBuffer(std::max<VkDeviceSize>(_instances.size() * sizeof(InstanceData), sizeof(InstanceData)),
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, _instances.empty() ? nullptr : _instances.data(),
+			&instanceBuffer, &instanceMemory, GvkAllocator::CATEGORY_DRAW);
+	}
+
+	uint32_t GetDrawCount() const { return static_cast<uint32_t>(commands.size()); }
+	uint32_t GetInstanceCount() const { return instanceCount; }
+	const VkDrawIndexedIndirectCommand& GetCommand(uint32_t _draw) const { return commands[_draw]; }
+
+	// Every slice is marked out of date if the command actually changed
+	void SetCommand(uint32_t _draw, const VkDrawIndexedIndirectCommand& _command)
+	{
+		VkDrawIndexedIndirectCommand& command = commands[_draw];
+		if (memcmp(&command, &_command, sizeof(command)) == 0)
+			return;
+		command = _command;
+		std::fill(dirty.begin(), dirty.end(), 1);
+	}
+
+	// Records a copy of the commands from _ring into _slice when it is out of date, followed
+	// by a barrier for indirect and compute reads. _ring must already be on this frame and
+	// have GetCommandBytes reserved for it: a slice left stale could point into geometry the
+	// pool has since freed, so a full ring is an error and the slice must not be drawn.
+	// Returns false when nothing was recorded.
+	bool RecordUpdate(unsigned int _slice, GvkRingBuffer& _ring, VkCommandBuffer _commandBuffer)
+	{
+		if (!dirty[_slice] || commands.empty())
+			return false;
+		GvkRingBuffer::Allocation staging = _ring.Push(commands.data(), GetCommandBytes());
+		if (staging.pointer == nullptr) {
+			std::cout << "Draw List Error: frame ring has no room for the draw commands, slice " << _slice << " is out of date.\n";
+			return false;
+		}
+		dirty[_slice] = 0;
+		bytesUploaded += GetCommandBytes();
+		++slicesUploaded;
+
+		VkBufferCopy region = { staging.offset, sliceSize * _slice, GetCommandBytes() };
+		vkCmdCopyBuffer(_commandBuffer, _ring.GetBuffer(), commandBuffer, 1, &region);
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = commandBuffer;
+		barrier.offset = sliceSize * _slice;
+		barrier.size = sliceSize;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return true;
+	}
+
+	bool IsCurrent(unsigned int _slice) const { return !dirty[_slice] || commands.empty(); }
+	VkBuffer GetCommandBuffer() const { return commandBuffer; }
+	VkDeviceSize GetCommandOffset(unsigned int _slice) const { return sliceSize * _slice; }
+	VkDeviceSize GetCommandBytes() const { return VkDeviceSize(commands.size()) * sizeof(VkDrawIndexedIndirectCommand); }
+	VkBuffer GetDrawDataBuffer() const { return drawDataBuffer; }
+	VkBuffer GetInstanceBuffer() const { return instanceBuffer; }
+
+	void ReportStats(const char* _label) const
+	{
+		std::cout << _label << ": " << commands.size() << " draw(s), command slices uploaded " << slicesUploaded
+			<< " time(s), " << bytesUploaded << " bytes\n";
+	}
+
+	void Destroy()
+	{
+		if (allocator == nullptr)
+			return;
+		allocator->DestroyBuffer(commandBuffer, commandMemory);
+		allocator->DestroyBuffer(drawDataBuffer, drawDataMemory);
+		allocator->DestroyBuffer(instanceBuffer, instanceMemory);
+		commands.clear();
+		dirty.clear();
+		allocator = nullptr;
+	}
+};
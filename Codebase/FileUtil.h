@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <initializer_list>
+#include <cstdint>
+#include <cstddef>
+
+// Small helpers shared by the on-disk caches (scene blob, shader and pipeline caches)
+// and the load time mesh passes.
+namespace FileUtil {
+
+	// 64 bit FNV-1a, pass a previous result as _hash to continue it over more data
+	inline uint64_t Hash(const void* _data, size_t _size, uint64_t _hash = 14695981039346656037ull)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(_data);
+		for (size_t i = 0; i < _size; ++i)
+			_hash = (_hash ^ bytes[i]) * 1099511628211ull;
+		return _hash;
+	}
+
+	struct Chunk {
+		const void* data;
+		size_t size;
+	};
+
+	// Writes the chunks back to back to a temporary name and renames it over _path,
+	// so a crash or a concurrent reader never sees a torn file. Creates missing
+	// parent directories.
+	inline bool WriteAtomic(const std::string& _path, std::initializer_list<Chunk> _chunks)
+	{
+		std::error_code error;
+		std::filesystem::path parent = std::filesystem::path(_path).parent_path();
+		if (!parent.empty())
+			std::filesystem::create_directories(parent, error);
+		std::string temporary = _path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+			for (const Chunk& chunk : _chunks)
+				file.write(static_cast<const char*>(chunk.data), static_cast<std::streamsize>(chunk.size));
+			if (!file.good()) {
+				file.close();
+				std::filesystem::remove(temporary, error);
+				return false;
+			}
+		}
+		std::filesystem::rename(temporary, _path, error);
+		if (error) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "GvkAllocator.h"
+#include "TransformStore.h"
+#include "DrawList.h"
+#include "DepthPyramid.h"
+// Expects Gateware.h (with GVulkanSurface and GMath enabled) to be included first, like renderer.h
+
+// Culls every instance of a DrawList against the view frustum on the GPU. Each frame a
+// compute pass copies that frame's draw commands with no instances, then tests each
+// instance's bounding sphere (DrawData::bounds under its world matrix) against the six
+// planes and appends the survivors to their draw's run of a compacted instance stream,
+// bumping the draw's instanceCount. The renderer then draws from these outputs instead
+// of the DrawList's. Visible and culled totals are copied to host memory and read back
+// the next time the same frame comes around, so nothing ever waits on them.
+//
+// Created for occlusion, the culling runs in two phases around a DepthPyramid. Record
+// keeps only what was visible last frame, which the renderer draws into the pyramid's
+// depth pass, and RecordLate tests every instance against the pyramid built from it,
+// appending the newly visible ones to the same outputs.
+class FrustumCuller
+{
+	// Matches CULL_DATA in Shaders::cullShader and Shaders::occlusionCullShader
+	struct PushConstants {
+		GW::MATH::GMATRIXF viewProjection;
+		uint32_t instanceCount;
+		uint32_t drawCount;
+		uint32_t pass;
+		uint32_t pyramidLevels;
+		uint32_t viewportSize[2];
+		uint32_t padding[2];
+	};
+
+	struct Counters {
+		uint32_t visible, culled, occluded;
+	};
+
+	VkDevice device = nullptr;
+	GvkAllocator* allocator = nullptr;
+	const DrawList* drawList = nullptr;
+	VkBuffer commandBuffer = nullptr;		// per slice: compacted commands
+	GvkAllocator::Allocation commandMemory;
+	VkBuffer instanceBuffer = nullptr;		// per slice: compacted instance stream
+	GvkAllocator::Allocation instanceMemory;
+	VkBuffer counterBuffer = nullptr;		// per slice: visible, culled, occluded
+	GvkAllocator::Allocation counterMemory;
+	VkBuffer readbackBuffer = nullptr;		// HOST_VISIBLE copy of every slice's counters
+	GvkAllocator::Allocation readbackMemory;
+	VkBuffer visibilityBuffer = nullptr;	// per instance, shared by every slice: visible last frame
+	GvkAllocator::Allocation visibilityMemory;
+	bool occlusion = false;
+	bool visibilityCleared = false;
+	PushConstants lateConstants = {};	// what Record left for RecordLate
+	VkDescriptorSetLayout setLayout = nullptr;
+	VkDescriptorPool descriptorPool = nullptr;
+	std::vector<VkDescriptorSet> descriptorSets;	// per slice
+	VkPipelineLayout pipelineLayout = nullptr;
+	VkPipeline pipeline = nullptr;
+	VkDeviceSize commandSliceSize = 0, instanceSliceSize = 0, counterSliceSize = 0;
+	std::vector<char> pending;	// per slice, counters were recorded and not read yet
+
+	// Totals of the counters read back since Create
+	uint64_t visibleInstances = 0;
+	uint64_t culledInstances = 0;
+	uint64_t occludedInstances = 0;
+	unsigned int framesRead = 0;
+	Counters last = {};
+
+public:
+	// Entry point of Shaders::cullShader, or of Shaders::occlusionCullShader with _occlusion
+	static const char* EntryPoint(bool _occlusion) { return _occlusion ? "mainOcclusion" : "main"; }
+
+	// Builds the pipeline from _cullShader, the source matching _occlusion compiled at EntryPoint(_occlusion),
+	// and a descriptor set per slice, each reading the matching slices of _transforms and
+	// _drawList's commands. With _occlusion, SetDepthPyramid has to be called before culling.
+	bool Create(VkPhysicalDevice _physicalDevice, VkDevice _device, GvkAllocator* _allocator, const TransformStore& _transforms,
+		const DrawList& _drawList, VkShaderModule _cullShader, VkPipelineCache _pipelineCache, unsigned int _frameCount,
+		bool _occlusion = false)
+	{
+		device = _device;
+		allocator = _allocator;
+		drawList = &_drawList;
+		occlusion = _occlusion;
+		visibilityCleared = false;
+		pending.assign(_frameCount, 0);
+
+		// Every slice is bound at its own offset
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		VkDeviceSize alignment = std::max(properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize(16));
+		auto alignUp = [alignment](VkDeviceSize _size) { return (std::max<VkDeviceSize>(_size, 16) + alignment - 1) / alignment * alignment; };
+		commandSliceSize = alignUp(_drawList.GetCommandBytes());
+		instanceSliceSize = alignUp(VkDeviceSize(_drawList.GetInstanceCount()) * sizeof(DrawList::InstanceData));
+		counterSliceSize = alignUp(sizeof(Counters));
+
+		if (allocator->CreateBuffer(commandSliceSize * _frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &commandBuffer, &commandMemory, GvkAllocator::CATEGORY_DRAW) != VK_SUCCESS ||
+			allocator->CreateBuffer(instanceSliceSize * _frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &instanceBuffer, &instanceMemory, GvkAllocator::CATEGORY_DRAW) != VK_SUCCESS ||
+			allocator->CreateBuffer(counterSliceSize * _frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &counterBuffer, &counterMemory, GvkAllocator::CATEGORY_DRAW) != VK_SUCCESS ||
+			allocator->CreateBuffer(sizeof(Counters) * _frameCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &readbackBuffer, &readbackMemory,
+			GvkAllocator::CATEGORY_DRAW) != VK_SUCCESS)
+			return false;
+		if (occlusion && allocator->CreateBuffer(VkDeviceSize(std::max(_drawList.GetInstanceCount(), 1u)) * sizeof(uint32_t),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&visibilityBuffer, &visibilityMemory, GvkAllocator::CATEGORY_DRAW) != VK_SUCCESS)
+			return false;
+
+		// Set 0: inputs 0-3, outputs 4-6, all plain storage buffers. The pyramid (7) and
+		// visibility (8) are only used by the occlusion entry point, and only written for it.
+		VkDescriptorSetLayoutBinding bindings[9] = {};
+		for (uint32_t i = 0; i < 9; ++i) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		VkDescriptorSetLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 9;
+		layout_info.pBindings = bindings;
+		if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &setLayout) != VK_SUCCESS)
+			return false;
+		VkDescriptorPoolSize pool_sizes[2] = { { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8 * _frameCount },
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, _frameCount } };
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.maxSets = _frameCount;
+		pool_info.poolSizeCount = 2;
+		pool_info.pPoolSizes = pool_sizes;
+		if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptorPool) != VK_SUCCESS)
+			return false;
+		std::vector<VkDescriptorSetLayout> layouts(_frameCount, setLayout);
+		descriptorSets.resize(_frameCount);
+		VkDescriptorSetAllocateInfo allocate_info = {};
+		allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocate_info.descriptorPool = descriptorPool;
+		allocate_info.descriptorSetCount = _frameCount;
+		allocate_info.pSetLayouts = layouts.data();
+		if (vkAllocateDescriptorSets(device, &allocate_info, descriptorSets.data()) != VK_SUCCESS)
+			return false;
+		for (unsigned int slice = 0; slice < _frameCount; ++slice) {
+			VkDescriptorBufferInfo infos[7] = {
+				{ _transforms.GetBuffer(), _transforms.GetSliceOffset(slice), std::max<VkDeviceSize>(_transforms.GetRange(), sizeof(GW::MATH::GMATRIXF)) },
+				{ _drawList.GetDrawDataBuffer(), 0, VK_WHOLE_SIZE },
+				{ _drawList.GetInstanceBuffer(), 0, VK_WHOLE_SIZE },
+				{ _drawList.GetCommandBuffer(), _drawList.GetCommandOffset(slice), commandSliceSize },
+				{ commandBuffer, commandSliceSize * slice, commandSliceSize },
+				{ instanceBuffer, instanceSliceSize * slice, instanceSliceSize },
+				{ counterBuffer, counterSliceSize * slice, counterSliceSize } };
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = descriptorSets[slice];
+			write.dstBinding = 0;
+			write.descriptorCount = 7;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			write.pBufferInfo = infos;
+			vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+			if (occlusion) {
+				VkDescriptorBufferInfo visibility_info = { visibilityBuffer, 0, VK_WHOLE_SIZE };
+				write.dstBinding = 8;
+				write.descriptorCount = 1;
+				write.pBufferInfo = &visibility_info;
+				vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+			}
+		}
+
+		VkPushConstantRange push_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants) };
+		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &setLayout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_range;
+		if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipelineLayout) != VK_SUCCESS)
+			return false;
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = _cullShader;
+		pipeline_info.stage.pName = EntryPoint(occlusion);
+		pipeline_info.layout = pipelineLayout;
+		return vkCreateComputePipelines(device, _pipelineCache, 1, &pipeline_info, nullptr, &pipeline) == VK_SUCCESS;
+	}
+
+	// Points every slice at _pyramid's levels. Call again after each DepthPyramid::Resize.
+	void SetDepthPyramid(const DepthPyramid& _pyramid)
+	{
+		lateConstants.pyramidLevels = _pyramid.GetLevelCount();
+		lateConstants.viewportSize[0] = _pyramid.GetWidth();
+		lateConstants.viewportSize[1] = _pyramid.GetHeight();
+		VkDescriptorImageInfo image_info = { nullptr, _pyramid.GetPyramidView(), VK_IMAGE_LAYOUT_GENERAL };
+		for (VkDescriptorSet set : descriptorSets) {
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = set;
+			write.dstBinding = 7;
+			write.descriptorCount = 1;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			write.pImageInfo = &image_info;
+			vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+		}
+	}
+
+	// Reads _slice's counters from the last time it was culled. Only call once that
+	// submission is known to be done, e.g. after waiting on the slice's fence.
+	void ReadCounters(unsigned int _slice)
+	{
+		if (!pending[_slice])
+			return;
+		pending[_slice] = 0;
+		memcpy(&last, static_cast<const char*>(readbackMemory.mapped) + sizeof(Counters) * _slice, sizeof(Counters));
+		visibleInstances += last.visible;
+		culledInstances += last.culled;
+		occludedInstances += last.occluded;
+		++framesRead;
+	}
+
+	// Records the reset and cull dispatches for _slice into _commandBuffer, after the
+	// transform and draw command updates. Returns false if there is nothing to cull.
+	// For occlusion this is the first phase: the outputs then hold what was visible last
+	// frame, ready to be drawn into the depth pass, and RecordLate has to follow.
+	bool Record(unsigned int _slice, VkCommandBuffer _commandBuffer, const GW::MATH::GMATRIXF& _viewProjection)
+	{
+		if (drawList->GetDrawCount() == 0)
+			return false;
+		PushConstants constants = lateConstants;
+		constants.viewProjection = _viewProjection;
+		constants.instanceCount = drawList->GetInstanceCount();
+		constants.drawCount = drawList->GetDrawCount();
+
+		// Nothing was visible before the first frame
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		if (occlusion && !visibilityCleared) {
+			vkCmdFillBuffer(_commandBuffer, visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+			visibilityCleared = true;
+		}
+
+		vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[_slice], 0, nullptr);
+
+		// Pass 0: commands without instances, counters at zero
+		constants.pass = 0;
+		vkCmdPushConstants(_commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+		vkCmdDispatch(_commandBuffer, (constants.drawCount + 63) / 64, 1, 1);
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		// Pass 1: one thread per instance
+		constants.pass = 1;
+		vkCmdPushConstants(_commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+		if (constants.instanceCount > 0)
+			vkCmdDispatch(_commandBuffer, (constants.instanceCount + 63) / 64, 1, 1);
+		if (!occlusion) {
+			Finish(_slice, _commandBuffer);
+			return true;
+		}
+
+		// The depth pass draws what pass 1 kept, pass 2 appends to it
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		lateConstants = constants;
+		return true;
+	}
+
+	// Second phase of occlusion culling, after Record and the pyramid's reduce: tests every
+	// instance against the pyramid and appends the visible ones the first phase skipped
+	void RecordLate(unsigned int _slice, VkCommandBuffer _commandBuffer)
+	{
+		if (!occlusion)
+			return;
+
+		// The depth pass is done reading the outputs pass 2 appends to
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+		vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[_slice], 0, nullptr);
+		lateConstants.pass = 2;
+		vkCmdPushConstants(_commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &lateConstants);
+		if (lateConstants.instanceCount > 0)
+			vkCmdDispatch(_commandBuffer, (lateConstants.instanceCount + 63) / 64, 1, 1);
+		Finish(_slice, _commandBuffer);
+	}
+
+	VkBuffer GetCommandBuffer() const { return commandBuffer; }
+	VkDeviceSize GetCommandOffset(unsigned int _slice) const { return commandSliceSize * _slice; }
+	VkBuffer GetInstanceBuffer() const { return instanceBuffer; }
+	VkDeviceSize GetInstanceOffset(unsigned int _slice) const { return instanceSliceSize * _slice; }
+
+	void ReportStats(const char* _label) const
+	{
+		std::cout << _label << ": last frame " << last.visible << " visible, " << last.culled << " culled";
+		if (occlusion)
+			std::cout << ", " << last.occluded << " occluded";
+		uint64_t total = visibleInstances + culledInstances + occludedInstances;
+		if (total > 0) {
+			std::cout << ", " << 100.0 * static_cast<double>(culledInstances) / static_cast<double>(total)
+				<< "% culled";
+			if (occlusion)
+				std::cout << " and " << 100.0 * static_cast<double>(occludedInstances) / static_cast<double>(total) << "% occluded";
+			std::cout << " over " << framesRead << " frame(s)";
+		}
+		std::cout << "\n";
+	}
+
+	void Destroy()
+	{
+		if (device == nullptr)
+			return;
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+		allocator->DestroyBuffer(commandBuffer, commandMemory);
+		allocator->DestroyBuffer(instanceBuffer, instanceMemory);
+		allocator->DestroyBuffer(counterBuffer, counterMemory);
+		allocator->DestroyBuffer(readbackBuffer, readbackMemory);
+		allocator->DestroyBuffer(visibilityBuffer, visibilityMemory);
+		descriptorSets.clear();
+		device = nullptr;
+	}
+
+private:
+	// Results feed the draws and the counter copy, read back by ReadCounters
+	void Finish(unsigned int _slice, VkCommandBuffer _commandBuffer)
+	{
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		VkBufferCopy region = { counterSliceSize * _slice, sizeof(Counters) * _slice, sizeof(Counters) };
+		vkCmdCopyBuffer(_commandBuffer, counterBuffer, readbackBuffer, 1, &region);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		pending[_slice] = 1;
+	}
+};
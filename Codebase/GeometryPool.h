@@ -0,0 +1,320 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "GvkAllocator.h"
+#include "GvkUploader.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// Fixed size GPU arenas for vertices and indices that level geometry is streamed into.
+// The unit of residency is a group: one model's vertex range and the index range of all
+// of its submeshes, which only ever index into that vertex range. The CPU keeps the
+// source data, the pool only points at it; groups are requested every frame they are wanted, paged in nearest first
+// under a per frame upload budget, and evicted least recently used when the arenas are
+// full. Evicted ranges are only reused once every frame that might still read them
+// has retired.
+class GeometryPool
+{
+public:
+	struct Group {
+		uint32_t vertexStart, vertexCount;	// in the source vertices
+		uint32_t indexStart, indexCount;	// in the source indices
+	};
+
+private:
+	// First fit over offset sorted free ranges, in elements
+	struct Arena {
+		struct Range {
+			uint32_t offset, size;
+		};
+		std::vector<Range> freeRanges;
+		uint32_t capacity = 0;
+		uint32_t used = 0;
+
+		void Reset(uint32_t _capacity)
+		{
+			capacity = _capacity;
+			used = 0;
+			freeRanges.assign(1, { 0, _capacity });
+		}
+
+		bool Allocate(uint32_t _size, uint32_t& _offset)
+		{
+			for (size_t i = 0; i < freeRanges.size(); ++i)
+				if (freeRanges[i].size >= _size) {
+					_offset = freeRanges[i].offset;
+					freeRanges[i].offset += _size;
+					freeRanges[i].size -= _size;
+					if (freeRanges[i].size == 0)
+						freeRanges.erase(freeRanges.begin() + i);
+					used += _size;
+					return true;
+				}
+			return false;
+		}
+
+		void Free(uint32_t _offset, uint32_t _size)
+		{
+			used -= _size;
+			auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), _offset,
+				[](const Range& _a, uint32_t _b) { return _a.offset < _b; });
+			if (next != freeRanges.end() && _offset + _size == next->offset) {
+				_size += next->size;
+				next = freeRanges.erase(next);
+			}
+			if (next != freeRanges.begin() && (next - 1)->offset + (next - 1)->size == _offset) {
+				(next - 1)->size += _size;
+				return;
+			}
+			freeRanges.insert(next, { _offset, _size });
+		}
+	};
+
+	enum State : uint8_t { NOT_RESIDENT, LOADING, RESIDENT };
+	struct Residency {
+		State state = NOT_RESIDENT;
+		uint32_t vertexOffset = 0;	// in the arenas
+		uint32_t indexOffset = 0;
+		uint64_t ticket = 0;		// uploader ticket while LOADING
+		uint64_t lastUsed = 0;		// frame it was last requested
+	};
+	struct DeferredFree {
+		uint32_t vertexOffset, vertexCount, indexOffset, indexCount;
+		uint64_t frame;
+		uint64_t ticket;	// uploader ticket that may still write the ranges, 0 for none
+	};
+	struct PageIn {
+		float distance;
+		uint32_t group;
+	};
+
+	GvkAllocator* allocator = nullptr;
+	GvkUploader* uploader = nullptr;
+	VkBuffer vertexBuffer = nullptr;
+	VkBuffer indexBuffer = nullptr;
+	GvkAllocator::Allocation vertexMemory;
+	GvkAllocator::Allocation indexMemory;
+	Arena vertexArena, indexArena;
+	const char* vertexSource = nullptr;		// not owned, has to outlive the pool
+	const uint32_t* indexSource = nullptr;
+	uint32_t vertexStride = 0;
+	std::vector<Group> groups;
+	std::vector<Residency> residency;
+	std::vector<bool> oversized;			// groups already reported as never fitting the staging ring
+	std::vector<PageIn> requests;			// this frame's, served nearest first
+	std::vector<DeferredFree> deferredFrees;
+	unsigned int frameCount = 0;
+	uint64_t frame = 0;
+	uint64_t residencyVersion = 0;	// bumped whenever a group becomes resident or is evicted
+	VkDeviceSize uploadBytesPerFrame = 4ull << 20;
+
+	// Counters since Create
+	VkDeviceSize bytesStreamed = 0;
+	unsigned int groupsStreamed = 0;
+	unsigned int evictions = 0;
+
+public:
+	// Keeps pointers to the source geometry and creates arenas of at most the given budgets, no
+	// bigger than the whole level. _frameCount is the number of frames in flight.
+	bool Create(GvkAllocator* _allocator, GvkUploader* _uploader, const void* _vertices, uint32_t _vertexStride, uint32_t _vertexCount,
+		const uint32_t* _indices, uint32_t _indexCount, const std::vector<Group>& _groups,
+		VkDeviceSize _vertexBudget, VkDeviceSize _indexBudget, unsigned int _frameCount)
+	{
+		allocator = _allocator;
+		uploader = _uploader;
+		vertexStride = _vertexStride;
+		frameCount = _frameCount;
+		vertexSource = static_cast<const char*>(_vertices);
+		indexSource = _indices;
+		groups = _groups;
+		residency.assign(groups.size(), Residency());
+		oversized.assign(groups.size(), false);
+
+		uint32_t vertexCapacity = static_cast<uint32_t>(std::min<VkDeviceSize>(_vertexBudget / _vertexStride, _vertexCount));
+		uint32_t indexCapacity = static_cast<uint32_t>(std::min<VkDeviceSize>(_indexBudget / sizeof(uint32_t), _indexCount));
+		vertexArena.Reset(vertexCapacity);
+		indexArena.Reset(indexCapacity);
+		if (!uploader->CreateBuffer(std::max<VkDeviceSize>(VkDeviceSize(vertexCapacity) * _vertexStride, 16), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			nullptr, &vertexBuffer, &vertexMemory, GvkAllocator::CATEGORY_VERTEX))
+			return false;
+		if (!uploader->CreateBuffer(std::max<VkDeviceSize>(VkDeviceSize(indexCapacity) * sizeof(uint32_t), 16), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			nullptr, &indexBuffer, &indexMemory, GvkAllocator::CATEGORY_INDEX))
+			return false;
+
+		// Groups with nothing to draw are resident from the start
+		for (size_t i = 0; i < groups.size(); ++i)
+			if (groups[i].indexCount == 0)
+				residency[i].state = RESIDENT;
+		return true;
+	}
+
+	// Call once per frame before any Request. Promotes finished uploads and releases
+	// evicted ranges no frame in flight can still be reading.
+	void BeginFrame()
+	{
+		++frame;
+		for (Residency& group : residency)
+			if (group.state == LOADING && uploader->IsComplete(group.ticket)) {
+				group.state = RESIDENT;
+				++residencyVersion;
+			}
+		size_t kept = 0;
+		for (const DeferredFree& free : deferredFrees) {
+			if (free.frame + frameCount < frame && uploader->IsComplete(free.ticket)) {
+				vertexArena.Free(free.vertexOffset, free.vertexCount);
+				indexArena.Free(free.indexOffset, free.indexCount);
+			}
+			else
+				deferredFrees[kept++] = free;
+		}
+		deferredFrees.resize(kept);
+		requests.clear();
+	}
+
+	// Marks _group as wanted this frame, _distance orders the page ins. Only the first
+	// request per frame counts.
+	void Request(uint32_t _group, float _distance)
+	{
+		Residency& group = residency[_group];
+		if (group.lastUsed == frame)
+			return;
+		group.lastUsed = frame;
+		if (group.state == NOT_RESIDENT)
+			requests.push_back({ _distance, _group });
+	}
+
+	// Starts uploads for this frame's requests, nearest first, evicting what has gone
+	// unused the longest when the arenas are full. A group is only started once the
+	// uploader can stage all of it, so this never waits on the GPU; groups bigger than
+	// the whole staging ring are skipped.
+	void Update()
+	{
+		std::sort(requests.begin(), requests.end(), [](const PageIn& a, const PageIn& b) { return a.distance < b.distance; });
+		VkDeviceSize budget = uploadBytesPerFrame;
+		bool uploaded = false;
+		for (const PageIn& request : requests) {
+			const Group& group = groups[request.group];
+			VkDeviceSize vertexBytes = VkDeviceSize(group.vertexCount) * vertexStride;
+			VkDeviceSize indexBytes = VkDeviceSize(group.indexCount) * sizeof(uint32_t);
+			VkDeviceSize bytes = vertexBytes + indexBytes;
+			if (bytes > budget && uploaded)
+				break;	// always let one through so big groups still make progress
+			VkDeviceSize staged = ((vertexBytes + 15) & ~VkDeviceSize(15)) + ((indexBytes + 15) & ~VkDeviceSize(15));
+			if (staged > uploader->GetStagingSize()) {
+				if (!oversized[request.group]) {
+					std::cout << "Geometry Pool Error: group " << request.group << " (" << bytes / 1024
+						<< " KB) is bigger than the staging ring and is never streamed.\n";
+					oversized[request.group] = true;
+				}
+				continue;
+			}
+			if (staged > uploader->GetStagingAvailable())
+				break;	// staging frees up as earlier uploads land, try again next frame
+			Residency& target = residency[request.group];
+			if (!Place(group, target))
+				break;	// nearer groups come first, so stop rather than evict for farther ones
+			if (!uploader->Upload(vertexBuffer, VkDeviceSize(target.vertexOffset) * vertexStride,
+				vertexSource + size_t(group.vertexStart) * vertexStride, VkDeviceSize(group.vertexCount) * vertexStride) ||
+				!uploader->Upload(indexBuffer, VkDeviceSize(target.indexOffset) * sizeof(uint32_t),
+				indexSource + group.indexStart, VkDeviceSize(group.indexCount) * sizeof(uint32_t))) {
+				// Part of the group may already be queued, keep its ranges until that lands
+				deferredFrees.push_back({ target.vertexOffset, group.vertexCount, target.indexOffset, group.indexCount,
+					frame, uploader->GetPendingTicket() });
+				break;
+			}
+			target.state = LOADING;
+			target.ticket = uploader->GetPendingTicket();
+			budget -= std::min(budget, bytes);
+			bytesStreamed += bytes;
+			++groupsStreamed;
+			uploaded = true;
+		}
+		if (uploaded)
+			uploader->Submit();
+	}
+
+	bool IsResident(uint32_t _group) const { return residency[_group].state == RESIDENT; }
+	uint32_t GetVertexOffset(uint32_t _group) const { return residency[_group].vertexOffset; }
+	// Where _sourceFirstIndex (an index into the source indices of _group) sits in the arena
+	uint32_t GetFirstIndex(uint32_t _group, uint32_t _sourceFirstIndex) const
+	{
+		return residency[_group].indexOffset + (_sourceFirstIndex - groups[_group].indexStart);
+	}
+	// Changes whenever IsResident or the offsets of any group change
+	uint64_t GetResidencyVersion() const { return residencyVersion; }
+	VkBuffer GetVertexBuffer() const { return vertexBuffer; }
+	VkBuffer GetIndexBuffer() const { return indexBuffer; }
+	void SetUploadBytesPerFrame(VkDeviceSize _bytes) { uploadBytesPerFrame = _bytes; }
+
+	void ReportStats(const char* _label) const
+	{
+		unsigned int resident = 0;
+		for (const Residency& group : residency)
+			resident += group.state == RESIDENT ? 1 : 0;
+		std::cout << _label << ": " << resident << "/" << groups.size() << " groups resident, vertices "
+			<< VkDeviceSize(vertexArena.used) * vertexStride / 1024 << "/" << VkDeviceSize(vertexArena.capacity) * vertexStride / 1024
+			<< " KB, indices " << VkDeviceSize(indexArena.used) * sizeof(uint32_t) / 1024 << "/"
+			<< VkDeviceSize(indexArena.capacity) * sizeof(uint32_t) / 1024 << " KB, streamed " << bytesStreamed / 1024
+			<< " KB in " << groupsStreamed << " group(s), " << evictions << " eviction(s)\n";
+	}
+
+	void Destroy()
+	{
+		if (allocator == nullptr)
+			return;
+		allocator->DestroyBuffer(vertexBuffer, vertexMemory);
+		allocator->DestroyBuffer(indexBuffer, indexMemory);
+		vertexSource = nullptr;
+		indexSource = nullptr;
+		allocator = nullptr;
+	}
+
+private:
+	// Finds arena space for _group, evicting least recently used groups not wanted this
+	// frame. Evicted space comes back frameCount frames later, so this can fail for a
+	// while and succeed on a later frame.
+	bool Place(const Group& _group, Residency& _target)
+	{
+		if (_group.vertexCount > vertexArena.capacity || _group.indexCount > indexArena.capacity)
+			return false;	// never fits, the arenas are smaller than this one group
+		while (true) {
+			uint32_t vertexOffset = 0, indexOffset = 0;
+			if (vertexArena.Allocate(_group.vertexCount, vertexOffset)) {
+				if (indexArena.Allocate(_group.indexCount, indexOffset)) {
+					_target.vertexOffset = vertexOffset;
+					_target.indexOffset = indexOffset;
+					return true;
+				}
+				vertexArena.Free(vertexOffset, _group.vertexCount);
+			}
+			// Stop evicting once enough is on its way back, the space arrives in a few frames
+			VkDeviceSize pendingVertices = 0, pendingIndices = 0;
+			for (const DeferredFree& free : deferredFrees) {
+				pendingVertices += free.vertexCount;
+				pendingIndices += free.indexCount;
+			}
+			if (pendingVertices >= _group.vertexCount && pendingIndices >= _group.indexCount)
+				return false;
+			if (!EvictLeastRecentlyUsed())
+				return false;
+		}
+	}
+
+	bool EvictLeastRecentlyUsed()
+	{
+		uint32_t victim = UINT32_MAX;
+		for (uint32_t i = 0; i < residency.size(); ++i)
+			if (residency[i].state == RESIDENT && groups[i].indexCount > 0 && residency[i].lastUsed < frame &&
+				(victim == UINT32_MAX || residency[i].lastUsed < residency[victim].lastUsed))
+				victim = i;
+		if (victim == UINT32_MAX)
+			return false;
+		Residency& group = residency[victim];
+		deferredFrees.push_back({ group.vertexOffset, groups[victim].vertexCount, group.indexOffset, groups[victim].indexCount, frame, 0 });
+		group.state = NOT_RESIDENT;
+		++residencyVersion;
+		++evictions;
+		return true;
+	}
+};
@@ -0,0 +1,564 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <cstring>
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// Block based sub-allocator for every buffer and image the renderer creates.
+// Memory is taken from the driver in large blocks, one pool of blocks per memory type
+// (buffers and images are pooled apart so bufferImageGranularity never matters), and
+// handed out from each block's offset sorted free list. Requests are rounded up to size
+// classes so freed ranges are easy to reuse; anything over half a block gets its own
+// dedicated allocation. HOST_VISIBLE blocks stay mapped for their whole life.
+// Every allocation is tagged with a category so the report can say where memory goes,
+// next to the driver's budget when VK_EXT_memory_budget is supported.
+class GvkAllocator
+{
+public:
+	enum Category : uint32_t {
+		CATEGORY_OTHER,
+		CATEGORY_VERTEX,
+		CATEGORY_INDEX,
+		CATEGORY_TRANSFORM,
+		CATEGORY_MATERIAL,
+		CATEGORY_DRAW,			// indirect commands, per draw data and the instance stream
+		CATEGORY_FRAME_DATA,	// frame ring: scene data and per frame staging
+		CATEGORY_STAGING,		// uploader's staging ring
+		CATEGORY_COUNT
+	};
+
+	static const char* CategoryName(uint32_t _category)
+	{
+		static const char* names[CATEGORY_COUNT] = { "other", "vertex", "index", "transform", "material", "draw", "frame data", "staging" };
+		return _category < CATEGORY_COUNT ? names[_category] : "?";
+	}
+
+	struct Allocation {
+		VkDeviceMemory memory = nullptr;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;			// size class actually reserved
+		void* mapped = nullptr;			// null unless HOST_VISIBLE
+		uint32_t pool = UINT32_MAX;		// memory type * 2 + (1 for images)
+		uint32_t block = UINT32_MAX;	// UINT32_MAX for dedicated allocations
+		uint32_t category = CATEGORY_OTHER;
+	};
+
+	struct CategoryStats {
+		VkDeviceSize deviceBytes = 0;	// in DEVICE_LOCAL heaps
+		VkDeviceSize hostBytes = 0;
+		unsigned int allocationCount = 0;
+	};
+
+	struct HeapStats {
+		VkDeviceSize blockBytes = 0;	// taken from the driver
+		VkDeviceSize usedBytes = 0;		// handed out to resources
+		VkDeviceSize largestFree = 0;	// sum over blocks of each block's biggest free range
+		VkDeviceSize freeBytes = 0;
+		unsigned int blockCount = 0;
+		unsigned int allocationCount = 0;
+		// 0 when all free space is one range, towards 1 as it splinters
+		float Fragmentation() const { return freeBytes ? 1.0f - static_cast<float>(largestFree) / freeBytes : 0.0f; }
+	};
+
+private:
+	struct Range {
+		VkDeviceSize offset, size;
+	};
+	struct Block {
+		VkDeviceMemory memory = nullptr;
+		VkDeviceSize size = 0;
+		VkDeviceSize used = 0;
+		char* mapped = nullptr;
+		unsigned int allocationCount = 0;
+		std::vector<Range> freeRanges;	// sorted by offset, never adjacent
+	};
+	struct Pool {
+		std::vector<Block> blocks;		// empty slots (memory == nullptr) are reused
+	};
+
+	VkDevice device = nullptr;
+	VkPhysicalDevice physicalDevice = nullptr;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	bool budgetSupported = false;
+	CategoryStats categories[CATEGORY_COUNT];
+	VkDeviceSize blockSize = 0;
+	std::vector<Pool> pools;
+	std::vector<VkDeviceSize> dedicatedBytes;	// per heap
+	std::vector<unsigned int> dedicatedCount;
+	unsigned int driverAllocations = 0;
+	std::mutex mutex;
+
+public:
+	bool Create(VkPhysicalDevice _physicalDevice, VkDevice _device, VkDeviceSize _blockSize = 64ull << 20)
+	{
+		device = _device;
+		physicalDevice = _physicalDevice;
+		blockSize = _blockSize;
+		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memoryProperties);
+
+		// The budget query needs the extension and vkGetPhysicalDeviceMemoryProperties2 (1.1)
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, extensions.data());
+		budgetSupported = false;
+		if (properties.apiVersion >= VK_API_VERSION_1_1)
+			for (const VkExtensionProperties& extension : extensions)
+				if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+					budgetSupported = true;
+		pools.assign(memoryProperties.memoryTypeCount * 2, Pool());
+		dedicatedBytes.assign(memoryProperties.memoryHeapCount, 0);
+		dedicatedCount.assign(memoryProperties.memoryHeapCount, 0);
+		return true;
+	}
+
+	// Rounds up to one of four steps per power of two (256, 320, 384, 448, 512, ...)
+	static VkDeviceSize SizeClass(VkDeviceSize _size)
+	{
+		if (_size <= 256)
+			return 256;
+		VkDeviceSize power = 256;
+		while (power * 2 < _size)
+			power *= 2;
+		VkDeviceSize step = power / 4;
+		return (_size + step - 1) / step * step;
+	}
+
+	// Reserves memory that satisfies _requirements and has _properties
+	bool Allocate(const VkMemoryRequirements& _requirements, VkMemoryPropertyFlags _properties, bool _isImage, Allocation& _out,
+		Category _category = CATEGORY_OTHER)
+	{
+		uint32_t memoryType = FindMemoryType(_requirements.memoryTypeBits, _properties);
+		if (memoryType == UINT32_MAX) {
+			std::cout << "Allocator Error: no memory type has the requested properties.\n";
+			return false;
+		}
+		bool hostVisible = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+		uint32_t poolIndex = memoryType * 2 + (_isImage ? 1 : 0);
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Big resources skip the pools
+		if (_requirements.size > blockSize / 2) {
+			VkDeviceMemory memory;
+			if (!AllocateMemory(memoryType, _requirements.size, memory))
+				return false;
+			_out = Allocation();
+			_out.memory = memory;
+			_out.size = _requirements.size;
+			_out.pool = poolIndex;
+			if (hostVisible)
+				vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &_out.mapped);
+			uint32_t heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+			dedicatedBytes[heap] += _out.size;
+			++dedicatedCount[heap];
+			Account(_out, _category, true);
+			return true;
+		}
+
+		VkDeviceSize size = SizeClass(_requirements.size);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(_requirements.alignment, 1);
+		Pool& pool = pools[poolIndex];
+		for (uint32_t b = 0; b < pool.blocks.size(); ++b)
+			if (pool.blocks[b].memory != nullptr && TakeRange(pool.blocks[b], size, alignment, _out)) {
+				FinishAllocation(pool.blocks[b], poolIndex, b, _out);
+				Account(_out, _category, true);
+				return true;
+			}
+
+		// Open a new block, reusing a released slot when there is one
+		uint32_t slot = 0;
+		while (slot < pool.blocks.size() && pool.blocks[slot].memory != nullptr)
+			++slot;
+		if (slot == pool.blocks.size())
+			pool.blocks.push_back(Block());
+		Block& block = pool.blocks[slot];
+		if (!AllocateMemory(memoryType, blockSize, block.memory))
+			return false;
+		block.size = blockSize;
+		block.used = 0;
+		block.allocationCount = 0;
+		block.freeRanges.assign(1, { 0, blockSize });
+		block.mapped = nullptr;
+		if (hostVisible)
+			vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&block.mapped));
+		if (!TakeRange(block, size, alignment, _out))
+			return false;
+		FinishAllocation(block, poolIndex, slot, _out);
+		Account(_out, _category, true);
+		return true;
+	}
+
+	void Free(Allocation& _allocation)
+	{
+		if (_allocation.memory == nullptr)
+			return;
+		std::lock_guard<std::mutex> lock(mutex);
+		Account(_allocation, static_cast<Category>(_allocation.category), false);
+		if (_allocation.block == UINT32_MAX) {
+			uint32_t heap = memoryProperties.memoryTypes[_allocation.pool / 2].heapIndex;
+			dedicatedBytes[heap] -= _allocation.size;
+			--dedicatedCount[heap];
+			if (_allocation.mapped != nullptr)
+				vkUnmapMemory(device, _allocation.memory);
+			vkFreeMemory(device, _allocation.memory, nullptr);
+			--driverAllocations;
+		}
+		else {
+			Block& block = pools[_allocation.pool].blocks[_allocation.block];
+			ReturnRange(block, { _allocation.offset, _allocation.size });
+			block.used -= _allocation.size;
+			--block.allocationCount;
+		}
+		_allocation = Allocation();
+	}
+
+	// Buffer creation in the style of GvkHelper::create_buffer, memory comes from the pools
+	VkResult CreateBuffer(VkDeviceSize _size, VkBufferUsageFlags _usage, VkMemoryPropertyFlags _properties,
+		VkBuffer* _outBuffer, Allocation* _outAllocation, Category _category = CATEGORY_OTHER)
+	{
+		VkBufferCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		create_info.size = _size;
+		create_info.usage = _usage;
+		create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkResult r = vkCreateBuffer(device, &create_info, nullptr, _outBuffer);
+		if (r)
+			return r;
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, *_outBuffer, &requirements);
+		if (!Allocate(requirements, _properties, false, *_outAllocation, _category)) {
+			vkDestroyBuffer(device, *_outBuffer, nullptr);
+			*_outBuffer = nullptr;
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		return vkBindBufferMemory(device, *_outBuffer, _outAllocation->memory, _outAllocation->offset);
+	}
+
+	VkResult CreateImage(const VkImageCreateInfo& _createInfo, VkMemoryPropertyFlags _properties,
+		VkImage* _outImage, Allocation* _outAllocation, Category _category = CATEGORY_OTHER)
+	{
+		VkResult r = vkCreateImage(device, &_createInfo, nullptr, _outImage);
+		if (r)
+			return r;
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, *_outImage, &requirements);
+		if (!Allocate(requirements, _properties, _createInfo.tiling == VK_IMAGE_TILING_OPTIMAL, *_outAllocation, _category)) {
+			vkDestroyImage(device, *_outImage, nullptr);
+			*_outImage = nullptr;
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		return vkBindImageMemory(device, *_outImage, _outAllocation->memory, _outAllocation->offset);
+	}
+
+	void DestroyBuffer(VkBuffer& _buffer, Allocation& _allocation)
+	{
+		if (_buffer != nullptr)
+			vkDestroyBuffer(device, _buffer, nullptr);
+		_buffer = nullptr;
+		Free(_allocation);
+	}
+
+	void DestroyImage(VkImage& _image, Allocation& _allocation)
+	{
+		if (_image != nullptr)
+			vkDestroyImage(device, _image, nullptr);
+		_image = nullptr;
+		Free(_allocation);
+	}
+
+	// Defragmentation by release: hands empty blocks back to the driver, keeping one
+	// spare per pool so a steady stream of loads and unloads does not thrash.
+	// Returns the bytes released.
+	VkDeviceSize Trim()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		VkDeviceSize released = 0;
+		for (Pool& pool : pools) {
+			bool keptSpare = false;
+			for (Block& block : pool.blocks) {
+				if (block.memory == nullptr || block.allocationCount > 0)
+					continue;
+				if (!keptSpare) {
+					keptSpare = true;
+					continue;
+				}
+				if (block.mapped != nullptr)
+					vkUnmapMemory(device, block.memory);
+				vkFreeMemory(device, block.memory, nullptr);
+				--driverAllocations;
+				released += block.size;
+				block = Block();
+			}
+		}
+		return released;
+	}
+
+	// Live totals for one heap
+	HeapStats GetHeapStats(uint32_t _heap)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return CollectHeapStats(_heap);
+	}
+
+	uint32_t GetHeapCount() const { return memoryProperties.memoryHeapCount; }
+	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return memoryProperties; }
+	unsigned int GetDriverAllocationCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return driverAllocations;
+	}
+
+	CategoryStats GetCategoryStats(Category _category)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return categories[_category];
+	}
+
+	// True once a DEVICE_LOCAL heap's process usage passes _fraction of its budget. Without
+	// VK_EXT_memory_budget this allocator's blocks are measured against the heap size.
+	bool OverBudget(float _fraction)
+	{
+		std::vector<VkDeviceSize> budget, usage;
+		bool haveBudget = GetBudget(budget, usage);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; ++heap) {
+			if (!(memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+				continue;
+			VkDeviceSize used = haveBudget ? usage[heap] : CollectHeapStats(heap).blockBytes;
+			VkDeviceSize limit = haveBudget ? budget[heap] : memoryProperties.memoryHeaps[heap].size;
+			if (used > limit * _fraction)
+				return true;
+		}
+		return false;
+	}
+
+	// Driver's budget for each heap and this process's usage of it, which includes memory
+	// allocated outside this allocator. False when VK_EXT_memory_budget is unavailable.
+	bool GetBudget(std::vector<VkDeviceSize>& _budget, std::vector<VkDeviceSize>& _usage) const
+	{
+		if (!budgetSupported)
+			return false;
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties.pNext = &budget;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+		_budget.assign(budget.heapBudget, budget.heapBudget + memoryProperties.memoryHeapCount);
+		_usage.assign(budget.heapUsage, budget.heapUsage + memoryProperties.memoryHeapCount);
+		return true;
+	}
+
+	// Full report: every heap against its budget, then every category. Holds the mutex
+	// throughout so other threads' allocations cannot tear the numbers.
+	void PrintStats()
+	{
+		std::vector<VkDeviceSize> budget, usage;
+		bool haveBudget = GetBudget(budget, usage);
+		std::lock_guard<std::mutex> lock(mutex);
+		std::cout << "Allocator: " << driverAllocations << " driver allocations"
+			<< (haveBudget ? "" : ", no VK_EXT_memory_budget so heap sizes stand in for budgets") << "\n";
+		for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; ++heap) {
+			HeapStats stats = CollectHeapStats(heap);
+			if (stats.blockBytes == 0 && !haveBudget)
+				continue;
+			bool deviceLocal = (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			VkDeviceSize heapBudget = haveBudget ? budget[heap] : memoryProperties.memoryHeaps[heap].size;
+			std::cout << "  heap " << heap << (deviceLocal ? " (device)" : " (host)") << ": "
+				<< stats.usedBytes / 1024 << " KB used of " << stats.blockBytes / 1024 << " KB in "
+				<< stats.blockCount << " block(s), " << stats.allocationCount << " allocation(s), "
+				<< static_cast<int>(stats.Fragmentation() * 100.0f) << "% fragmented, budget " << heapBudget / (1024 * 1024) << " MB";
+			if (haveBudget)
+				std::cout << ", process usage " << usage[heap] / (1024 * 1024) << " MB ("
+					<< (heapBudget ? 100 * usage[heap] / heapBudget : 0) << "%)";
+			std::cout << "\n";
+		}
+		for (uint32_t c = 0; c < CATEGORY_COUNT; ++c) {
+			const CategoryStats& stats = categories[c];
+			if (stats.allocationCount == 0)
+				continue;
+			std::cout << "  " << CategoryName(c) << ": " << stats.deviceBytes / 1024 << " KB device, "
+				<< stats.hostBytes / 1024 << " KB host, " << stats.allocationCount << " allocation(s)\n";
+		}
+	}
+
+	// One line for periodic logging: device and host totals against budget, then categories
+	void LogSummary()
+	{
+		std::vector<VkDeviceSize> budget, usage;
+		bool haveBudget = GetBudget(budget, usage);
+		std::lock_guard<std::mutex> lock(mutex);
+		VkDeviceSize deviceUsed = 0, deviceBlocks = 0, deviceBudget = 0, hostBlocks = 0;
+		for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; ++heap) {
+			HeapStats stats = CollectHeapStats(heap);
+			if (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				deviceUsed += stats.usedBytes;
+				deviceBlocks += stats.blockBytes;
+				deviceBudget += haveBudget ? budget[heap] : memoryProperties.memoryHeaps[heap].size;
+			}
+			else
+				hostBlocks += stats.blockBytes;
+		}
+		const double MB = 1024.0 * 1024.0;
+		std::ios::fmtflags flags = std::cout.flags();
+		std::streamsize precision = std::cout.precision(1);
+		std::cout << std::fixed;
+		std::cout << "Memory: device " << deviceUsed / MB << " MB used, " << deviceBlocks / MB << " MB reserved of "
+			<< deviceBudget / MB << " MB " << (haveBudget ? "budget" : "heap") << ", host " << hostBlocks / MB << " MB |";
+		for (uint32_t c = 0; c < CATEGORY_COUNT; ++c) {
+			const CategoryStats& stats = categories[c];
+			if (stats.allocationCount > 0)
+				std::cout << " " << CategoryName(c) << " " << (stats.deviceBytes + stats.hostBytes) / MB;
+		}
+		std::cout << " MB\n";
+		std::cout.precision(precision);
+		std::cout.flags(flags);
+	}
+
+	// Frees every block. Resources must already be destroyed.
+	void Destroy()
+	{
+		if (device == nullptr)
+			return;
+		for (Pool& pool : pools)
+			for (Block& block : pool.blocks)
+				if (block.memory != nullptr) {
+					if (block.mapped != nullptr)
+						vkUnmapMemory(device, block.memory);
+					vkFreeMemory(device, block.memory, nullptr);
+				}
+		pools.clear();
+		driverAllocations = 0;
+		for (CategoryStats& stats : categories)
+			stats = CategoryStats();
+		device = nullptr;
+	}
+
+private:
+	uint32_t FindMemoryType(uint32_t _typeBits, VkMemoryPropertyFlags _properties) const
+	{
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+			if ((_typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & _properties) == _properties)
+				return i;
+		return UINT32_MAX;
+	}
+
+	bool AllocateMemory(uint32_t _memoryType, VkDeviceSize _size, VkDeviceMemory& _out)
+	{
+		VkMemoryAllocateInfo allocate_info = {};
+		allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocate_info.allocationSize = _size;
+		allocate_info.memoryTypeIndex = _memoryType;
+		if (vkAllocateMemory(device, &allocate_info, nullptr, &_out) != VK_SUCCESS) {
+			std::cout << "Allocator Error: vkAllocateMemory of " << _size << " bytes failed.\n";
+			_out = nullptr;
+			return false;
+		}
+		++driverAllocations;
+		return true;
+	}
+
+	// First fit over the block's free ranges
+	static bool TakeRange(Block& _block, VkDeviceSize _size, VkDeviceSize _alignment, Allocation& _out)
+	{
+		for (size_t i = 0; i < _block.freeRanges.size(); ++i) {
+			Range range = _block.freeRanges[i];
+			VkDeviceSize offset = (range.offset + _alignment - 1) / _alignment * _alignment;
+			if (offset + _size > range.offset + range.size)
+				continue;
+			// Keep what is left on either side of the allocation
+			Range before = { range.offset, offset - range.offset };
+			Range after = { offset + _size, range.offset + range.size - offset - _size };
+			_block.freeRanges.erase(_block.freeRanges.begin() + i);
+			if (after.size > 0)
+				_block.freeRanges.insert(_block.freeRanges.begin() + i, after);
+			if (before.size > 0)
+				_block.freeRanges.insert(_block.freeRanges.begin() + i, before);
+			_out = Allocation();
+			_out.offset = offset;
+			_out.size = _size;
+			return true;
+		}
+		return false;
+	}
+
+	static void ReturnRange(Block& _block, Range _range)
+	{
+		auto next = std::lower_bound(_block.freeRanges.begin(), _block.freeRanges.end(), _range.offset,
+			[](const Range& _a, VkDeviceSize _offset) { return _a.offset < _offset; });
+		// Merge with the following range
+		if (next != _block.freeRanges.end() && _range.offset + _range.size == next->offset) {
+			_range.size += next->size;
+			next = _block.freeRanges.erase(next);
+		}
+		// Merge with the preceding range
+		if (next != _block.freeRanges.begin()) {
+			auto previous = next - 1;
+			if (previous->offset + previous->size == _range.offset) {
+				previous->size += _range.size;
+				return;
+			}
+		}
+		_block.freeRanges.insert(next, _range);
+	}
+
+	// Totals for one heap. Caller holds the mutex.
+	HeapStats CollectHeapStats(uint32_t _heap) const
+	{
+		HeapStats stats;
+		for (uint32_t p = 0; p < pools.size(); ++p) {
+			if (memoryProperties.memoryTypes[p / 2].heapIndex != _heap)
+				continue;
+			for (const Block& block : pools[p].blocks) {
+				if (block.memory == nullptr)
+					continue;
+				++stats.blockCount;
+				stats.blockBytes += block.size;
+				stats.usedBytes += block.used;
+				stats.allocationCount += block.allocationCount;
+				VkDeviceSize largest = 0;
+				for (const Range& range : block.freeRanges) {
+					stats.freeBytes += range.size;
+					largest = std::max(largest, range.size);
+				}
+				stats.largestFree += largest;
+			}
+		}
+		stats.blockBytes += dedicatedBytes[_heap];
+		stats.usedBytes += dedicatedBytes[_heap];
+		stats.allocationCount += dedicatedCount[_heap];
+		return stats;
+	}
+
+	// Adds or removes _allocation from its category's totals. Caller holds the mutex.
+	void Account(Allocation& _allocation, Category _category, bool _add)
+	{
+		_allocation.category = _category;
+		CategoryStats& stats = categories[_category];
+		bool deviceLocal = (memoryProperties.memoryHeaps[memoryProperties.memoryTypes[_allocation.pool / 2].heapIndex].flags &
+			VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		VkDeviceSize& bytes = deviceLocal ? stats.deviceBytes : stats.hostBytes;
+		if (_add) {
+			bytes += _allocation.size;
+			++stats.allocationCount;
+		}
+		else {
+			bytes -= _allocation.size;
+			--stats.allocationCount;
+		}
+	}
+
+	void FinishAllocation(Block& _block, uint32_t _pool, uint32_t _blockIndex, Allocation& _out)
+	{
+		_out.memory = _block.memory;
+		_out.mapped = _block.mapped ? _block.mapped + _out.offset : nullptr;
+		_out.pool = _pool;
+		_out.block = _blockIndex;
+		_block.used += _out.size;
+		++_block.allocationCount;
+	}
+};
@@ -0,0 +1,163 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include "FileUtil.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// One VkPipelineCache shared by every pipeline the renderer creates, persisted between
+// runs. The file is only handed to the driver when it was written on the same device
+// (vendor, device id and pipeline cache UUID) with the same driver version and its
+// contents hash still matches; anything else starts from an empty cache. Save writes
+// the driver's current data back if it changed since Create.
+class GvkPipelineCache
+{
+	// File layout: Header followed by dataSize bytes from vkGetPipelineCacheData
+	static constexpr char magic[4] = { 'P', 'S', 'O', 'C' };
+	static const uint32_t version = 1;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	VkDevice device = nullptr;
+	VkPhysicalDeviceProperties properties = {};
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	size_t loadedBytes = 0;
+	uint64_t loadedHash = 0;
+
+public:
+	// Creates the cache, seeded from _path when the file is valid for this device
+	bool Create(VkPhysicalDevice _physicalDevice, VkDevice _device, const std::string& _path)
+	{
+		device = _device;
+		path = _path;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<char> data;
+		const char* rejected = Load(data);
+		VkPipelineCacheCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		create_info.initialDataSize = data.size();
+		create_info.pInitialData = data.empty() ? nullptr : data.data();
+		VkResult result = vkCreatePipelineCache(device, &create_info, nullptr, &cache);
+		if (result != VK_SUCCESS && !data.empty()) {
+			// The driver can still refuse data we accepted, fall back to an empty cache
+			rejected = "refused by the driver";
+			data.clear();
+			create_info.initialDataSize = 0;
+			create_info.pInitialData = nullptr;
+			result = vkCreatePipelineCache(device, &create_info, nullptr, &cache);
+		}
+		if (result != VK_SUCCESS) {
+			std::cout << "Pipeline Cache Error: vkCreatePipelineCache failed (" << result << ").\n";
+			cache = VK_NULL_HANDLE;
+			return false;
+		}
+		loadedBytes = data.size();
+		loadedHash = FileUtil::Hash(data.data(), data.size());
+
+		std::chrono::duration<float, std::milli> loadTime = std::chrono::steady_clock::now() - start;
+		if (rejected == nullptr)
+			std::cout << "Loaded pipeline cache \"" << path << "\" (" << loadedBytes << " bytes) in " << loadTime.count() << " ms\n";
+		else
+			std::cout << "Pipeline cache \"" << path << "\" " << rejected << ", starting empty\n";
+		return true;
+	}
+
+	// VK_NULL_HANDLE if Create failed, which every vkCreate*Pipelines accepts
+	VkPipelineCache Get() const { return cache; }
+
+	// Writes the driver's data back to the file, skipped when nothing was added
+	bool Save()
+	{
+		if (cache == VK_NULL_HANDLE)
+			return false;
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+			return false;
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+			return false;
+		data.resize(size);
+		uint64_t hash = FileUtil::Hash(data.data(), data.size());
+		if (size == loadedBytes && hash == loadedHash)
+			return true;
+
+		Header header = {};
+		memcpy(header.magic, magic, 4);
+		header.version = version;
+		header.vendorID = properties.vendorID;
+		header.deviceID = properties.deviceID;
+		header.driverVersion = properties.driverVersion;
+		memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+		header.dataSize = size;
+		header.dataHash = hash;
+
+		if (!FileUtil::WriteAtomic(path, { { &header, sizeof(Header) }, { data.data(), size } }))
+			return false;
+		std::cout << "Saved pipeline cache \"" << path << "\" (" << size << " bytes)\n";
+		loadedBytes = size;
+		loadedHash = hash;
+		return true;
+	}
+
+	void Destroy()
+	{
+		if (cache != VK_NULL_HANDLE)
+			vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+		device = nullptr;
+	}
+
+private:
+	// Fills _data with the file's cache data. Returns why it was rejected, or nullptr.
+	const char* Load(std::vector<char>& _data) const
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+			return "not found";
+		Header header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(Header)) ||
+			memcmp(header.magic, magic, 4) != 0 || header.version != version || header.dataSize > (256ull << 20))
+			return "is damaged";
+		if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+			memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+			return "was written on another device";
+		if (header.driverVersion != properties.driverVersion)
+			return "was written by another driver version";
+		_data.resize(static_cast<size_t>(header.dataSize));
+		if (!file.read(_data.data(), static_cast<std::streamsize>(_data.size())) ||
+			FileUtil::Hash(_data.data(), _data.size()) != header.dataHash || !MatchesDevice(_data)) {
+			_data.clear();
+			return "is damaged";
+		}
+		return nullptr;
+	}
+
+	// The driver's own header repeats the device identity, check it as well
+	bool MatchesDevice(const std::vector<char>& _data) const
+	{
+		// headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+		uint32_t fields[4];
+		if (_data.size() < sizeof(fields) + VK_UUID_SIZE)
+			return false;
+		memcpy(fields, _data.data(), sizeof(fields));
+		return fields[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			fields[2] == properties.vendorID && fields[3] == properties.deviceID &&
+			memcmp(_data.data() + sizeof(fields), properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include "GvkAllocator.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// One persistently mapped HOST_VISIBLE buffer split into a slice per frame in flight.
+// Each frame bump-allocates its dynamic constant/storage data out of its own slice and
+// binds it with a dynamic offset, so nothing is mapped, unmapped or created per frame.
+// A slice is only reused once the frame that filled it has retired, which holds as
+// long as BeginFrame is given the same index as the swapchain image being recorded.
+class GvkRingBuffer
+{
+	GvkAllocator* allocator = nullptr;
+	VkBuffer buffer = nullptr;
+	GvkAllocator::Allocation memory;
+	char* mapped = nullptr;
+	VkDeviceSize sliceSize = 0;
+	VkDeviceSize alignment = 1;
+	unsigned int frameCount = 0;
+	VkDeviceSize sliceStart = 0;
+	VkDeviceSize cursor = 0;
+	bool overflowReported = false;
+
+public:
+	struct Allocation {
+		void* pointer = nullptr;	// write the frame's data here
+		uint32_t offset = 0;		// dynamic offset for vkCmdBindDescriptorSets
+	};
+
+	bool Create(VkPhysicalDevice _physicalDevice, GvkAllocator* _allocator, unsigned int _frameCount, VkDeviceSize _bytesPerFrame,
+		VkBufferUsageFlags _usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		GvkAllocator::Category _category = GvkAllocator::CATEGORY_FRAME_DATA)
+	{
+		allocator = _allocator;
+		frameCount = _frameCount;
+
+		// Every allocation must satisfy both dynamic offset alignments
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		alignment = std::max(properties.limits.minStorageBufferOffsetAlignment, properties.limits.minUniformBufferOffsetAlignment);
+		alignment = std::max(alignment, VkDeviceSize(16));
+		sliceSize = AlignUp(_bytesPerFrame);
+
+		if (allocator->CreateBuffer(sliceSize * frameCount, _usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, &memory, _category) != VK_SUCCESS)
+			return false;
+		mapped = static_cast<char*>(memory.mapped);
+		return mapped != nullptr;
+	}
+
+	// Starts filling _frameIndex's slice, dropping whatever it held last time around
+	void BeginFrame(unsigned int _frameIndex)
+	{
+		sliceStart = sliceSize * (_frameIndex % frameCount);
+		cursor = 0;
+	}
+
+	// Bump-allocates _size bytes from the current frame's slice. The pointer is null
+	// when the slice is full.
+	Allocation Allocate(VkDeviceSize _size)
+	{
+		Allocation allocation;
+		VkDeviceSize size = AlignUp(_size);
+		if (cursor + size > sliceSize) {
+			if (!overflowReported)
+				std::cout << "Ring Buffer Error: frame slice of " << sliceSize << " bytes is full.\n";
+			overflowReported = true;
+			return allocation;
+		}
+		allocation.pointer = mapped + sliceStart + cursor;
+		allocation.offset = static_cast<uint32_t>(sliceStart + cursor);
+		cursor += size;
+		return allocation;
+	}
+
+	// Copies _data into a fresh allocation
+	Allocation Push(const void* _data, VkDeviceSize _size)
+	{
+		Allocation allocation = Allocate(_size);
+		if (allocation.pointer != nullptr)
+			memcpy(allocation.pointer, _data, static_cast<size_t>(_size));
+		return allocation;
+	}
+
+	VkBuffer GetBuffer() const { return buffer; }
+	VkDeviceSize GetBytesUsed() const { return cursor; }
+	VkDeviceSize AlignUp(VkDeviceSize _size) const { return (_size + alignment - 1) / alignment * alignment; }
+
+	void Destroy()
+	{
+		if (allocator == nullptr)
+			return;
+		allocator->DestroyBuffer(buffer, memory);
+		mapped = nullptr;
+		buffer = nullptr;
+		allocator = nullptr;
+	}
+};
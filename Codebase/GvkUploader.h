@@ -0,0 +1,345 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "GvkAllocator.h"
+// Expects Gateware.h (with GVulkanSurface enabled) to be included first, like renderer.h
+
+// Fills DEVICE_LOCAL buffers through one persistently mapped staging buffer. Uploads
+// are queued as copy regions and recorded into a single command buffer per submission.
+// Submissions are asynchronous: each one is tagged with a ticket and signals its own
+// fence, and callers check IsComplete(ticket) before using what it filled, so the render
+// loop never waits on a transfer. The staging buffer is used as a ring whose space is
+// handed back as submissions retire.
+class GvkUploader
+{
+	struct PendingCopy {
+		VkBuffer destination;
+		VkBufferCopy region;
+	};
+	struct Submission {
+		uint64_t ticket;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		VkDeviceSize stagingStart;	// where this submission's data begins in the ring
+		std::chrono::steady_clock::time_point submitted;
+	};
+
+	GvkAllocator* allocator = nullptr;
+	VkDevice device = nullptr;
+	VkCommandPool commandPool = nullptr;	// our own, so command buffers can be reset and reused
+	VkQueue queue = nullptr;
+	VkBuffer stagingBuffer = nullptr;
+	GvkAllocator::Allocation stagingData;
+	char* stagingMapped = nullptr;
+	VkDeviceSize stagingSize = 0;
+	VkDeviceSize stagingHead = 0;	// next byte to write
+	VkDeviceSize stagingTail = 0;	// oldest byte still needed by the GPU or by pending copies
+	VkDeviceSize pendingStart = 0;
+	std::vector<PendingCopy> pending;
+	std::deque<Submission> inFlight;
+	std::vector<VkCommandBuffer> freeCommandBuffers;
+	std::vector<VkFence> freeFences;
+	uint64_t nextTicket = 1;		// ticket the pending copies will complete under
+	uint64_t completedTicket = 0;	// every ticket up to here is resident
+
+	// Throughput counters since Create or the last ResetStats
+	VkDeviceSize bytesUploaded = 0;
+	unsigned int submissions = 0;
+	unsigned int stalls = 0;			// times Upload had to wait for staging space
+	double secondsUploading = 0.0;	// wall time with a submission outstanding, as observed
+	std::chrono::steady_clock::time_point lastRetired;
+
+public:
+	// _queueFamily is the family _queue belongs to
+	bool Create(GvkAllocator* _allocator, VkDevice _device, unsigned int _queueFamily, VkQueue _queue,
+		VkDeviceSize _stagingSize = 16ull << 20)
+	{
+		allocator = _allocator;
+		device = _device;
+		queue = _queue;
+		stagingSize = _stagingSize & ~VkDeviceSize(15);
+		stagingHead = stagingTail = 0;
+
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_info.queueFamilyIndex = _queueFamily;
+		if (vkCreateCommandPool(device, &pool_info, nullptr, &commandPool) != VK_SUCCESS)
+			return false;
+
+		if (allocator->CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingData,
+			GvkAllocator::CATEGORY_STAGING) != VK_SUCCESS)
+			return false;
+		stagingMapped = static_cast<char*>(stagingData.mapped);	// allocator keeps host blocks mapped
+		return stagingMapped != nullptr;
+	}
+
+	// Creates a DEVICE_LOCAL buffer and queues _data (may be null) to fill it
+	bool CreateBuffer(VkDeviceSize _size, VkBufferUsageFlags _usage, const void* _data, VkBuffer* _outBuffer,
+		GvkAllocator::Allocation* _outAllocation, GvkAllocator::Category _category = GvkAllocator::CATEGORY_OTHER)
+	{
+		if (allocator->CreateBuffer(_size, _usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _outBuffer, _outAllocation, _category) != VK_SUCCESS)
+			return false;
+		return _data == nullptr || Upload(*_outBuffer, 0, _data, _size);
+	}
+
+	// Queues a copy of _size bytes into _destination at _offset. The data is staged right
+	// away so the caller's memory can be released; the GPU copy happens on Submit. Only
+	// blocks when the staging ring is full of work the GPU has not finished.
+	bool Upload(VkBuffer _destination, VkDeviceSize _offset, const void* _data, VkDeviceSize _size)
+	{
+		const char* bytes = static_cast<const char*>(_data);
+		while (_size > 0) {
+			VkDeviceSize available = Contiguous();
+			if (available == 0) {
+				// Send what is staged, then take back whatever the GPU has finished with
+				if (!pending.empty() && Submit() == 0)
+					return false;
+				Poll();
+				if (Contiguous() == 0) {
+					if (inFlight.empty())
+						return false;
+					++stalls;
+					Wait(inFlight.back().ticket);	// drain fully rather than trickle in small chunks
+				}
+				continue;
+			}
+			if (pending.empty())
+				pendingStart = stagingHead;
+			VkDeviceSize chunk = std::min(_size, available);
+			memcpy(stagingMapped + stagingHead, bytes, static_cast<size_t>(chunk));
+			pending.push_back({ _destination, { stagingHead, _offset, chunk } });
+			stagingHead = std::min((stagingHead + chunk + 15) & ~VkDeviceSize(15), stagingSize);
+			bytes += chunk;
+			_offset += chunk;
+			_size -= chunk;
+		}
+		return true;
+	}
+
+	// Records every queued copy into one command buffer and submits it without waiting.
+	// Returns the ticket to check with IsComplete, 0 on failure.
+	uint64_t Submit()
+	{
+		if (pending.empty())
+			return nextTicket - 1;
+		Submission submission = {};
+		submission.ticket = nextTicket;
+		submission.stagingStart = pendingStart;
+		if (!AcquireCommandBuffer(submission.commandBuffer, submission.fence))
+			return 0;
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(submission.commandBuffer, &begin_info);
+
+		// Neighbouring copies into the same buffer go out as one vkCmdCopyBuffer
+		std::vector<VkBufferCopy> regions;
+		regions.reserve(pending.size());
+		VkDeviceSize bytes = 0;
+		for (size_t i = 0; i < pending.size(); ++i) {
+			regions.push_back(pending[i].region);
+			bytes += pending[i].region.size;
+			if (i + 1 == pending.size() || pending[i + 1].destination != pending[i].destination) {
+				vkCmdCopyBuffer(submission.commandBuffer, stagingBuffer, pending[i].destination,
+					static_cast<uint32_t>(regions.size()), regions.data());
+				regions.clear();
+			}
+		}
+
+		// Make the copies visible to vertex input, index fetch, indirect and shader reads.
+		// Both share one queue, so the barrier also orders every later frame's submission.
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(submission.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkEndCommandBuffer(submission.commandBuffer);
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &submission.commandBuffer;
+		if (vkQueueSubmit(queue, 1, &submit_info, submission.fence) != VK_SUCCESS) {
+			std::cout << "Upload Error: transfer submission failed.\n";
+			vkResetCommandBuffer(submission.commandBuffer, 0);
+			freeCommandBuffers.push_back(submission.commandBuffer);
+			freeFences.push_back(submission.fence);
+			return 0;
+		}
+		submission.submitted = std::chrono::steady_clock::now();
+		inFlight.push_back(submission);
+		pending.clear();
+		bytesUploaded += bytes;
+		++submissions;
+		return nextTicket++;
+	}
+
+	// Retires every submission whose fence has signaled. Never blocks.
+	void Poll()
+	{
+		while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+			Retire();
+		UpdateTail();
+	}
+
+	// True once everything submitted under _ticket is resident
+	bool IsComplete(uint64_t _ticket) const { return _ticket <= completedTicket; }
+
+	// Ticket the queued but not yet submitted copies will complete under
+	uint64_t GetPendingTicket() const { return nextTicket; }
+
+	VkDeviceSize GetStagingSize() const { return stagingSize; }
+
+	// Bytes Upload can stage right now without waiting, after taking back what the GPU
+	// has finished with. Every Upload uses its size rounded up to 16 bytes.
+	VkDeviceSize GetStagingAvailable()
+	{
+		Poll();
+		if (pending.empty() && inFlight.empty())
+			return stagingSize;
+		if (stagingHead > stagingTail)
+			return (stagingSize - stagingHead) + stagingTail;	// the end, then wrapping to the tail
+		return stagingHead < stagingTail ? stagingTail - stagingHead : 0;
+	}
+
+	// Blocks until _ticket is resident. For load time and teardown, not the frame loop.
+	void Wait(uint64_t _ticket)
+	{
+		while (!inFlight.empty() && inFlight.front().ticket <= _ticket) {
+			vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, UINT64_MAX);
+			Retire();
+		}
+		UpdateTail();
+	}
+
+	// Submits everything queued and waits for it
+	bool Flush()
+	{
+		uint64_t ticket = Submit();
+		if (!pending.empty())
+			return false;
+		Wait(ticket);
+		return true;
+	}
+
+	// Prints bytes moved, submissions and effective throughput
+	void ReportStats(const char* _label) const
+	{
+		double megabytes = static_cast<double>(bytesUploaded) / (1024.0 * 1024.0);
+		std::cout << _label << ": uploaded " << megabytes << " MB in " << submissions << " submission(s), "
+			<< secondsUploading * 1000.0 << " ms";
+		if (secondsUploading > 0.0)
+			std::cout << " (" << megabytes / secondsUploading << " MB/s)";
+		if (stalls > 0)
+			std::cout << ", " << stalls << " staging stall(s)";
+		std::cout << "\n";
+	}
+
+	void ResetStats()
+	{
+		bytesUploaded = 0;
+		submissions = 0;
+		stalls = 0;
+		secondsUploading = 0.0;
+	}
+
+	void Destroy()
+	{
+		if (device == nullptr)
+			return;
+		Flush();
+		for (VkFence fence : freeFences)
+			vkDestroyFence(device, fence, nullptr);
+		freeFences.clear();
+		freeCommandBuffers.clear();
+		vkDestroyCommandPool(device, commandPool, nullptr);	// frees its command buffers too
+		allocator->DestroyBuffer(stagingBuffer, stagingData);
+		commandPool = nullptr;
+		stagingMapped = nullptr;
+		stagingBuffer = nullptr;
+		device = nullptr;
+	}
+
+private:
+	// Bytes writable at stagingHead without running into live data, wrapping if needed.
+	// Live data is [tail, head) around the ring, so head == tail while live means full.
+	VkDeviceSize Contiguous()
+	{
+		if (pending.empty() && inFlight.empty()) {
+			stagingHead = stagingTail = 0;
+			return stagingSize;
+		}
+		if (stagingHead > stagingTail) {
+			if (stagingHead < stagingSize)
+				return stagingSize - stagingHead;
+			if (stagingTail == 0)
+				return 0;
+			stagingHead = 0;	// the unused end is reclaimed with the data before it
+		}
+		return stagingHead < stagingTail ? stagingTail - stagingHead : 0;
+	}
+
+	void UpdateTail()
+	{
+		if (!inFlight.empty())
+			stagingTail = inFlight.front().stagingStart;
+		else if (!pending.empty())
+			stagingTail = pendingStart;
+		else
+			stagingHead = stagingTail = 0;
+	}
+
+	void Retire()
+	{
+		Submission& done = inFlight.front();
+		// Overlapping submissions only count once
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed = now - std::max(done.submitted, lastRetired);
+		secondsUploading += elapsed.count();
+		lastRetired = now;
+		completedTicket = done.ticket;
+		vkResetFences(device, 1, &done.fence);
+		vkResetCommandBuffer(done.commandBuffer, 0);
+		freeCommandBuffers.push_back(done.commandBuffer);
+		freeFences.push_back(done.fence);
+		inFlight.pop_front();
+	}
+
+	bool AcquireCommandBuffer(VkCommandBuffer& _commandBuffer, VkFence& _fence)
+	{
+		if (freeCommandBuffers.empty()) {
+			VkCommandBufferAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			alloc_info.commandPool = commandPool;
+			alloc_info.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(device, &alloc_info, &commandBuffer) != VK_SUCCESS)
+				return false;
+			freeCommandBuffers.push_back(commandBuffer);
+		}
+		if (freeFences.empty()) {
+			VkFenceCreateInfo fence_info = {};
+			fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			VkFence fence;
+			if (vkCreateFence(device, &fence_info, nullptr, &fence) != VK_SUCCESS)
+				return false;
+			freeFences.push_back(fence);
+		}
+		_commandBuffer = freeCommandBuffers.back();
+		_fence = freeFences.back();
+		freeCommandBuffers.pop_back();
+		freeFences.pop_back();
+		return true;
+	}
+};
@@ -0,0 +1,451 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "Gateware/Gateware.h"
+#include "InstanceCuller.h"
+// Builds in parallel with GConcurrent when GATEWARE_ENABLE_SYSTEM is defined, serially otherwise
+
+// Bounding volume hierarchy over instance bounding spheres, so frustum culling costs
+// roughly what is visible instead of what is loaded. Built top down over the spheres'
+// boxes with binned SAH: the top of the tree is split on the calling thread until there
+// is a subtree per task, then the subtrees are built in parallel and stitched in. Every
+// node covers a contiguous range of slots, so a node fully inside the frustum hands its
+// whole range over without visiting its children. Children always sit after their
+// parent, which lets Refit fix boxes bottom up after instances move.
+class InstanceBVH
+{
+public:
+	struct Node {
+		float boundsMin[3];
+		uint32_t first;		// first slot under this node
+		float boundsMax[3];
+		uint32_t count;		// slots under this node
+		uint32_t left;		// right child is left + 1, 0 for leaves
+		uint32_t parent;
+	};
+
+	static const uint32_t binCount = 16;
+	static const uint32_t maxLeafSize = 8;
+	static constexpr float traversalCost = 4.0f;	// a node's box test against a sphere test, plus the stack work
+
+private:
+	std::vector<Node> nodes;
+	std::vector<uint32_t> items;	// per slot, the instance it holds
+	std::vector<uint32_t> slots;	// per instance, where it sits
+	std::vector<uint32_t> leaves;	// per slot, the leaf holding it
+	std::vector<float> centerX, centerY, centerZ, radius;	// per slot
+	std::vector<char> dirty;	// per node, waiting for Refit
+	std::vector<uint32_t> dirtyLeaves;
+	std::vector<std::pair<uint32_t, uint32_t>> stack;	// node, planes still straddled
+
+	// Counters since Build
+	double buildMilliseconds = 0.0;
+	uint32_t lastVisible = 0;
+	uint64_t nodesVisited = 0;
+	uint64_t visibleTotal = 0;
+	unsigned int frames = 0;
+	unsigned int refits = 0;
+	double cullMilliseconds = 0.0;
+
+	struct Box {
+		float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const Box& _box)
+		{
+			for (int a = 0; a < 3; ++a) {
+				min[a] = std::min(min[a], _box.min[a]);
+				max[a] = std::max(max[a], _box.max[a]);
+			}
+		}
+		void Grow(const float _point[3])
+		{
+			for (int a = 0; a < 3; ++a) {
+				min[a] = std::min(min[a], _point[a]);
+				max[a] = std::max(max[a], _point[a]);
+			}
+		}
+		float HalfArea() const
+		{
+			if (min[0] > max[0])
+				return 0.0f;
+			float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+			return x * y + y * z + z * x;
+		}
+	};
+
+	Box SlotBox(uint32_t _slot) const
+	{
+		Box box;
+		float center[3] = { centerX[_slot], centerY[_slot], centerZ[_slot] };
+		for (int a = 0; a < 3; ++a) {
+			box.min[a] = center[a] - radius[_slot];
+			box.max[a] = center[a] + radius[_slot];
+		}
+		return box;
+	}
+
+	// Build time copy of an instance, partitioned in place so every pass reads memory in order
+	struct Primitive {
+		Box box;
+		float centroid[3];
+		uint32_t instance;
+	};
+
+	// Sets _node's bounds from its range and picks where to split it with binned SAH.
+	// Returns the first slot of the right half, or 0 to keep it as a leaf.
+	static uint32_t Split(std::vector<Primitive>& _primitives, Node& _node)
+	{
+		Primitive* first = _primitives.data() + _node.first;
+		Primitive* last = first + _node.count;
+		Box bounds, centroidBounds;
+		for (const Primitive* primitive = first; primitive != last; ++primitive) {
+			bounds.Grow(primitive->box);
+			centroidBounds.Grow(primitive->centroid);
+		}
+		std::copy(bounds.min, bounds.min + 3, _node.boundsMin);
+		std::copy(bounds.max, bounds.max + 3, _node.boundsMax);
+		if (_node.count <= 1)
+			return 0;
+
+		int axis = 0;
+		for (int a = 1; a < 3; ++a)
+			if (centroidBounds.max[a] - centroidBounds.min[a] > centroidBounds.max[axis] - centroidBounds.min[axis])
+				axis = a;
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		uint32_t middle = _node.first + _node.count / 2;
+		if (extent <= 0.0f) // every centroid in one spot, SAH cannot separate them
+			return _node.count > maxLeafSize ? middle : 0;
+
+		// Bin the centroids, then sweep for the cheapest boundary
+		Box binBoxes[binCount];
+		uint32_t binCounts[binCount] = {};
+		float binScale = binCount / extent;
+		auto binOf = [&](const Primitive& _primitive) {
+			int bin = static_cast<int>((_primitive.centroid[axis] - centroidBounds.min[axis]) * binScale);
+			return static_cast<uint32_t>(std::min(std::max(bin, 0), static_cast<int>(binCount) - 1));
+		};
+		for (const Primitive* primitive = first; primitive != last; ++primitive) {
+			uint32_t bin = binOf(*primitive);
+			binBoxes[bin].Grow(primitive->box);
+			++binCounts[bin];
+		}
+		float rightArea[binCount];
+		uint32_t rightCount[binCount];
+		Box sweep;
+		uint32_t swept = 0;
+		for (uint32_t b = binCount - 1; b > 0; --b) {
+			sweep.Grow(binBoxes[b]);
+			swept += binCounts[b];
+			rightArea[b] = sweep.HalfArea();
+			rightCount[b] = swept;
+		}
+		sweep = Box();
+		swept = 0;
+		float bestCost = FLT_MAX;
+		uint32_t bestBin = 0;
+		for (uint32_t b = 1; b < binCount; ++b) {
+			sweep.Grow(binBoxes[b - 1]);
+			swept += binCounts[b - 1];
+			if (swept == 0 || rightCount[b] == 0)
+				continue;
+			float cost = swept * sweep.HalfArea() + rightCount[b] * rightArea[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		// A leaf costs testing every item, a split one node visit plus its children's expected work
+		float area = bounds.HalfArea();
+		bool worthSplitting = bestBin > 0 && (area <= 0.0f || traversalCost + bestCost / area < static_cast<float>(_node.count));
+		if (!worthSplitting && _node.count <= maxLeafSize)
+			return 0;
+		if (bestBin == 0) {
+			// Too big for a leaf and no bin boundary to use: halve it around the median centroid
+			std::nth_element(first, _primitives.data() + middle, last,
+				[&](const Primitive& _a, const Primitive& _b) { return _a.centroid[axis] < _b.centroid[axis]; });
+			return middle;
+		}
+		// Too big for a leaf still splits at the cheapest boundary, so the children stay apart
+		Primitive* split = std::partition(first, last, [&](const Primitive& _primitive) { return binOf(_primitive) < bestBin; });
+		return static_cast<uint32_t>(split - _primitives.data());
+	}
+
+	// Appends _node's children to _nodes, returns false if it stays a leaf
+	static bool SplitInto(std::vector<Primitive>& _primitives, std::vector<Node>& _nodes, uint32_t _node)
+	{
+		uint32_t split = Split(_primitives, _nodes[_node]);
+		if (split == 0)
+			return false;
+		Node left = {}, right = {};
+		left.first = _nodes[_node].first;
+		left.count = split - left.first;
+		right.first = split;
+		right.count = _nodes[_node].first + _nodes[_node].count - split;
+		left.parent = right.parent = _node;
+		_nodes[_node].left = static_cast<uint32_t>(_nodes.size());
+		_nodes.push_back(left);
+		_nodes.push_back(right);
+		return true;
+	}
+
+	// Builds the whole subtree under _nodes[0], depth first
+	static void BuildSubtree(std::vector<Primitive>& _primitives, std::vector<Node>& _nodes)
+	{
+		std::vector<uint32_t> pending = { 0 };
+		while (!pending.empty()) {
+			uint32_t node = pending.back();
+			pending.pop_back();
+			if (SplitInto(_primitives, _nodes, node)) {
+				pending.push_back(_nodes[node].left + 1);
+				pending.push_back(_nodes[node].left);
+			}
+		}
+	}
+
+	void RefitNode(uint32_t _node)
+	{
+		Node& node = nodes[_node];
+		Box box;
+		if (node.left == 0)
+			for (uint32_t s = node.first; s < node.first + node.count; ++s)
+				box.Grow(SlotBox(s));
+		else
+			for (uint32_t child = node.left; child <= node.left + 1; ++child) {
+				Box childBox;
+				std::copy(nodes[child].boundsMin, nodes[child].boundsMin + 3, childBox.min);
+				std::copy(nodes[child].boundsMax, nodes[child].boundsMax + 3, childBox.max);
+				box.Grow(childBox);
+			}
+		std::copy(box.min, box.min + 3, node.boundsMin);
+		std::copy(box.max, box.max + 3, node.boundsMax);
+	}
+
+	void Append(uint32_t _first, uint32_t _count, std::vector<uint32_t>& _visible) const
+	{
+		_visible.insert(_visible.end(), items.begin() + _first, items.begin() + _first + _count);
+	}
+
+public:
+	// Builds the tree over world space _spheres, one per instance. _tasks subtrees are
+	// built in parallel, 0 picks one per hardware thread.
+	void Build(const std::vector<GW::MATH::GSPHEREF>& _spheres, unsigned int _tasks = 0)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint32_t count = static_cast<uint32_t>(_spheres.size());
+		std::vector<Primitive> primitives(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			const GW::MATH::GSPHEREF& sphere = _spheres[i];
+			float center[3] = { sphere.x, sphere.y, sphere.z };
+			for (int a = 0; a < 3; ++a) {
+				primitives[i].box.min[a] = center[a] - sphere.radius;
+				primitives[i].box.max[a] = center[a] + sphere.radius;
+				primitives[i].centroid[a] = center[a];
+			}
+			primitives[i].instance = i;
+		}
+
+		// Top of the tree: split the largest open node until there is a subtree per task
+		nodes.assign(1, Node{ { 0, 0, 0 }, 0, { 0, 0, 0 }, count, 0, 0 });
+		if (_tasks == 0)
+			_tasks = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<uint32_t> open = { 0 };
+		while (count > 0 && open.size() < _tasks && nodes[open.front()].count > 4096) {
+			std::pop_heap(open.begin(), open.end(), [&](uint32_t _a, uint32_t _b) { return nodes[_a].count < nodes[_b].count; });
+			uint32_t node = open.back();
+			open.pop_back();
+			if (SplitInto(primitives, nodes, node))
+				for (uint32_t child = nodes[node].left; child <= nodes[node].left + 1; ++child) {
+					open.push_back(child);
+					std::push_heap(open.begin(), open.end(), [&](uint32_t _a, uint32_t _b) { return nodes[_a].count < nodes[_b].count; });
+				}
+		}
+
+		// Each open node's subtree is built on its own, over its own range of primitives
+		std::vector<std::vector<Node>> subtrees(open.size());
+#ifdef GATEWARE_ENABLE_SYSTEM
+		GW::SYSTEM::GConcurrent workers;
+		bool parallel = open.size() > 1 && +workers.Create(true);
+#else
+		bool parallel = false;
+#endif
+		for (size_t t = 0; t < open.size(); ++t) {
+			subtrees[t].assign(1, nodes[open[t]]);
+			subtrees[t][0].left = 0;
+			auto task = [&, t]() { BuildSubtree(primitives, subtrees[t]); };
+#ifdef GATEWARE_ENABLE_SYSTEM
+			if (parallel && +workers.BranchSingular(task))
+				continue;
+#endif
+			task();
+		}
+#ifdef GATEWARE_ENABLE_SYSTEM
+		if (parallel)
+			workers.Converge(0);
+#endif
+
+		// Stitch: a subtree's root replaces its open node, the rest is appended
+		for (size_t t = 0; t < open.size(); ++t) {
+			uint32_t root = open[t];
+			uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;	// local node k lands at base + k
+			auto remap = [&](uint32_t _local) { return _local == 0 ? root : base + _local; };
+			for (size_t k = 0; k < subtrees[t].size(); ++k) {
+				Node node = subtrees[t][k];
+				if (node.left != 0)
+					node.left = remap(node.left);
+				node.parent = (k == 0) ? nodes[root].parent : remap(node.parent);
+				if (k == 0)
+					nodes[root] = node;
+				else
+					nodes.push_back(node);
+			}
+		}
+
+		// Slot order copies for traversal and the per instance links Refit needs
+		items.resize(count);
+		slots.resize(count);
+		leaves.resize(count);
+		centerX.resize(count);
+		centerY.resize(count);
+		centerZ.resize(count);
+		radius.resize(count);
+		for (uint32_t s = 0; s < count; ++s) {
+			items[s] = primitives[s].instance;
+			const GW::MATH::GSPHEREF& sphere = _spheres[items[s]];
+			slots[items[s]] = s;
+			centerX[s] = sphere.x;
+			centerY[s] = sphere.y;
+			centerZ[s] = sphere.z;
+			radius[s] = sphere.radius;
+		}
+		for (uint32_t n = 0; n < nodes.size(); ++n)
+			if (nodes[n].left == 0)
+				for (uint32_t s = nodes[n].first; s < nodes[n].first + nodes[n].count; ++s)
+					leaves[s] = n;
+		dirty.assign(nodes.size(), 0);
+		dirtyLeaves.clear();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		buildMilliseconds = elapsed.count();
+	}
+
+	// Moves _instance to the world space _sphere. Boxes catch up on the next Refit.
+	void SetInstance(uint32_t _instance, const GW::MATH::GSPHEREF& _sphere)
+	{
+		uint32_t slot = slots[_instance];
+		centerX[slot] = _sphere.x;
+		centerY[slot] = _sphere.y;
+		centerZ[slot] = _sphere.z;
+		radius[slot] = _sphere.radius;
+		if (!dirty[leaves[slot]]) {
+			dirty[leaves[slot]] = 1;
+			dirtyLeaves.push_back(leaves[slot]);
+		}
+	}
+
+	// Recomputes the boxes of every moved instance's leaf and their ancestors, children
+	// before parents. The tree's shape stays, so heavy movement slowly loosens it.
+	void Refit()
+	{
+		if (dirtyLeaves.empty())
+			return;
+		std::vector<uint32_t> refit;
+		for (uint32_t leaf : dirtyLeaves)
+			for (uint32_t node = leaf; ; node = nodes[node].parent) {
+				if (node != leaf && dirty[node])
+					break;	// the rest of the path is already queued
+				dirty[node] = 1;
+				refit.push_back(node);
+				if (node == 0)
+					break;
+			}
+		std::sort(refit.begin(), refit.end(), std::greater<uint32_t>());
+		for (uint32_t node : refit) {
+			RefitNode(node);
+			dirty[node] = 0;
+		}
+		dirtyLeaves.clear();
+		++refits;
+	}
+
+	// Fills _visible with every instance whose sphere touches all six _planes, in no
+	// particular order, and returns how many there are
+	uint32_t Cull(const float _planes[6][4], std::vector<uint32_t>& _visible)
+	{
+		auto start = std::chrono::steady_clock::now();
+		_visible.clear();
+		if (!items.empty())
+			stack.assign(1, { 0u, 0x3Fu });
+		while (!stack.empty()) {
+			uint32_t index = stack.back().first, planeMask = stack.back().second;
+			stack.pop_back();
+			const Node& node = nodes[index];
+			++nodesVisited;
+
+			// Drop the node if a plane has it all outside, stop testing planes it is all inside of
+			bool outside = false;
+			for (uint32_t p = 0; p < 6 && !outside; ++p) {
+				if (!(planeMask & (1u << p)))
+					continue;
+				const float* plane = _planes[p];
+				float distance = plane[3], reach = 0.0f;
+				for (int a = 0; a < 3; ++a) {
+					float center = (node.boundsMin[a] + node.boundsMax[a]) * 0.5f;
+					distance += plane[a] * center;
+					reach += std::fabs(plane[a]) * (node.boundsMax[a] - node.boundsMin[a]) * 0.5f;
+				}
+				if (distance + reach < 0.0f)
+					outside = true;
+				else if (distance - reach >= 0.0f)
+					planeMask &= ~(1u << p);
+			}
+			if (outside)
+				continue;
+			if (planeMask == 0)
+				Append(node.first, node.count, _visible);
+			else if (node.left != 0) {
+				stack.push_back({ node.left + 1, planeMask });
+				stack.push_back({ node.left, planeMask });
+			}
+			else
+				for (uint32_t s = node.first; s < node.first + node.count; ++s) {
+					bool inside = true;
+					for (uint32_t p = 0; p < 6 && inside; ++p)
+						if (planeMask & (1u << p))
+							inside = (_planes[p][0] * centerX[s] + _planes[p][1] * centerY[s]) +
+								(_planes[p][2] * centerZ[s] + _planes[p][3]) >= -radius[s];
+					if (inside)
+						_visible.push_back(items[s]);
+				}
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		cullMilliseconds += elapsed.count();
+		lastVisible = static_cast<uint32_t>(_visible.size());
+		visibleTotal += lastVisible;
+		++frames;
+		return lastVisible;
+	}
+
+	uint32_t GetNodeCount() const { return static_cast<uint32_t>(nodes.size()); }
+	const Node& GetNode(uint32_t _node) const { return nodes[_node]; }
+	uint32_t GetInstance(uint32_t _slot) const { return items[_slot]; }
+
+	void ReportStats(const char* _label) const
+	{
+		uint32_t leafCount = 0;
+		for (const Node& node : nodes)
+			leafCount += node.left == 0;
+		std::cout << _label << ": " << items.size() << " instance(s) in " << nodes.size() << " node(s), " << leafCount
+			<< " leaves, built in " << buildMilliseconds << " ms, last frame " << lastVisible << " visible";
+		if (frames > 0)
+			std::cout << ", " << static_cast<double>(nodesVisited) / frames << " nodes and " << cullMilliseconds / frames
+				<< " ms per frame, " << refits << " refit(s)";
+		std::cout << "\n";
+	}
+};
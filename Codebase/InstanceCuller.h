@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "Gateware/Gateware.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define INSTANCE_CULLER_SSE	// otherwise Cull falls back to CullScalar
+#endif
+
+// Frustum culling on the CPU for the direct draw path. Holds a world space bounding
+// sphere per instance, laid out as separate x, y, z and radius arrays padded to a
+// multiple of four so each SSE load fetches one component of four instances. Cull
+// writes the indices of the instances that touch the frustum, in ascending order, so
+// per draw runs of instances stay contiguous after compaction.
+class InstanceCuller
+{
+	std::vector<float> centerX, centerY, centerZ, radius;
+	uint32_t count = 0;
+
+	// Counters since Create
+	uint32_t lastVisible = 0;
+	uint64_t visibleTotal = 0;
+	uint64_t culledTotal = 0;
+	unsigned int frames = 0;
+	double cullMilliseconds = 0.0;
+
+public:
+	// Room for _count spheres. The padding never passes a plane test.
+	void Create(uint32_t _count)
+	{
+		count = _count;
+		size_t padded = (static_cast<size_t>(_count) + 3) & ~size_t(3);
+		centerX.assign(padded, 0.0f);
+		centerY.assign(padded, 0.0f);
+		centerZ.assign(padded, 0.0f);
+		radius.assign(padded, -FLT_MAX);
+	}
+
+	// Moves _local (model space) into world space under the row vector matrix _world,
+	// the radius grows with the largest axis scale
+	static GW::MATH::GSPHEREF TransformSphere(const GW::MATH::GMATRIXF& _world, const GW::MATH::GSPHEREF& _local)
+	{
+		const float* m = _world.data;
+		GW::MATH::GSPHEREF sphere;
+		sphere.x = _local.x * m[0] + _local.y * m[4] + _local.z * m[8] + m[12];
+		sphere.y = _local.x * m[1] + _local.y * m[5] + _local.z * m[9] + m[13];
+		sphere.z = _local.x * m[2] + _local.y * m[6] + _local.z * m[10] + m[14];
+		float scale = 0.0f;
+		for (int row = 0; row < 3; row++)
+			scale = std::max(scale, m[row * 4] * m[row * 4] + m[row * 4 + 1] * m[row * 4 + 1] + m[row * 4 + 2] * m[row * 4 + 2]);
+		sphere.radius = _local.radius * std::sqrt(scale);
+		return sphere;
+	}
+
+	// _sphere is in world space
+	void SetInstance(uint32_t _index, const GW::MATH::GSPHEREF& _sphere)
+	{
+		centerX[_index] = _sphere.x;
+		centerY[_index] = _sphere.y;
+		centerZ[_index] = _sphere.z;
+		radius[_index] = _sphere.radius;
+	}
+
+	uint32_t GetCount() const { return count; }
+
+	// Inward facing planes of a row vector viewProjection with Vulkan's 0..1 depth, in clip
+	// order -x, +x, -y, +y, near, far. Normalized so distances are in world units.
+	static void ExtractPlanes(const GW::MATH::GMATRIXF& _viewProjection, float _planes[6][4])
+	{
+		const float* m = _viewProjection.data;	// clip = v * m, so planes come from m's columns
+		for (int i = 0; i < 4; ++i) {
+			float column0 = m[i * 4 + 0], column1 = m[i * 4 + 1], column2 = m[i * 4 + 2], column3 = m[i * 4 + 3];
+			_planes[0][i] = column3 + column0;
+			_planes[1][i] = column3 - column0;
+			_planes[2][i] = column3 + column1;
+			_planes[3][i] = column3 - column1;
+			_planes[4][i] = column2;
+			_planes[5][i] = column3 - column2;
+		}
+		for (int p = 0; p < 6; ++p) {
+			float length = std::sqrt(_planes[p][0] * _planes[p][0] + _planes[p][1] * _planes[p][1] + _planes[p][2] * _planes[p][2]);
+			if (length > 0.0f)
+				for (int i = 0; i < 4; ++i)
+					_planes[p][i] /= length;
+		}
+	}
+
+	// Fills _visible with the indices of every sphere inside or touching all six planes and
+	// returns how many there are. Four spheres per iteration when SSE is available.
+	uint32_t Cull(const float _planes[6][4], std::vector<uint32_t>& _visible)
+	{
+		auto start = std::chrono::steady_clock::now();
+#ifdef INSTANCE_CULLER_SSE
+		_visible.resize(centerX.size());
+		__m128 planes[6][4];
+		for (int p = 0; p < 6; ++p)
+			for (int i = 0; i < 4; ++i)
+				planes[p][i] = _mm_set1_ps(_planes[p][i]);
+		uint32_t* out = _visible.data();
+		uint32_t visible = 0;
+		for (uint32_t i = 0; i < centerX.size(); i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]);
+			__m128 y = _mm_loadu_ps(&centerY[i]);
+			__m128 z = _mm_loadu_ps(&centerZ[i]);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[0][0], x), _mm_mul_ps(planes[0][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[0][2], z), planes[0][3])), negativeRadius);
+			for (int p = 1; p < 6; ++p) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+					_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			// Branchless append, every lane writes and only survivors advance
+			int mask = _mm_movemask_ps(inside);
+			for (uint32_t lane = 0; lane < 4; ++lane) {
+				out[visible] = i + lane;
+				visible += (mask >> lane) & 1;
+			}
+		}
+		_visible.resize(visible);
+#else
+		uint32_t visible = CullScalar(_planes, _visible);
+#endif
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		cullMilliseconds += elapsed.count();
+		lastVisible = visible;
+		visibleTotal += visible;
+		culledTotal += count - visible;
+		++frames;
+		return visible;
+	}
+
+	// One sphere at a time, the reference Cull has to match
+	uint32_t CullScalar(const float _planes[6][4], std::vector<uint32_t>& _visible) const
+	{
+		_visible.clear();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; ++p)
+				inside = (_planes[p][0] * centerX[i] + _planes[p][1] * centerY[i]) + (_planes[p][2] * centerZ[i] + _planes[p][3]) >= -radius[i];
+			if (inside)
+				_visible.push_back(i);
+		}
+		return static_cast<uint32_t>(_visible.size());
+	}
+
+	void ReportStats(const char* _label) const
+	{
+		std::cout << _label << ": last frame " << lastVisible << " visible, " << count - lastVisible << " culled";
+		if (visibleTotal + culledTotal > 0)
+			std::cout << ", " << 100.0 * static_cast<double>(culledTotal) / static_cast<double>(visibleTotal + culledTotal)
+				<< "% culled over " << frames << " frame(s), " << cullMilliseconds / frames << " ms per frame";
+		std::cout << "\n";
+	}
+};
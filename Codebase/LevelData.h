@@ -1,4 +1,6 @@
 #pragma once
+#include <string>
+#include <unordered_map>
 #include "h2bParser.h"
 #include "Gateware/Gateware.h"
 
@@ -7,12 +9,13 @@ class LevelData
 public:
 	struct UniqueMesh {
 		std::string name;
-		unsigned int indexCount;
+		unsigned int indexCount = 0;
 		unsigned int instanceCount = 1;
-		unsigned int firstIndex;
-		unsigned int vertexOffset;
-		unsigned int transformOffset;			//goes to push constant
-		unsigned int materialIndex;				//goes to push constant
+		unsigned int firstIndex = 0;
+		unsigned int vertexOffset = 0;
+		unsigned int transformOffset = 0;		//goes to the draw list's per draw data
+		unsigned int materialIndex = 0;			//goes to the draw list's per draw data
+		GW::MATH::GSPHEREF bounds = {};			//model space bounding sphere of the vertices it draws
 	};
 
 	// Members
@@ -32,47 +35,94 @@ public:
 	// Returns a pointer to a unique mesh if it exists
 	UniqueMesh* GetMesh(const std::string& _meshName)
 	{
-		for (unsigned int i = 0; i < uniqueMeshes.size(); i++)
-		{
-			if (uniqueMeshes[i].name.compare(_meshName) == 0)
-				return &uniqueMeshes[i];
-		}
-		return nullptr;
+		auto found = meshLookup.find(_meshName);
+		if (found == meshLookup.end())
+			return nullptr;
+		return &uniqueMeshes[found->second];
+	}
+
+	// Returns the ID (index into uniqueMeshes) of a unique mesh, creating it if it does not exist
+	unsigned int RegisterMesh(const std::string& _meshName)
+	{
+		auto found = meshLookup.find(_meshName);
+		if (found != meshLookup.end())
+			return found->second;
+		unsigned int meshId = static_cast<unsigned int>(uniqueMeshes.size());
+		UniqueMesh newMesh;
+		newMesh.name = _meshName;
+		newMesh.instanceCount = 0;
+		newMesh.transformOffset = 0;
+		uniqueMeshes.push_back(newMesh);
+		instanceBuckets.emplace_back();
+		meshLookup.emplace(_meshName, meshId);
+		return meshId;
+	}
+
+	// Renames a registered unique mesh, keeping it findable under its new name
+	void RenameMesh(unsigned int _meshId, const std::string& _meshName)
+	{
+		meshLookup.erase(uniqueMeshes[_meshId].name);
+		uniqueMeshes[_meshId].name = _meshName;
+		meshLookup[_meshName] = _meshId;
+	}
+
+	// Add an instance of a registered unique mesh. Instances are bucketed per mesh
+	// and only laid out in transforms once CompactInstances is called.
+	void AddInstance(unsigned int _meshId, const GW::MATH::GMATRIXF& _matrix)
+	{
+		instanceBuckets[_meshId].push_back(_matrix);
 	}
 
 	// Add an instance of a unique mesh OR create a new unique mesh if does not exist
-	void AddInstance(std::string _meshName, GW::MATH::GMATRIXF _matrix)
+	void AddInstance(const std::string& _meshName, const GW::MATH::GMATRIXF& _matrix)
 	{
-		// NOTE: 
-		// There is currently an instance-per-draw limit of 1024 
-		// in the pixel and vertex shaders. This AddInstance setup is
-		// currently designed to have no limit on instance count and 
-		// will cause bugs if there are more than 1024 duplicates of an
-		// object in a scene.
-		//
+		AddInstance(RegisterMesh(_meshName), _matrix);
+	}
 
-		// ALSO NOTE:
-		// The way this is currently set up if you don't add instances 
-		// in order, with duplicates next to each other, then it may
-		// cause the transformOffset of some uniqueMeshes to no longer 
-		// be valid.
-		//
-		
-		UniqueMesh* instance = GetMesh(_meshName);
-		if (instance)
+	// Lays every mesh's instances out contiguously in transforms (in mesh ID order)
+	// and fills in each unique mesh's transformOffset and instanceCount.
+	// Call once, after all instances have been added.
+	void CompactInstances()
+	{
+		size_t total = 0;
+		for (const std::vector<GW::MATH::GMATRIXF>& bucket : instanceBuckets)
+			total += bucket.size();
+		transforms.clear();
+		transforms.reserve(total);
+		for (size_t meshId = 0; meshId < instanceBuckets.size(); meshId++)
 		{
-			auto iter = transforms.begin() + instance->transformOffset + instance->instanceCount;
-			transforms.insert(iter, _matrix);
-			instance->instanceCount++;
+			std::vector<GW::MATH::GMATRIXF>& bucket = instanceBuckets[meshId];
+			uniqueMeshes[meshId].transformOffset = static_cast<unsigned int>(transforms.size());
+			uniqueMeshes[meshId].instanceCount = static_cast<unsigned int>(bucket.size());
+			transforms.insert(transforms.end(), bucket.begin(), bucket.end());
+			std::vector<GW::MATH::GMATRIXF>().swap(bucket);
 		}
-		else
+	}
+
+	// Fits every unique mesh's bounds around the vertices its indices reference.
+	// Call once vertices and indices are final.
+	void ComputeMeshBounds()
+	{
+		std::vector<GW::MATH::GVECTORF> points;
+		for (UniqueMesh& mesh : uniqueMeshes)
 		{
-			UniqueMesh newInstance;
-			newInstance.name = _meshName;
-			newInstance.instanceCount = 1;
-			newInstance.transformOffset = transforms.size();
-			transforms.push_back(_matrix);
-			uniqueMeshes.push_back(newInstance);
+			points.clear();
+			points.reserve(mesh.indexCount);
+			for (unsigned int i = mesh.firstIndex; i < mesh.firstIndex + mesh.indexCount; i++)
+			{
+				const H2B::VECTOR& pos = vertices[mesh.vertexOffset + indices[i]].pos;
+				points.push_back({ pos.x, pos.y, pos.z, 0.0f });
+			}
+			mesh.bounds = {};
+			if (points.size() == 1)
+				mesh.bounds.data = points[0];
+			else if (points.size() > 1 && +GW::MATH::GCollision::ComputeSphereFromPointsF(points.data(),
+				static_cast<unsigned int>(points.size()), mesh.bounds))
+				mesh.bounds.radius *= 1.0001f;	// rounding can leave the farthest point just outside
 		}
 	}
+
+private:
+	std::unordered_map<std::string, unsigned int> meshLookup;
+	std::vector<std::vector<GW::MATH::GMATRIXF>> instanceBuckets;	// pending instances per mesh ID
 };
\ No newline at end of file
@@ -0,0 +1,314 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include "Gateware/Gateware.h"
+
+// Level files come in two flavours:
+//  - the text format written by Tools/LevelExporter.py (GameLevel.txt)
+//  - a compiled binary form (.lvl) produced by the LevelConverter tool
+// Both load into the same LevelFile::Level so the renderer does not care which one it got.
+namespace LevelFile {
+
+	// Binary layout (little endian). Every section starts on a 64 byte boundary
+	// so the matrices can be used straight out of the file buffer.
+	//
+	//	Header
+	//	GMATRIXF	matrices[instanceCount]
+	//	uint32_t	meshIds[instanceCount]			index into the string table
+	//	GMATRIXF	lightMatrices[lightCount]
+	//	uint32_t	lightNameIds[lightCount]		index into the string table
+	//	uint32_t	nameOffsets[meshNameCount]		byte offset of each name in the string table
+	//	char		stringTable[stringTableSize]	null terminated mesh and light names
+	//
+	static const char binaryMagic[4] = { 'L', 'V', 'L', 'B' };
+	static const uint32_t binaryVersion = 2;
+	static const uint64_t sectionAlignment = 64;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t instanceCount;
+		uint32_t meshNameCount;
+		uint32_t lightCount;
+		uint32_t reserved;
+		uint64_t stringTableSize;
+		uint64_t matricesOffset;
+		uint64_t meshIdsOffset;
+		uint64_t lightMatricesOffset;
+		uint64_t lightNameIdsOffset;
+		uint64_t nameOffsetsOffset;
+		uint64_t stringTableOffset;
+		uint64_t fileSize;
+	};
+
+	struct Level {
+		std::vector<std::string> meshNames;				// string table, a mesh's ID is its index
+		std::vector<uint32_t> meshIds;					// one per instance
+		std::vector<GW::MATH::GMATRIXF> matrices;		// one per instance
+		std::vector<uint32_t> lightNameIds;				// one per light, shares the string table
+		std::vector<GW::MATH::GMATRIXF> lightMatrices;	// one per light
+
+		void Clear()
+		{
+			meshNames.clear();
+			meshIds.clear();
+			matrices.clear();
+			lightNameIds.clear();
+			lightMatrices.clear();
+			nameLookup.clear();
+		}
+
+		// Returns the ID of a mesh name, adding it to the string table if it is new
+		uint32_t InternName(const std::string& _meshName)
+		{
+			auto found = nameLookup.find(_meshName);
+			if (found != nameLookup.end())
+				return found->second;
+			uint32_t id = static_cast<uint32_t>(meshNames.size());
+			meshNames.push_back(_meshName);
+			nameLookup.emplace(_meshName, id);
+			return id;
+		}
+
+		void AddInstance(const std::string& _meshName, const GW::MATH::GMATRIXF& _matrix)
+		{
+			meshIds.push_back(InternName(_meshName));
+			matrices.push_back(_matrix);
+		}
+
+		void AddLight(const std::string& _lightName, const GW::MATH::GMATRIXF& _matrix)
+		{
+			lightNameIds.push_back(InternName(_lightName));
+			lightMatrices.push_back(_matrix);
+		}
+
+	private:
+		std::unordered_map<std::string, uint32_t> nameLookup;
+	};
+
+	inline uint64_t AlignUp(uint64_t _value, uint64_t _alignment)
+	{
+		return (_value + _alignment - 1) & ~(_alignment - 1);
+	}
+
+	// Forward-only cursor over a text buffer that was read in one go
+	struct TextCursor {
+		const char* at;
+		const char* end;
+
+		bool Done() const { return at >= end; }
+
+		// Returns the next line with indentation and line endings stripped (no copies)
+		std::string_view NextLine()
+		{
+			while (at < end && (*at == ' ' || *at == '\t'))
+				++at;
+			const char* start = at;
+			while (at < end && *at != '\n')
+				++at;
+			const char* stop = at;
+			if (at < end)
+				++at; // step over '\n'
+			while (stop > start && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t'))
+				--stop;
+			return std::string_view(start, stop - start);
+		}
+
+		// Parses one float, skipping any leading blanks
+		bool NextFloat(float& _out)
+		{
+			while (at < end && (*at == ' ' || *at == '\t' || *at == '+'))
+				++at;
+			std::from_chars_result result = std::from_chars(at, end, _out);
+			if (result.ec != std::errc())
+				return false;
+			at = result.ptr;
+			return true;
+		}
+
+		// Moves just past the next occurrence of _c
+		bool SkipPast(char _c)
+		{
+			const void* found = memchr(at, _c, end - at);
+			if (found == nullptr)
+				return false;
+			at = static_cast<const char*>(found) + 1;
+			return true;
+		}
+	};
+
+	// Parses "<Matrix 4x4 (a, b, c, d)" followed by three more "(a, b, c, d)" rows
+	inline bool ParseMatrix(TextCursor& _cursor, GW::MATH::GMATRIXF& _outMatrix)
+	{
+		for (int i = 0; i < 16; ++i) {
+			if (!_cursor.SkipPast((i % 4 == 0) ? '(' : ','))
+				return false;
+			if (!_cursor.NextFloat(_outMatrix.data[i]))
+				return false;
+		}
+		// finish the line holding the closing ")>"
+		_cursor.NextLine();
+		return true;
+	}
+
+	// Loads the Blender exporter's text format. The file is read once and tokenized
+	// in place; mesh names are only copied the first time they show up.
+	inline bool ReadText(const char* _path, Level& _level)
+	{
+		_level.Clear();
+		std::ifstream file(_path, std::ios::in | std::ios::binary | std::ios::ate);
+
+		// Failed to open
+		if (!file.is_open())
+			return false;
+		std::vector<char> buffer(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		if (!file.read(buffer.data(), buffer.size()))
+			return false;
+
+		// Walk the blocks, anything that is not a MESH or LIGHT is skipped line by line
+		TextCursor cursor = { buffer.data(), buffer.data() + buffer.size() };
+		std::string name;
+		while (!cursor.Done()) {
+			std::string_view line = cursor.NextLine();
+			bool isMesh = (line == "MESH");
+			if (!isMesh && line != "LIGHT")
+				continue;
+
+			// Get name, trimming off Blender's ".001" style duplicate suffix
+			line = cursor.NextLine();
+			line = line.substr(0, line.find('.'));
+			name.assign(line.data(), line.size());
+
+			// Get matrix
+			GW::MATH::GMATRIXF m;
+			if (!ParseMatrix(cursor, m))
+				return false;
+			if (isMesh)
+				_level.AddInstance(name, m);
+			else
+				_level.AddLight(name, m);
+		}
+		return true;
+	}
+
+	// True if _count elements of _size bytes starting at _offset lie inside the file,
+	// written so a crafted header cannot wrap the arithmetic
+	inline bool SectionFits(uint64_t _offset, uint64_t _count, uint64_t _size, uint64_t _fileSize)
+	{
+		return _offset <= _fileSize && _count <= (_fileSize - _offset) / _size;
+	}
+
+	// Loads a compiled level with a single read
+	inline bool ReadBinary(const char* _path, Level& _level)
+	{
+		_level.Clear();
+		std::ifstream file(_path, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		std::streamoff size = file.tellg();
+		if (size < static_cast<std::streamoff>(sizeof(Header)))
+			return false;
+		std::vector<char> buffer(static_cast<size_t>(size));
+		file.seekg(0);
+		if (!file.read(buffer.data(), size))
+			return false;
+
+		// Validate header and section bounds before touching anything else
+		Header header;
+		memcpy(&header, buffer.data(), sizeof(Header));
+		if (memcmp(header.magic, binaryMagic, 4) != 0 || header.version != binaryVersion ||
+			header.fileSize != static_cast<uint64_t>(size))
+			return false;
+		uint64_t fileSize = header.fileSize;
+		if (!SectionFits(header.matricesOffset, header.instanceCount, sizeof(GW::MATH::GMATRIXF), fileSize) ||
+			!SectionFits(header.meshIdsOffset, header.instanceCount, sizeof(uint32_t), fileSize) ||
+			!SectionFits(header.lightMatricesOffset, header.lightCount, sizeof(GW::MATH::GMATRIXF), fileSize) ||
+			!SectionFits(header.lightNameIdsOffset, header.lightCount, sizeof(uint32_t), fileSize) ||
+			!SectionFits(header.nameOffsetsOffset, header.meshNameCount, sizeof(uint32_t), fileSize) ||
+			!SectionFits(header.stringTableOffset, header.stringTableSize, 1, fileSize))
+			return false;
+
+		// Bulk copy the packed sections
+		_level.matrices.resize(header.instanceCount);
+		memcpy(_level.matrices.data(), buffer.data() + header.matricesOffset,
+			sizeof(GW::MATH::GMATRIXF) * header.instanceCount);
+		_level.meshIds.resize(header.instanceCount);
+		memcpy(_level.meshIds.data(), buffer.data() + header.meshIdsOffset,
+			sizeof(uint32_t) * header.instanceCount);
+		_level.lightMatrices.resize(header.lightCount);
+		memcpy(_level.lightMatrices.data(), buffer.data() + header.lightMatricesOffset,
+			sizeof(GW::MATH::GMATRIXF) * header.lightCount);
+		_level.lightNameIds.resize(header.lightCount);
+		memcpy(_level.lightNameIds.data(), buffer.data() + header.lightNameIdsOffset,
+			sizeof(uint32_t) * header.lightCount);
+
+		// Rebuild the string table
+		const char* strings = buffer.data() + header.stringTableOffset;
+		_level.meshNames.reserve(header.meshNameCount);
+		for (uint32_t i = 0; i < header.meshNameCount; ++i) {
+			uint32_t offset;
+			memcpy(&offset, buffer.data() + header.nameOffsetsOffset + sizeof(uint32_t) * i, sizeof(uint32_t));
+			if (offset >= header.stringTableSize ||
+				memchr(strings + offset, '\0', header.stringTableSize - offset) == nullptr)
+				return false;
+			// WriteBinary never repeats a name, a repeat would shift every id after it
+			if (_level.InternName(strings + offset) != i)
+				return false;
+		}
+		for (uint32_t id : _level.meshIds)
+			if (id >= _level.meshNames.size())
+				return false;
+		for (uint32_t id : _level.lightNameIds)
+			if (id >= _level.meshNames.size())
+				return false;
+		return true;
+	}
+
+	inline bool WriteBinary(const char* _path, const Level& _level)
+	{
+		// Lay out the sections
+		Header header = {};
+		memcpy(header.magic, binaryMagic, 4);
+		header.version = binaryVersion;
+		header.instanceCount = static_cast<uint32_t>(_level.matrices.size());
+		header.meshNameCount = static_cast<uint32_t>(_level.meshNames.size());
+		header.lightCount = static_cast<uint32_t>(_level.lightMatrices.size());
+		for (const std::string& name : _level.meshNames)
+			header.stringTableSize += name.size() + 1;
+		header.matricesOffset = AlignUp(sizeof(Header), sectionAlignment);
+		header.meshIdsOffset = AlignUp(header.matricesOffset + sizeof(GW::MATH::GMATRIXF) * header.instanceCount, sectionAlignment);
+		header.lightMatricesOffset = AlignUp(header.meshIdsOffset + sizeof(uint32_t) * header.instanceCount, sectionAlignment);
+		header.lightNameIdsOffset = AlignUp(header.lightMatricesOffset + sizeof(GW::MATH::GMATRIXF) * header.lightCount, sectionAlignment);
+		header.nameOffsetsOffset = AlignUp(header.lightNameIdsOffset + sizeof(uint32_t) * header.lightCount, sectionAlignment);
+		header.stringTableOffset = AlignUp(header.nameOffsetsOffset + sizeof(uint32_t) * header.meshNameCount, sectionAlignment);
+		header.fileSize = header.stringTableOffset + header.stringTableSize;
+
+		// Fill a single buffer and write it out in one go
+		std::vector<char> buffer(static_cast<size_t>(header.fileSize), 0);
+		memcpy(buffer.data(), &header, sizeof(Header));
+		memcpy(buffer.data() + header.matricesOffset, _level.matrices.data(), sizeof(GW::MATH::GMATRIXF) * header.instanceCount);
+		memcpy(buffer.data() + header.meshIdsOffset, _level.meshIds.data(), sizeof(uint32_t) * header.instanceCount);
+		memcpy(buffer.data() + header.lightMatricesOffset, _level.lightMatrices.data(), sizeof(GW::MATH::GMATRIXF) * header.lightCount);
+		memcpy(buffer.data() + header.lightNameIdsOffset, _level.lightNameIds.data(), sizeof(uint32_t) * header.lightCount);
+		uint32_t stringOffset = 0;
+		for (uint32_t i = 0; i < header.meshNameCount; ++i) {
+			memcpy(buffer.data() + header.nameOffsetsOffset + sizeof(uint32_t) * i, &stringOffset, sizeof(uint32_t));
+			memcpy(buffer.data() + header.stringTableOffset + stringOffset,
+				_level.meshNames[i].c_str(), _level.meshNames[i].size() + 1);
+			stringOffset += static_cast<uint32_t>(_level.meshNames[i].size() + 1);
+		}
+
+		std::ofstream file(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file.write(buffer.data(), buffer.size());
+		return file.good();
+	}
+}
@@ -0,0 +1,420 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "h2bParser.h"
+#include "FileUtil.h"
+
+// Load time passes that shrink or reorder a model's vertex and index data before
+// it is merged into the level buffers.
+namespace MeshOptimizer {
+
+	// Hash of a vertex's raw bytes
+	inline uint64_t HashVertex(const H2B::VERTEX& _vertex)
+	{
+		return FileUtil::Hash(&_vertex, sizeof(H2B::VERTEX));
+	}
+
+	// Collapses bit-identical vertices (position, uvw and normal all equal).
+	// _outVertices receives the unique vertices in first use order and _outRemap maps
+	// every original vertex to its new index. Returns the unique vertex count.
+	inline unsigned WeldVertices(const H2B::VERTEX* _vertices, unsigned _vertexCount,
+		std::vector<H2B::VERTEX>& _outVertices, std::vector<unsigned>& _outRemap)
+	{
+		_outVertices.clear();
+		_outVertices.reserve(_vertexCount);
+		_outRemap.resize(_vertexCount);
+
+		// Open addressing table of unique vertex indices, kept at most half full
+		size_t tableSize = 16;
+		while (tableSize < _vertexCount * 2u)
+			tableSize *= 2;
+		std::vector<unsigned> table(tableSize, UINT32_MAX);
+		for (unsigned i = 0; i < _vertexCount; ++i) {
+			size_t slot = static_cast<size_t>(HashVertex(_vertices[i])) & (tableSize - 1);
+			while (table[slot] != UINT32_MAX &&
+				memcmp(&_outVertices[table[slot]], &_vertices[i], sizeof(H2B::VERTEX)) != 0)
+				slot = (slot + 1) & (tableSize - 1);
+			if (table[slot] == UINT32_MAX) {
+				table[slot] = static_cast<unsigned>(_outVertices.size());
+				_outVertices.push_back(_vertices[i]);
+			}
+			_outRemap[i] = table[slot];
+		}
+		return static_cast<unsigned>(_outVertices.size());
+	}
+
+	// Appends _count indices to _out, sending each through _remap when one is given.
+	// Returns false, leaving _out untouched, if an index is not below _vertexCount.
+	inline bool AppendIndices(const unsigned* _indices, size_t _count, unsigned _vertexCount, const std::vector<unsigned>& _remap, std::vector<unsigned>& _out)
+	{
+		for (size_t i = 0; i < _count; ++i)
+			if (_indices[i] >= _vertexCount)
+				return false;
+		if (_remap.empty()) {
+			_out.insert(_out.end(), _indices, _indices + _count);
+			return true;
+		}
+		size_t start = _out.size();
+		_out.resize(start + _count);
+		for (size_t i = 0; i < _count; ++i)
+			_out[start + i] = _remap[_indices[i]];
+		return true;
+	}
+
+	// Post-transform cache efficiency of an index list
+	struct VertexCacheStats {
+		float acmr = 0.0f;	// vertices transformed per triangle (0.5 is ideal, 3 is worst)
+		float atvr = 0.0f;	// vertices transformed per unique vertex used (1 is ideal)
+	};
+
+	// Simulates a FIFO post-transform cache of _cacheSize entries over one index list
+	inline VertexCacheStats AnalyzeVertexCache(const unsigned* _indices, size_t _indexCount, unsigned _vertexCount, unsigned _cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		if (_indexCount < 3)
+			return stats;
+		std::vector<unsigned> timestamps(_vertexCount, 0);
+		std::vector<char> used(_vertexCount, 0);
+		unsigned time = _cacheSize + 1, misses = 0, unique = 0;
+		for (size_t i = 0; i < _indexCount; ++i) {
+			unsigned index = _indices[i];
+			if (time - timestamps[index] > _cacheSize) {
+				timestamps[index] = time++;
+				++misses;
+			}
+			if (!used[index]) {
+				used[index] = 1;
+				++unique;
+			}
+		}
+		stats.acmr = static_cast<float>(misses) / static_cast<float>(_indexCount / 3);
+		stats.atvr = static_cast<float>(misses) / static_cast<float>(unique);
+		return stats;
+	}
+
+	// Reorders triangles for post-transform cache hits (Forsyth's linear-speed algorithm).
+	// Vertices are scored by their position in a simulated LRU cache and by how many
+	// unprocessed triangles still use them; the best scoring cached triangle goes next.
+	inline void OptimizeVertexCache(unsigned* _indices, size_t _indexCount, unsigned _vertexCount)
+	{
+		const int cacheSize = 32;
+		const float lastTriangleScore = 0.75f, cacheDecayPower = 1.5f, valenceBoostScale = 2.0f, valenceBoostPower = 0.5f;
+		size_t triangleCount = _indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		// Triangle adjacency per vertex
+		std::vector<unsigned> liveTriangles(_vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+			++liveTriangles[_indices[i]];
+		std::vector<unsigned> adjacencyOffsets(_vertexCount + 1, 0);
+		for (unsigned v = 0; v < _vertexCount; ++v)
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		std::vector<unsigned> adjacency(triangleCount * 3);
+		std::vector<unsigned> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+			adjacency[fill[_indices[i]]++] = static_cast<unsigned>(i / 3);
+
+		auto vertexScore = [&](int _cachePosition, unsigned _live) -> float {
+			if (_live == 0)
+				return -1.0f;
+			float score = 0.0f;
+			if (_cachePosition >= 0)
+				score = (_cachePosition < 3) ? lastTriangleScore :
+					std::pow(1.0f - (_cachePosition - 3) / static_cast<float>(cacheSize - 3), cacheDecayPower);
+			return score + valenceBoostScale * std::pow(static_cast<float>(_live), -valenceBoostPower);
+		};
+
+		std::vector<int> cachePosition(_vertexCount, -1);
+		std::vector<float> vertexScores(_vertexCount);
+		for (unsigned v = 0; v < _vertexCount; ++v)
+			vertexScores[v] = vertexScore(-1, liveTriangles[v]);
+		std::vector<float> triangleScores(triangleCount);
+		for (size_t t = 0; t < triangleCount; ++t)
+			triangleScores[t] = vertexScores[_indices[t * 3]] + vertexScores[_indices[t * 3 + 1]] + vertexScores[_indices[t * 3 + 2]];
+		std::vector<char> emitted(triangleCount, 0);
+		std::vector<unsigned> output;
+		output.reserve(triangleCount * 3);
+		std::vector<unsigned> cache, nextCache;
+		cache.reserve(cacheSize + 3);
+		nextCache.reserve(cacheSize + 3);
+		size_t fallbackCursor = 0;
+
+		size_t best = 0;
+		float bestScore = triangleScores[0];
+		for (size_t t = 1; t < triangleCount; ++t)
+			if (triangleScores[t] > bestScore) {
+				bestScore = triangleScores[t];
+				best = t;
+			}
+		while (true) {
+			// Emit the triangle and retire it from its vertices' adjacency
+			emitted[best] = 1;
+			const unsigned* tri = _indices + best * 3;
+			output.insert(output.end(), tri, tri + 3);
+			for (int k = 0; k < 3; ++k) {
+				unsigned v = tri[k];
+				unsigned* begin = adjacency.data() + adjacencyOffsets[v];
+				unsigned* end = begin + liveTriangles[v];
+				*std::find(begin, end, static_cast<unsigned>(best)) = end[-1];
+				--liveTriangles[v];
+			}
+
+			// Move its vertices to the front of the cache
+			nextCache.assign(tri, tri + 3);
+			for (unsigned v : cache)
+				if (v != tri[0] && v != tri[1] && v != tri[2])
+					nextCache.push_back(v);
+			cache.swap(nextCache);
+
+			// Rescore everything the cache touched and pick the best cached triangle
+			best = SIZE_MAX;
+			bestScore = -1.0f;
+			for (size_t i = 0; i < cache.size(); ++i) {
+				unsigned v = cache[i];
+				cachePosition[v] = (i < static_cast<size_t>(cacheSize)) ? static_cast<int>(i) : -1;
+				float newScore = vertexScore(cachePosition[v], liveTriangles[v]);
+				float delta = newScore - vertexScores[v];
+				vertexScores[v] = newScore;
+				for (unsigned a = 0; a < liveTriangles[v]; ++a) {
+					unsigned t = adjacency[adjacencyOffsets[v] + a];
+					triangleScores[t] += delta;
+				}
+			}
+			for (unsigned v : cache)
+				for (unsigned a = 0; a < liveTriangles[v]; ++a) {
+					unsigned t = adjacency[adjacencyOffsets[v] + a];
+					if (triangleScores[t] > bestScore) {
+						bestScore = triangleScores[t];
+						best = t;
+					}
+				}
+			if (cache.size() > static_cast<size_t>(cacheSize))
+				cache.resize(cacheSize);
+
+			// Nothing cached is left, restart from the next unemitted triangle
+			if (best == SIZE_MAX) {
+				while (fallbackCursor < triangleCount && emitted[fallbackCursor])
+					++fallbackCursor;
+				if (fallbackCursor == triangleCount)
+					break;
+				best = fallbackCursor;
+			}
+		}
+		memcpy(_indices, output.data(), output.size() * sizeof(unsigned));
+	}
+
+	// Reorders cache optimized triangles to cut overdraw. The list is split into
+	// clusters wherever the simulated cache goes cold, and clusters facing away from
+	// the mesh center are drawn first so they occlude the rest. The new order is kept
+	// only while its ACMR stays within _threshold of the cache optimized order.
+	inline void OptimizeOverdraw(unsigned* _indices, size_t _indexCount, const H2B::VERTEX* _vertices, unsigned _vertexCount, float _threshold = 1.05f)
+	{
+		const unsigned cacheSize = 16;
+		size_t triangleCount = _indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		// Cluster boundaries: triangles whose three vertices all miss the cache
+		std::vector<unsigned> clusterStarts;
+		std::vector<unsigned> timestamps(_vertexCount, 0);
+		unsigned time = cacheSize + 1;
+		for (size_t t = 0; t < triangleCount; ++t) {
+			unsigned misses = 0;
+			for (int k = 0; k < 3; ++k) {
+				unsigned v = _indices[t * 3 + k];
+				if (time - timestamps[v] > cacheSize) {
+					timestamps[v] = time++;
+					++misses;
+				}
+			}
+			if (t == 0 || misses == 3)
+				clusterStarts.push_back(static_cast<unsigned>(t));
+		}
+		size_t clusterCount = clusterStarts.size();
+		if (clusterCount < 2)
+			return;
+		clusterStarts.push_back(static_cast<unsigned>(triangleCount));
+
+		// Mesh centroid
+		H2B::VECTOR center = {};
+		for (size_t i = 0; i < triangleCount * 3; ++i) {
+			const H2B::VECTOR& p = _vertices[_indices[i]].pos;
+			center.x += p.x; center.y += p.y; center.z += p.z;
+		}
+		float inverse = 1.0f / static_cast<float>(triangleCount * 3);
+		center.x *= inverse; center.y *= inverse; center.z *= inverse;
+
+		// Sort key per cluster: how far its centroid lies along its average normal
+		std::vector<float> sortKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c) {
+			H2B::VECTOR centroid = {}, normal = {};
+			unsigned first = clusterStarts[c] * 3, last = clusterStarts[c + 1] * 3;
+			for (unsigned i = first; i < last; ++i) {
+				const H2B::VERTEX& v = _vertices[_indices[i]];
+				centroid.x += v.pos.x; centroid.y += v.pos.y; centroid.z += v.pos.z;
+				normal.x += v.nrm.x; normal.y += v.nrm.y; normal.z += v.nrm.z;
+			}
+			float count = static_cast<float>(last - first);
+			centroid.x = centroid.x / count - center.x;
+			centroid.y = centroid.y / count - center.y;
+			centroid.z = centroid.z / count - center.z;
+			float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+			sortKeys[c] = (length > 0.0f) ? (centroid.x * normal.x + centroid.y * normal.y + centroid.z * normal.z) / length : 0.0f;
+		}
+		std::vector<unsigned> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c)
+			order[c] = static_cast<unsigned>(c);
+		std::stable_sort(order.begin(), order.end(), [&](unsigned _a, unsigned _b) { return sortKeys[_a] > sortKeys[_b]; });
+
+		std::vector<unsigned> sorted;
+		sorted.reserve(triangleCount * 3);
+		for (unsigned c : order)
+			sorted.insert(sorted.end(), _indices + clusterStarts[c] * 3, _indices + clusterStarts[c + 1] * 3);
+
+		// Keep the cache friendly order if the sort costs too much
+		float before = AnalyzeVertexCache(_indices, triangleCount * 3, _vertexCount, cacheSize).acmr;
+		float after = AnalyzeVertexCache(sorted.data(), sorted.size(), _vertexCount, cacheSize).acmr;
+		if (after <= before * _threshold)
+			memcpy(_indices, sorted.data(), sorted.size() * sizeof(unsigned));
+	}
+
+	// Renumbers vertices in the order the index list first uses them so vertex fetch
+	// walks memory forward. Vertices no index uses are dropped. Rewrites _indices and
+	// _vertices in place and returns the new vertex count.
+	inline unsigned OptimizeVertexFetch(unsigned* _indices, size_t _indexCount, H2B::VERTEX* _vertices, unsigned _vertexCount)
+	{
+		std::vector<unsigned> remap(_vertexCount, UINT32_MAX);
+		std::vector<H2B::VERTEX> reordered;
+		reordered.reserve(_vertexCount);
+		for (size_t i = 0; i < _indexCount; ++i) {
+			unsigned& index = remap[_indices[i]];
+			if (index == UINT32_MAX) {
+				index = static_cast<unsigned>(reordered.size());
+				reordered.push_back(_vertices[_indices[i]]);
+			}
+			_indices[i] = index;
+		}
+		if (!reordered.empty())
+			memcpy(_vertices, reordered.data(), reordered.size() * sizeof(H2B::VERTEX));
+		return static_cast<unsigned>(reordered.size());
+	}
+
+	// Compact GPU vertex, 16 bytes instead of 36. Bound as
+	//	pos	R16G16B16A16_UNORM	position within the mesh bounds (w unused)
+	//	uv	R16G16_SFLOAT
+	//	nrm	R16G16_SNORM		octahedral encoded normal
+#pragma pack(push,1)
+	struct PACKED_VERTEX {
+		uint16_t pos[4];
+		uint16_t uv[2];
+		int16_t nrm[2];
+	};
+#pragma pack(pop)
+
+	// Undoes the position quantization: pos = unorm * scale + offset
+	struct QuantizationParams {
+		float offset[3];
+		float scale[3];
+	};
+
+	inline QuantizationParams ComputeQuantization(const H2B::VERTEX* _vertices, size_t _vertexCount)
+	{
+		QuantizationParams params = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f } };
+		if (_vertexCount == 0)
+			return params;
+		float minimum[3] = { _vertices[0].pos.x, _vertices[0].pos.y, _vertices[0].pos.z };
+		float maximum[3] = { minimum[0], minimum[1], minimum[2] };
+		for (size_t i = 1; i < _vertexCount; ++i) {
+			const float* p = &_vertices[i].pos.x;
+			for (int k = 0; k < 3; ++k) {
+				minimum[k] = std::min(minimum[k], p[k]);
+				maximum[k] = std::max(maximum[k], p[k]);
+			}
+		}
+		for (int k = 0; k < 3; ++k) {
+			params.offset[k] = minimum[k];
+			params.scale[k] = (maximum[k] > minimum[k]) ? maximum[k] - minimum[k] : 1.0f;
+		}
+		return params;
+	}
+
+	// float to IEEE half, round to nearest even
+	inline uint16_t FloatToHalf(float _value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &_value, 4);
+		uint32_t sign = (bits >> 16) & 0x8000u;
+		uint32_t exponent = (bits >> 23) & 0xFFu;
+		uint32_t mantissa = bits & 0x7FFFFFu;
+		if (exponent == 0xFFu) // inf or nan
+			return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+		int halfExponent = static_cast<int>(exponent) - 127 + 15;
+		if (halfExponent >= 31) // overflow
+			return static_cast<uint16_t>(sign | 0x7C00u);
+		if (halfExponent <= 0) { // subnormal or zero
+			if (halfExponent < -10)
+				return static_cast<uint16_t>(sign);
+			mantissa |= 0x800000u;
+			uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+			uint32_t half = mantissa >> shift;
+			uint32_t rest = mantissa & ((1u << shift) - 1u), midpoint = 1u << (shift - 1);
+			if (rest > midpoint || (rest == midpoint && (half & 1u)))
+				++half;
+			return static_cast<uint16_t>(sign | half);
+		}
+		uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+		uint32_t rest = mantissa & 0x1FFFu;
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+			++half; // may carry into the exponent, which is still correct
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	inline int16_t FloatToSnorm16(float _value)
+	{
+		float clamped = std::max(-1.0f, std::min(1.0f, _value));
+		return static_cast<int16_t>(std::lround(clamped * 32767.0f));
+	}
+
+	// Octahedral mapping of a unit normal onto [-1, 1]^2
+	inline void OctEncode(const H2B::VECTOR& _normal, int16_t _out[2])
+	{
+		float length = std::fabs(_normal.x) + std::fabs(_normal.y) + std::fabs(_normal.z);
+		if (length == 0.0f) {
+			_out[0] = _out[1] = 0;
+			return;
+		}
+		float x = _normal.x / length, y = _normal.y / length;
+		if (_normal.z < 0.0f) {
+			float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = foldedX;
+			y = foldedY;
+		}
+		_out[0] = FloatToSnorm16(x);
+		_out[1] = FloatToSnorm16(y);
+	}
+
+	// Packs _vertexCount vertices against _params, appending them to _out
+	inline void PackVertices(const H2B::VERTEX* _vertices, size_t _vertexCount, const QuantizationParams& _params, std::vector<PACKED_VERTEX>& _out)
+	{
+		size_t start = _out.size();
+		_out.resize(start + _vertexCount);
+		for (size_t i = 0; i < _vertexCount; ++i) {
+			const H2B::VERTEX& v = _vertices[i];
+			PACKED_VERTEX& packed = _out[start + i];
+			const float* p = &v.pos.x;
+			for (int k = 0; k < 3; ++k) {
+				float unorm = std::max(0.0f, std::min(1.0f, (p[k] - _params.offset[k]) / _params.scale[k]));
+				packed.pos[k] = static_cast<uint16_t>(std::lround(unorm * 65535.0f));
+			}
+			packed.pos[3] = 65535;
+			packed.uv[0] = FloatToHalf(v.uvw.x);
+			packed.uv[1] = FloatToHalf(v.uvw.y);
+			OctEncode(v.nrm, packed.nrm);
+		}
+	}
+}
@@ -0,0 +1,274 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include "h2bParser.h"
+#include "LevelData.h"
+#include "LevelFile.h"
+#include "FileUtil.h"
+
+// Bakes a fully merged LevelData into one aligned blob so later launches can skip
+// level parsing, model loading and merging. The blob remembers the files it was
+// built from; it is only used while every one of them still has the same size and
+// write time it had when the blob was written.
+namespace SceneCache {
+
+	// Blob layout (little endian), every section starts on a 64 byte boundary
+	//
+	//	Header
+	//	MeshRecord	meshes[meshCount]
+	//	VERTEX		vertices[vertexCount]
+	//	unsigned	indices[indexCount]
+	//	GMATRIXF	transforms[transformCount]
+	//	ATTRIBUTES	materials[materialCount]
+	//	InputRecord	inputs[inputCount]
+	//	char		stringTable[stringTableSize]	mesh names and input paths
+	//
+	static const char magic[4] = { 'S', 'C', 'N', 'B' };
+	static const uint32_t version = 2;
+	static const uint64_t sectionAlignment = 64;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t inputHash;
+		uint32_t meshCount;
+		uint32_t inputCount;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+		uint64_t transformCount;
+		uint64_t materialCount;
+		uint64_t stringTableSize;
+		uint64_t meshesOffset;
+		uint64_t verticesOffset;
+		uint64_t indicesOffset;
+		uint64_t transformsOffset;
+		uint64_t materialsOffset;
+		uint64_t inputsOffset;
+		uint64_t stringTableOffset;
+		uint64_t fileSize;
+	};
+
+	struct MeshRecord {
+		uint32_t nameOffset;
+		uint32_t indexCount;
+		uint32_t instanceCount;
+		uint32_t firstIndex;
+		uint32_t vertexOffset;
+		uint32_t transformOffset;
+		uint32_t materialIndex;
+		float bounds[4];	// center xyz, radius
+	};
+
+	struct InputRecord {
+		uint32_t pathOffset;
+		uint32_t reserved;
+		uint64_t size;
+		int64_t writeTime;
+	};
+
+	// The bulk sections of a level. Read points these into the mapped blob so geometry
+	// goes to the uploader without an extra copy; they stay valid while the mapping is open.
+	struct Sections {
+		const H2B::VERTEX* vertices = nullptr;
+		size_t vertexCount = 0;
+		const unsigned* indices = nullptr;
+		size_t indexCount = 0;
+		const GW::MATH::GMATRIXF* transforms = nullptr;
+		size_t transformCount = 0;
+		const H2B::ATTRIBUTES* materials = nullptr;
+		size_t materialCount = 0;
+	};
+
+	// Sections of a level that was built in memory
+	inline Sections View(const LevelData& _level)
+	{
+		Sections sections;
+		sections.vertices = _level.vertices.data();
+		sections.vertexCount = _level.vertices.size();
+		sections.indices = _level.indices.data();
+		sections.indexCount = _level.indices.size();
+		sections.transforms = _level.transforms.data();
+		sections.transformCount = _level.transforms.size();
+		sections.materials = _level.materials.data();
+		sections.materialCount = _level.materials.size();
+		return sections;
+	}
+
+	// Current size and write time of an input, both zero if it is missing
+	inline InputRecord StatInput(const std::string& _path)
+	{
+		InputRecord record = {};
+		std::error_code error;
+		uintmax_t size = std::filesystem::file_size(_path, error);
+		if (error)
+			return record;
+		auto writeTime = std::filesystem::last_write_time(_path, error);
+		if (error)
+			return record;
+		record.size = static_cast<uint64_t>(size);
+		record.writeTime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+		return record;
+	}
+
+	// Hashes every input's path, size and write time together with the caller's options
+	inline uint64_t HashInputs(const std::vector<std::string>& _paths, const std::vector<InputRecord>& _records, uint64_t _options)
+	{
+		uint64_t hash = FileUtil::Hash(&version, sizeof(version));
+		hash = FileUtil::Hash(&_options, sizeof(_options), hash);
+		for (size_t i = 0; i < _paths.size(); ++i) {
+			hash = FileUtil::Hash(_paths[i].c_str(), _paths[i].size() + 1, hash);
+			hash = FileUtil::Hash(&_records[i].size, sizeof(_records[i].size), hash);
+			hash = FileUtil::Hash(&_records[i].writeTime, sizeof(_records[i].writeTime), hash);
+		}
+		return hash;
+	}
+
+	// Writes the merged level. _inputs lists every file the level was built from.
+	inline bool Write(const char* _path, const LevelData& _level, const std::vector<std::string>& _inputs, uint64_t _options)
+	{
+		// Snapshot the inputs
+		std::vector<InputRecord> inputs(_inputs.size());
+		for (size_t i = 0; i < _inputs.size(); ++i)
+			inputs[i] = StatInput(_inputs[i]);
+
+		// Build the string table
+		std::vector<char> strings;
+		std::vector<MeshRecord> meshes(_level.uniqueMeshes.size());
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			const LevelData::UniqueMesh& mesh = _level.uniqueMeshes[i];
+			meshes[i].nameOffset = static_cast<uint32_t>(strings.size());
+			strings.insert(strings.end(), mesh.name.c_str(), mesh.name.c_str() + mesh.name.size() + 1);
+			meshes[i].indexCount = mesh.indexCount;
+			meshes[i].instanceCount = mesh.instanceCount;
+			meshes[i].firstIndex = mesh.firstIndex;
+			meshes[i].vertexOffset = mesh.vertexOffset;
+			meshes[i].transformOffset = mesh.transformOffset;
+			meshes[i].materialIndex = mesh.materialIndex;
+			memcpy(meshes[i].bounds, &mesh.bounds, sizeof(meshes[i].bounds));
+		}
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			inputs[i].pathOffset = static_cast<uint32_t>(strings.size());
+			strings.insert(strings.end(), _inputs[i].c_str(), _inputs[i].c_str() + _inputs[i].size() + 1);
+		}
+
+		// Lay out the sections
+		Header header = {};
+		memcpy(header.magic, magic, 4);
+		header.version = version;
+		header.inputHash = HashInputs(_inputs, inputs, _options);
+		header.meshCount = static_cast<uint32_t>(meshes.size());
+		header.inputCount = static_cast<uint32_t>(inputs.size());
+		header.vertexCount = _level.vertices.size();
+		header.indexCount = _level.indices.size();
+		header.transformCount = _level.transforms.size();
+		header.materialCount = _level.materials.size();
+		header.stringTableSize = strings.size();
+		header.meshesOffset = LevelFile::AlignUp(sizeof(Header), sectionAlignment);
+		header.verticesOffset = LevelFile::AlignUp(header.meshesOffset + sizeof(MeshRecord) * header.meshCount, sectionAlignment);
+		header.indicesOffset = LevelFile::AlignUp(header.verticesOffset + sizeof(H2B::VERTEX) * header.vertexCount, sectionAlignment);
+		header.transformsOffset = LevelFile::AlignUp(header.indicesOffset + sizeof(unsigned) * header.indexCount, sectionAlignment);
+		header.materialsOffset = LevelFile::AlignUp(header.transformsOffset + sizeof(GW::MATH::GMATRIXF) * header.transformCount, sectionAlignment);
+		header.inputsOffset = LevelFile::AlignUp(header.materialsOffset + sizeof(H2B::ATTRIBUTES) * header.materialCount, sectionAlignment);
+		header.stringTableOffset = LevelFile::AlignUp(header.inputsOffset + sizeof(InputRecord) * header.inputCount, sectionAlignment);
+		header.fileSize = header.stringTableOffset + header.stringTableSize;
+
+		// Fill and write the blob in one go
+		std::vector<char> blob(static_cast<size_t>(header.fileSize), 0);
+		memcpy(blob.data(), &header, sizeof(Header));
+		memcpy(blob.data() + header.meshesOffset, meshes.data(), sizeof(MeshRecord) * header.meshCount);
+		memcpy(blob.data() + header.verticesOffset, _level.vertices.data(), sizeof(H2B::VERTEX) * header.vertexCount);
+		memcpy(blob.data() + header.indicesOffset, _level.indices.data(), sizeof(unsigned) * header.indexCount);
+		memcpy(blob.data() + header.transformsOffset, _level.transforms.data(), sizeof(GW::MATH::GMATRIXF) * header.transformCount);
+		memcpy(blob.data() + header.materialsOffset, _level.materials.data(), sizeof(H2B::ATTRIBUTES) * header.materialCount);
+		memcpy(blob.data() + header.inputsOffset, inputs.data(), sizeof(InputRecord) * header.inputCount);
+		memcpy(blob.data() + header.stringTableOffset, strings.data(), strings.size());
+
+		return FileUtil::WriteAtomic(_path, { { blob.data(), blob.size() } });
+	}
+
+	// Maps a baked level and, if none of its inputs changed, fills _level's meshes from it
+	// and points _sections into _blob, which has to stay open while they are used.
+	// Returns false (leaving _level untouched) on a missing, stale or damaged blob.
+	inline bool Read(const char* _path, H2B::MappedFile& _blob, LevelData& _level, Sections& _sections, uint64_t _options)
+	{
+		H2B::MappedFile blob;
+		if (!blob.Open(_path) || blob.Size() < sizeof(Header))
+			return false;
+		Header header;
+		memcpy(&header, blob.Data(), sizeof(Header));
+		if (memcmp(header.magic, magic, 4) != 0 || header.version != version || header.fileSize != blob.Size())
+			return false;
+		const uint64_t offsets[] = { header.meshesOffset, header.verticesOffset, header.indicesOffset, header.transformsOffset,
+			header.materialsOffset, header.inputsOffset, header.stringTableOffset };
+		for (uint64_t offset : offsets)
+			if (offset % sectionAlignment != 0)
+				return false;
+		if (!LevelFile::SectionFits(header.meshesOffset, header.meshCount, sizeof(MeshRecord), header.fileSize) ||
+			!LevelFile::SectionFits(header.verticesOffset, header.vertexCount, sizeof(H2B::VERTEX), header.fileSize) ||
+			!LevelFile::SectionFits(header.indicesOffset, header.indexCount, sizeof(unsigned), header.fileSize) ||
+			!LevelFile::SectionFits(header.transformsOffset, header.transformCount, sizeof(GW::MATH::GMATRIXF), header.fileSize) ||
+			!LevelFile::SectionFits(header.materialsOffset, header.materialCount, sizeof(H2B::ATTRIBUTES), header.fileSize) ||
+			!LevelFile::SectionFits(header.inputsOffset, header.inputCount, sizeof(InputRecord), header.fileSize) ||
+			!LevelFile::SectionFits(header.stringTableOffset, header.stringTableSize, 1, header.fileSize))
+			return false;
+		const char* strings = blob.Data() + header.stringTableOffset;
+		auto stringAt = [&](uint32_t _offset) -> const char* {
+			if (_offset >= header.stringTableSize ||
+				memchr(strings + _offset, '\0', header.stringTableSize - _offset) == nullptr)
+				return nullptr;
+			return strings + _offset;
+		};
+
+		// Validate against the inputs as they are on disk right now (a stat per file)
+		const InputRecord* inputs = reinterpret_cast<const InputRecord*>(blob.Data() + header.inputsOffset);
+		std::vector<std::string> paths(header.inputCount);
+		std::vector<InputRecord> current(header.inputCount);
+		for (uint32_t i = 0; i < header.inputCount; ++i) {
+			const char* path = stringAt(inputs[i].pathOffset);
+			if (path == nullptr)
+				return false;
+			paths[i] = path;
+			current[i] = StatInput(paths[i]);
+		}
+		if (HashInputs(paths, current, _options) != header.inputHash)
+			return false;
+
+		// Only the meshes are copied out, the bulk sections are used in place
+		const MeshRecord* meshes = reinterpret_cast<const MeshRecord*>(blob.Data() + header.meshesOffset);
+		for (uint32_t i = 0; i < header.meshCount; ++i)
+		{
+			// Every range has to lie inside its section, a mesh that draws nothing needs no material
+			const MeshRecord& mesh = meshes[i];
+			if (stringAt(mesh.nameOffset) == nullptr ||
+				uint64_t(mesh.firstIndex) + mesh.indexCount > header.indexCount ||
+				mesh.vertexOffset > header.vertexCount ||
+				uint64_t(mesh.transformOffset) + mesh.instanceCount > header.transformCount ||
+				(mesh.indexCount > 0 && mesh.materialIndex >= header.materialCount))
+				return false;
+		}
+		for (uint32_t i = 0; i < header.meshCount; ++i) {
+			LevelData::UniqueMesh& mesh = _level.uniqueMeshes[_level.RegisterMesh(stringAt(meshes[i].nameOffset))];
+			mesh.indexCount = meshes[i].indexCount;
+			mesh.instanceCount = meshes[i].instanceCount;
+			mesh.firstIndex = meshes[i].firstIndex;
+			mesh.vertexOffset = meshes[i].vertexOffset;
+			mesh.transformOffset = meshes[i].transformOffset;
+			mesh.materialIndex = meshes[i].materialIndex;
+			memcpy(&mesh.bounds, meshes[i].bounds, sizeof(meshes[i].bounds));
+		}
+		_sections.vertices = reinterpret_cast<const H2B::VERTEX*>(blob.Data() + header.verticesOffset);
+		_sections.vertexCount = static_cast<size_t>(header.vertexCount);
+		_sections.indices = reinterpret_cast<const unsigned*>(blob.Data() + header.indicesOffset);
+		_sections.indexCount = static_cast<size_t>(header.indexCount);
+		_sections.transforms = reinterpret_cast<const GW::MATH::GMATRIXF*>(blob.Data() + header.transformsOffset);
+		_sections.transformCount = static_cast<size_t>(header.transformCount);
+		_sections.materials = reinterpret_cast<const H2B::ATTRIBUTES*>(blob.Data() + header.materialsOffset);
+		_sections.materialCount = static_cast<size_t>(header.materialCount);
+		_blob = std::move(blob);
+		return true;
+	}
+}
\ No newline at end of file
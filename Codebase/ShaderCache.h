@@ -0,0 +1,128 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "FileUtil.h"
+#ifdef ENABLE_SHADERC
+	#include "shaderc/shaderc.h" // needed for compiling shaders on a cache miss
+	#ifdef _WIN32 // must use MT platform DLL libraries on windows
+		#pragma comment(lib, "shaderc_combined.lib")
+	#endif
+#endif
+
+// Compiled SPIR-V on disk, one file per shader variant. Files are named by a hash of
+// everything that changes the output (source, stage, entry point and options), so an
+// edited shader simply misses and old files are never picked up by mistake. The
+// ShaderCompiler tool fills the cache at build time; with ENABLE_SHADERC defined a
+// miss is compiled on the spot and written back.
+namespace ShaderCache {
+
+	// File layout: Header followed by codeSize bytes of SPIR-V
+	static const char magic[4] = { 'S', 'P', 'V', 'C' };
+	static const uint32_t version = 1;
+	static const uint32_t spirvMagic = 0x07230203;
+
+	enum Stage : uint32_t {
+		VERTEX,
+		FRAGMENT,
+		COMPUTE,
+	};
+
+	// Everything besides the source that changes the SPIR-V
+	struct Options {
+		bool packedVertices = false;	// defines PACKED_VERTICES
+		bool debugInfo = false;
+	};
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint64_t codeSize;
+	};
+
+	inline uint64_t Key(const char* _source, Stage _stage, const Options& _options, const char* _entryPoint = "main")
+	{
+		uint32_t fields[4] = { version, _stage, _options.packedVertices, _options.debugInfo };
+		uint64_t key = FileUtil::Hash(fields, sizeof(fields));
+		key = FileUtil::Hash(_entryPoint, strlen(_entryPoint) + 1, key);
+		return FileUtil::Hash(_source, strlen(_source), key);
+	}
+
+	inline std::string FilePath(const std::string& _directory, uint64_t _key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(_key));
+		return (std::filesystem::path(_directory) / name).string();
+	}
+
+	// Fills _code from the cached file for _key. Returns false (leaving _code empty)
+	// on a missing or damaged file.
+	inline bool Read(const std::string& _directory, uint64_t _key, std::vector<uint32_t>& _code)
+	{
+		_code.clear();
+		std::ifstream file(FilePath(_directory, _key), std::ios::in | std::ios::binary);
+		if (!file.is_open())
+			return false;
+		Header header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(Header)) ||
+			memcmp(header.magic, magic, 4) != 0 || header.version != version || header.key != _key ||
+			header.codeSize < sizeof(uint32_t) || header.codeSize % sizeof(uint32_t) != 0 || header.codeSize > (64ull << 20))
+			return false;
+		_code.resize(static_cast<size_t>(header.codeSize / sizeof(uint32_t)));
+		if (!file.read(reinterpret_cast<char*>(_code.data()), static_cast<std::streamsize>(header.codeSize)) || _code[0] != spirvMagic) {
+			_code.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// Written atomically so a reader never sees a half written file
+	inline bool Write(const std::string& _directory, uint64_t _key, const std::vector<uint32_t>& _code)
+	{
+		Header header = {};
+		memcpy(header.magic, magic, 4);
+		header.version = version;
+		header.key = _key;
+		header.codeSize = _code.size() * sizeof(uint32_t);
+		return FileUtil::WriteAtomic(FilePath(_directory, _key),
+			{ { &header, sizeof(Header) }, { _code.data(), static_cast<size_t>(header.codeSize) } });
+	}
+
+#ifdef ENABLE_SHADERC
+	// Compiles HLSL to SPIR-V, on failure _errors holds the compiler's messages
+	inline bool Compile(const char* _source, Stage _stage, const Options& _options, std::vector<uint32_t>& _code,
+		std::string& _errors, const char* _entryPoint = "main")
+	{
+		shaderc_compiler_t compiler = shaderc_compiler_initialize();
+		shaderc_compile_options_t options = shaderc_compile_options_initialize();
+		shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
+		shaderc_compile_options_set_invert_y(options, false);
+		if (_options.debugInfo)
+			shaderc_compile_options_set_generate_debug_info(options);
+		if (_options.packedVertices) // selects the decode path in Shaders::vertexShader
+			shaderc_compile_options_add_macro_definition(options, "PACKED_VERTICES", 15, "1", 1);
+
+		static const shaderc_shader_kind kinds[] = { shaderc_vertex_shader, shaderc_fragment_shader, shaderc_compute_shader };
+		static const char* fileNames[] = { "main.vert", "main.frag", "main.comp" };
+		shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, _source, strlen(_source),
+			kinds[_stage], fileNames[_stage], _entryPoint, options);
+		bool compiled = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+		if (compiled) {
+			size_t bytes = shaderc_result_get_length(result);
+			_code.resize(bytes / sizeof(uint32_t));
+			memcpy(_code.data(), shaderc_result_get_bytes(result), bytes);
+		}
+		else
+			_errors = shaderc_result_get_error_message(result);
+		shaderc_result_release(result);
+		shaderc_compile_options_release(options);
+		shaderc_compiler_release(compiler);
+		return compiled;
+	}
+#endif
+}
@@ -0,0 +1,75 @@
+// Compiles the Blender exporter's text levels into the binary .lvl format the renderer loads.
+//
+// Usage: LevelConverter [--force] <level.txt | directory>...
+// Directories are scanned for *.txt levels. Each output is written next to its
+// input with a .lvl extension and is skipped when it is already newer than the input.
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include "../LevelFile.h"
+
+namespace fs = std::filesystem;
+
+// Converts one text level, returns false on failure
+static bool ConvertLevel(const fs::path& _input, bool _force)
+{
+	fs::path output = _input;
+	output.replace_extension(".lvl");
+
+	std::error_code error;
+	if (!_force && fs::exists(output, error) &&
+		fs::last_write_time(output, error) >= fs::last_write_time(_input, error))
+	{
+		std::cout << "Up to date: " << output.string() << "\n";
+		return true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	LevelFile::Level level;
+	if (!LevelFile::ReadText(_input.string().c_str(), level)) {
+		std::cout << "Level Loading Error: \"" << _input.string() << "\" did not open properly.\n";
+		return false;
+	}
+	if (!LevelFile::WriteBinary(output.string().c_str(), level)) {
+		std::cout << "Level Writing Error: \"" << output.string() << "\" could not be written.\n";
+		return false;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Converted " << _input.string() << " -> " << output.string() << " ("
+		<< level.matrices.size() << " instances, " << level.lightMatrices.size() << " lights, "
+		<< level.meshNames.size() << " names, "
+		<< elapsed.count() << " ms)\n";
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool force = false;
+	std::vector<fs::path> inputs;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--force")
+			force = true;
+		else
+			inputs.push_back(arg);
+	}
+	if (inputs.empty()) {
+		std::cout << "Usage: LevelConverter [--force] <level.txt | directory>...\n";
+		return 1;
+	}
+
+	int failures = 0;
+	for (const fs::path& input : inputs)
+	{
+		std::error_code error;
+		if (fs::is_directory(input, error)) {
+			for (const fs::directory_entry& entry : fs::directory_iterator(input, error))
+				if (entry.is_regular_file() && entry.path().extension() == ".txt")
+					failures += !ConvertLevel(entry.path(), force);
+		}
+		else
+			failures += !ConvertLevel(input, force);
+	}
+	return failures ? 1 : 0;
+}
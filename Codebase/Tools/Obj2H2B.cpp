@@ -0,0 +1,515 @@
+// Converts Wavefront .obj/.mtl pairs into the .h2b (v1.9d) models the renderer loads.
+//
+// Usage: Obj2H2B [--force] [--threads N] <model.obj | directory>...
+// Directories are scanned for *.obj models. Each output is written next to its
+// input with a .h2b extension and is skipped when it is already newer than both the
+// .obj and the .mtl its mtllib names. Files are converted in parallel, one per worker thread.
+//
+// Conversion rules. They follow the original Obj2Header exporter, but output is not
+// byte-identical: quads can be triangulated across the other diagonal, so compare
+// models by what they draw rather than by their bytes.
+//	- positions and normals have z negated, texture v becomes 1 - v and w is 0
+//	- polygons are fanned with the winding reversed to suit the flipped z
+//	- a vertex is emitted once per unique v/vt/vn triple, in first use order
+//	- faces are grouped by material in .mtl order, one batch and one mesh
+//	  ("default") per material
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../h2bParser.h"
+
+namespace fs = std::filesystem;
+
+// Workers share std::cout, every print takes this
+static std::mutex outputMutex;
+
+// Strings in the order the format stores them after each material's attributes
+enum MaterialString { NAME, MAP_KD, MAP_KS, MAP_KA, MAP_KE, MAP_NS, MAP_D, DISP, DECAL, BUMP, STRING_COUNT };
+
+struct Material {
+	H2B::ATTRIBUTES attrib;
+	std::string strings[STRING_COUNT];
+};
+
+// One face corner, 1 based obj indices (0 when absent)
+struct Corner {
+	int v, vt, vn;
+	bool operator==(const Corner& _other) const { return v == _other.v && vt == _other.vt && vn == _other.vn; }
+};
+
+struct CornerHash {
+	size_t operator()(const Corner& _c) const
+	{
+		uint64_t h = static_cast<uint32_t>(_c.v);
+		h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(_c.vt);
+		h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(_c.vn);
+		return static_cast<size_t>(h ^ (h >> 29));
+	}
+};
+
+// Splits a line into whitespace separated tokens without copying
+struct Tokenizer {
+	const char* at;
+	const char* end;
+
+	bool Done() const { return at >= end; }
+
+	// Steps onto the next line, returns it without its line ending
+	std::string_view NextLine()
+	{
+		const char* start = at;
+		const void* found = memchr(at, '\n', end - at);
+		const char* stop = found ? static_cast<const char*>(found) : end;
+		at = found ? stop + 1 : end;
+		while (stop > start && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t'))
+			--stop;
+		while (start < stop && (*start == ' ' || *start == '\t'))
+			++start;
+		return std::string_view(start, stop - start);
+	}
+};
+
+// Pops the next token off the front of _line
+static std::string_view NextToken(std::string_view& _line)
+{
+	size_t start = _line.find_first_not_of(" \t");
+	if (start == std::string_view::npos) {
+		_line = std::string_view();
+		return _line;
+	}
+	size_t stop = _line.find_first_of(" \t", start);
+	if (stop == std::string_view::npos)
+		stop = _line.size();
+	std::string_view token = _line.substr(start, stop - start);
+	_line.remove_prefix(stop);
+	return token;
+}
+
+static float ParseFloat(std::string_view _token, float _default = 0.0f)
+{
+	if (!_token.empty() && _token[0] == '+')
+		_token.remove_prefix(1);
+	float value = _default;
+	std::from_chars(_token.data(), _token.data() + _token.size(), value);
+	return value;
+}
+
+static void ParseVector(std::string_view& _line, H2B::VECTOR& _out)
+{
+	_out.x = ParseFloat(NextToken(_line));
+	_out.y = ParseFloat(NextToken(_line), _out.x);
+	_out.z = ParseFloat(NextToken(_line), _out.x);
+}
+
+// Turns a relative (negative) obj index into an absolute one
+static int ResolveIndex(int _index, size_t _count)
+{
+	return _index < 0 ? static_cast<int>(_count) + _index + 1 : _index;
+}
+
+// Parses "v", "v/vt", "v//vn" or "v/vt/vn"
+static bool ParseCorner(std::string_view _token, size_t _vCount, size_t _vtCount, size_t _vnCount, Corner& _out)
+{
+	const char* at = _token.data();
+	const char* end = at + _token.size();
+	_out = { 0, 0, 0 };
+	std::from_chars_result result = std::from_chars(at, end, _out.v);
+	if (result.ec != std::errc())
+		return false;
+	at = result.ptr;
+	if (at < end && *at == '/') {
+		++at;
+		if (at < end && *at != '/') {
+			result = std::from_chars(at, end, _out.vt);
+			at = result.ptr;
+		}
+		if (at < end && *at == '/') {
+			++at;
+			result = std::from_chars(at, end, _out.vn);
+		}
+	}
+	_out.v = ResolveIndex(_out.v, _vCount);
+	_out.vt = ResolveIndex(_out.vt, _vtCount);
+	_out.vn = ResolveIndex(_out.vn, _vnCount);
+	return _out.v > 0 && _out.v <= static_cast<int>(_vCount) &&
+		_out.vt >= 0 && _out.vt <= static_cast<int>(_vtCount) &&
+		_out.vn >= 0 && _out.vn <= static_cast<int>(_vnCount);
+}
+
+static bool ReadWholeFile(const fs::path& _path, std::vector<char>& _out)
+{
+	std::ifstream file(_path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+	_out.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	return _out.empty() || static_cast<bool>(file.read(_out.data(), _out.size()));
+}
+
+static Material DefaultMaterial(std::string_view _name)
+{
+	Material material;
+	material.attrib = {};
+	material.attrib.Kd = { 0.8f, 0.8f, 0.8f };
+	material.attrib.d = 1.0f;
+	material.attrib.sharpness = 60.0f;
+	material.attrib.Tf = { 1.0f, 1.0f, 1.0f };
+	material.attrib.Ni = 1.0f;
+	material.strings[NAME].assign(_name.data(), _name.size());
+	return material;
+}
+
+// Texture paths keep their arguments, backslashes become forward slashes
+static std::string TexturePath(std::string_view _rest)
+{
+	size_t start = _rest.find_first_not_of(" \t");
+	std::string path(start == std::string_view::npos ? std::string_view() : _rest.substr(start));
+	for (char& c : path)
+		if (c == '\\')
+			c = '/';
+	return path;
+}
+
+static bool ReadMtl(const fs::path& _path, std::vector<Material>& _materials)
+{
+	std::vector<char> buffer;
+	if (!ReadWholeFile(_path, buffer))
+		return false;
+	Tokenizer tokenizer = { buffer.data(), buffer.data() + buffer.size() };
+	Material* current = nullptr;
+	while (!tokenizer.Done()) {
+		std::string_view line = tokenizer.NextLine();
+		std::string_view key = NextToken(line);
+		if (key.empty() || key[0] == '#')
+			continue;
+		if (key == "newmtl") {
+			_materials.push_back(DefaultMaterial(NextToken(line)));
+			current = &_materials.back();
+			continue;
+		}
+		if (current == nullptr)
+			continue;
+		H2B::ATTRIBUTES& attrib = current->attrib;
+		if (key == "Kd") ParseVector(line, attrib.Kd);
+		else if (key == "Ks") ParseVector(line, attrib.Ks);
+		else if (key == "Ka") ParseVector(line, attrib.Ka);
+		else if (key == "Ke") ParseVector(line, attrib.Ke);
+		else if (key == "Tf") ParseVector(line, attrib.Tf);
+		else if (key == "d") attrib.d = ParseFloat(NextToken(line), 1.0f);
+		else if (key == "Tr") attrib.d = 1.0f - ParseFloat(NextToken(line));
+		else if (key == "Ns") attrib.Ns = ParseFloat(NextToken(line));
+		else if (key == "Ni") attrib.Ni = ParseFloat(NextToken(line), 1.0f);
+		else if (key == "sharpness") attrib.sharpness = ParseFloat(NextToken(line), 60.0f);
+		else if (key == "illum") attrib.illum = static_cast<unsigned>(ParseFloat(NextToken(line)));
+		else if (key == "map_Kd") current->strings[MAP_KD] = TexturePath(line);
+		else if (key == "map_Ks") current->strings[MAP_KS] = TexturePath(line);
+		else if (key == "map_Ka") current->strings[MAP_KA] = TexturePath(line);
+		else if (key == "map_Ke") current->strings[MAP_KE] = TexturePath(line);
+		else if (key == "map_Ns") current->strings[MAP_NS] = TexturePath(line);
+		else if (key == "map_d") current->strings[MAP_D] = TexturePath(line);
+		else if (key == "disp") current->strings[DISP] = TexturePath(line);
+		else if (key == "decal") current->strings[DECAL] = TexturePath(line);
+		else if (key == "bump" || key == "map_bump" || key == "map_Bump") current->strings[BUMP] = TexturePath(line);
+	}
+	return true;
+}
+
+// The material library an .obj pulls in (its first mtllib, like ReadObj), empty if it has none
+static fs::path FindMtlLib(const fs::path& _path)
+{
+	std::vector<char> buffer;
+	if (!ReadWholeFile(_path, buffer))
+		return fs::path();
+	Tokenizer tokenizer = { buffer.data(), buffer.data() + buffer.size() };
+	while (!tokenizer.Done()) {
+		std::string_view line = tokenizer.NextLine();
+		if (NextToken(line) == "mtllib")
+			return _path.parent_path() / TexturePath(line);
+	}
+	return fs::path();
+}
+
+// Everything one conversion produces
+struct Model {
+	std::vector<H2B::VERTEX> vertices;
+	std::vector<unsigned> indices;
+	std::vector<Material> materials;
+	std::vector<H2B::BATCH> batches;
+};
+
+static bool ReadObj(const fs::path& _path, Model& _model)
+{
+	std::vector<char> buffer;
+	if (!ReadWholeFile(_path, buffer)) {
+		std::lock_guard<std::mutex> lock(outputMutex);
+		std::cout << "OBJ Loading Error: \"" << _path.string() << "\" did not open properly.\n";
+		return false;
+	}
+
+	// Gather the raw streams and every material's triangles
+	std::vector<H2B::VECTOR> positions, uvs, normals;
+	std::vector<std::vector<Corner>> triangles; // per material
+	std::unordered_map<std::string, unsigned> materialLookup;
+	std::vector<Corner> polygon;
+	std::string mtlFile;
+	unsigned currentMaterial = UINT32_MAX;
+	positions.reserve(buffer.size() / 64);
+	normals.reserve(buffer.size() / 64);
+
+	// Materials are resolved as soon as the mtllib shows up so usemtl can map straight to an index
+	auto materialIndex = [&](std::string_view _name) -> unsigned {
+		auto found = materialLookup.find(std::string(_name));
+		if (found != materialLookup.end())
+			return found->second;
+		unsigned index = static_cast<unsigned>(_model.materials.size());
+		_model.materials.push_back(DefaultMaterial(_name));
+		triangles.resize(_model.materials.size());
+		materialLookup.emplace(std::string(_name), index);
+		return index;
+	};
+
+	Tokenizer tokenizer = { buffer.data(), buffer.data() + buffer.size() };
+	while (!tokenizer.Done()) {
+		std::string_view line = tokenizer.NextLine();
+		std::string_view key = NextToken(line);
+		if (key.empty() || key[0] == '#')
+			continue;
+		if (key == "v") {
+			H2B::VECTOR p;
+			ParseVector(line, p);
+			positions.push_back(p);
+		}
+		else if (key == "vt") {
+			H2B::VECTOR t = {};
+			t.x = ParseFloat(NextToken(line));
+			t.y = ParseFloat(NextToken(line));
+			uvs.push_back(t);
+		}
+		else if (key == "vn") {
+			H2B::VECTOR n;
+			ParseVector(line, n);
+			normals.push_back(n);
+		}
+		else if (key == "f") {
+			polygon.clear();
+			for (std::string_view token = NextToken(line); !token.empty(); token = NextToken(line)) {
+				Corner corner;
+				if (!ParseCorner(token, positions.size(), uvs.size(), normals.size(), corner)) {
+					std::lock_guard<std::mutex> lock(outputMutex);
+					std::cout << "OBJ Loading Error: \"" << _path.string() << "\" has a bad face index.\n";
+					return false;
+				}
+				polygon.push_back(corner);
+			}
+			if (polygon.size() < 3)
+				continue;
+			if (currentMaterial == UINT32_MAX)
+				currentMaterial = materialIndex("default");
+			// Fan the reversed polygon
+			std::vector<Corner>& out = triangles[currentMaterial];
+			size_t n = polygon.size();
+			out.push_back(polygon[n - 1]);
+			out.push_back(polygon[n - 2]);
+			out.push_back(polygon[n - 3]);
+			for (size_t k = 1; k + 2 < n; ++k) {
+				out.push_back(polygon[n - 3 - k]);
+				out.push_back(polygon[n - 1]);
+				out.push_back(polygon[n - 2 - k]);
+			}
+		}
+		else if (key == "usemtl")
+			currentMaterial = materialIndex(NextToken(line));
+		else if (key == "mtllib" && mtlFile.empty()) {
+			mtlFile = TexturePath(line);
+			std::vector<Material> materials;
+			if (!ReadMtl(_path.parent_path() / mtlFile, materials)) {
+				std::lock_guard<std::mutex> lock(outputMutex);
+				std::cout << "MTL Loading Error: \"" << (_path.parent_path() / mtlFile).string() << "\" did not open properly.\n";
+			}
+			for (Material& material : materials)
+				if (materialLookup.find(material.strings[NAME]) == materialLookup.end()) {
+					materialLookup.emplace(material.strings[NAME], static_cast<unsigned>(_model.materials.size()));
+					_model.materials.push_back(std::move(material));
+				}
+			triangles.resize(_model.materials.size());
+		}
+	}
+
+	// Emit unique vertices and indices grouped by material
+	size_t cornerCount = 0;
+	for (const std::vector<Corner>& corners : triangles)
+		cornerCount += corners.size();
+	std::unordered_map<Corner, unsigned, CornerHash> vertexLookup;
+	vertexLookup.reserve(cornerCount / 2);
+	_model.indices.reserve(cornerCount);
+	_model.batches.resize(_model.materials.size());
+	for (size_t m = 0; m < triangles.size(); ++m) {
+		_model.batches[m].indexOffset = static_cast<unsigned>(_model.indices.size());
+		for (const Corner& corner : triangles[m]) {
+			auto inserted = vertexLookup.emplace(corner, static_cast<unsigned>(_model.vertices.size()));
+			if (inserted.second) {
+				H2B::VERTEX vertex = {};
+				vertex.pos = positions[corner.v - 1];
+				vertex.pos.z = -vertex.pos.z;
+				if (corner.vt) {
+					vertex.uvw.x = uvs[corner.vt - 1].x;
+					vertex.uvw.y = 1.0f - uvs[corner.vt - 1].y;
+				}
+				if (corner.vn) {
+					vertex.nrm = normals[corner.vn - 1];
+					vertex.nrm.z = -vertex.nrm.z;
+				}
+				_model.vertices.push_back(vertex);
+			}
+			_model.indices.push_back(inserted.first->second);
+		}
+		_model.batches[m].indexCount = static_cast<unsigned>(_model.indices.size()) - _model.batches[m].indexOffset;
+	}
+	return true;
+}
+
+// Writes the v1.9d layout H2B::Parser reads
+static bool WriteH2B(const fs::path& _path, const Model& _model)
+{
+	static const char meshName[] = "default";
+	unsigned counts[4] = {
+		static_cast<unsigned>(_model.vertices.size()),
+		static_cast<unsigned>(_model.indices.size()),
+		static_cast<unsigned>(_model.materials.size()),
+		static_cast<unsigned>(_model.materials.size()),
+	};
+	std::vector<char> blob;
+	auto append = [&blob](const void* _data, size_t _size) {
+		const char* bytes = static_cast<const char*>(_data);
+		blob.insert(blob.end(), bytes, bytes + _size);
+	};
+	blob.reserve(20 + sizeof(H2B::VERTEX) * counts[0] + sizeof(unsigned) * counts[1] + 128 * counts[2]);
+	append("019d", 4);
+	append(counts, sizeof(counts));
+	append(_model.vertices.data(), sizeof(H2B::VERTEX) * _model.vertices.size());
+	append(_model.indices.data(), sizeof(unsigned) * _model.indices.size());
+	for (const Material& material : _model.materials) {
+		append(&material.attrib, 80);
+		for (const std::string& string : material.strings)
+			append(string.c_str(), string.size() + 1);
+	}
+	append(_model.batches.data(), sizeof(H2B::BATCH) * _model.batches.size());
+	for (unsigned i = 0; i < counts[3]; ++i) {
+		append(meshName, sizeof(meshName));
+		append(&_model.batches[i], sizeof(H2B::BATCH));
+		append(&i, sizeof(unsigned));
+	}
+
+	std::ofstream file(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+	file.write(blob.data(), blob.size());
+	return file.good();
+}
+
+// Converts one model, returns false on failure
+static bool ConvertModel(const fs::path& _input, bool _force)
+{
+	fs::path output = _input;
+	output.replace_extension(".h2b");
+
+	std::error_code error;
+	if (!_force && fs::exists(output, error)) {
+		auto outputTime = fs::last_write_time(output, error);
+		bool upToDate = outputTime >= fs::last_write_time(_input, error);
+		fs::path mtl = upToDate ? FindMtlLib(_input) : fs::path();
+		if (!mtl.empty() && fs::exists(mtl, error))
+			upToDate = upToDate && outputTime >= fs::last_write_time(mtl, error);
+		if (upToDate) {
+			std::lock_guard<std::mutex> lock(outputMutex);
+			std::cout << "Up to date: " << output.string() << "\n";
+			return true;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Model model;
+	if (!ReadObj(_input, model))
+		return false;
+	if (!WriteH2B(output, model)) {
+		std::lock_guard<std::mutex> lock(outputMutex);
+		std::cout << "H2B Writing Error: \"" << output.string() << "\" could not be written.\n";
+		return false;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::lock_guard<std::mutex> lock(outputMutex);
+	std::cout << "Converted " << _input.string() << " -> " << output.string() << " ("
+		<< model.vertices.size() << " vertices, " << model.indices.size() << " indices, "
+		<< model.materials.size() << " materials, "
+		<< elapsed.count() << " ms)\n";
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool force = false;
+	unsigned threadCount = std::thread::hardware_concurrency();
+	std::vector<fs::path> inputs;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--force")
+			force = true;
+		else if (arg == "--threads" && i + 1 < argc) {
+			std::string_view count = argv[++i];
+			auto result = std::from_chars(count.data(), count.data() + count.size(), threadCount);
+			if (result.ec != std::errc() || result.ptr != count.data() + count.size()) {
+				std::cout << "Obj2H2B Error: \"" << count << "\" is not a thread count.\n";
+				return 1;
+			}
+			threadCount = std::max(threadCount, 1u);
+		}
+		else
+			inputs.push_back(arg);
+	}
+	if (inputs.empty()) {
+		std::cout << "Usage: Obj2H2B [--force] [--threads N] <model.obj | directory>...\n";
+		return 1;
+	}
+
+	std::vector<fs::path> models;
+	for (const fs::path& input : inputs)
+	{
+		std::error_code error;
+		if (fs::is_directory(input, error)) {
+			for (const fs::directory_entry& entry : fs::directory_iterator(input, error))
+				if (entry.is_regular_file() && entry.path().extension() == ".obj")
+					models.push_back(entry.path());
+		}
+		else
+			models.push_back(input);
+	}
+
+	// Workers pull the next model until none are left
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<size_t> next(0);
+	std::atomic<int> failures(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < models.size(); i = next++)
+			failures += !ConvertModel(models[i], force);
+	};
+	threadCount = std::max(1u, std::min(threadCount, static_cast<unsigned>(models.size())));
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threadCount; ++i)
+		workers.emplace_back(worker);
+	worker();
+	for (std::thread& thread : workers)
+		thread.join();
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << models.size() << " models on " << threadCount << " threads in " << elapsed.count() << " ms\n";
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+// Compiles the renderer's HLSL shaders into the SPIR-V shader cache so launches load
+// them instead of running shaderc.
+//
+// Usage: ShaderCompiler [--force] <cache directory>
+// Writes every variant the renderer can ask for: packed and full vertices, with and
+// without debug info. Variants already in the cache are skipped, their file name is
+// the hash of the source and options.
+#define ENABLE_SHADERC
+#include <chrono>
+#include <iostream>
+#include "../ShaderCache.h"
+#include "../shaders.h"
+
+// Compiles one variant into the cache, returns false on failure
+static bool CompileVariant(const std::string& _directory, const char* _name, const char* _source,
+	ShaderCache::Stage _stage, const ShaderCache::Options& _options, bool _force, const char* _entryPoint = "main")
+{
+	uint64_t key = ShaderCache::Key(_source, _stage, _options, _entryPoint);
+	std::string path = ShaderCache::FilePath(_directory, key);
+	std::vector<uint32_t> code;
+	if (!_force && ShaderCache::Read(_directory, key, code)) {
+		std::cout << "Up to date: " << path << "\n";
+		return true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::string errors;
+	if (!ShaderCache::Compile(_source, _stage, _options, code, errors, _entryPoint)) {
+		std::cout << _name << " Shader Errors: " << errors << "\n";
+		return false;
+	}
+	if (!ShaderCache::Write(_directory, key, code)) {
+		std::cout << "Shader Cache Error: \"" << path << "\" could not be written.\n";
+		return false;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Compiled " << _name << (_options.packedVertices ? " (packed" : " (full") << " vertices"
+		<< (_options.debugInfo ? ", debug info) -> " : ") -> ") << path << " ("
+		<< code.size() * sizeof(uint32_t) << " bytes, " << elapsed.count() << " ms)\n";
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool force = false;
+	std::string directory;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--force")
+			force = true;
+		else
+			directory = arg;
+	}
+	if (directory.empty()) {
+		std::cout << "Usage: ShaderCompiler [--force] <cache directory>\n";
+		return 1;
+	}
+
+	// Occlusion culling is opt in, its shaders failing only turns it off at runtime instead of failing the build
+	int failures = 0, optionalFailures = 0;
+	for (int variant = 0; variant < 4; ++variant)
+	{
+		ShaderCache::Options options;
+		options.packedVertices = (variant & 1) != 0;
+		options.debugInfo = (variant & 2) != 0;
+		failures += !CompileVariant(directory, "Vertex", Shaders::vertexShader, ShaderCache::VERTEX, options, force);
+		failures += !CompileVariant(directory, "Pixel", Shaders::pixelShader, ShaderCache::FRAGMENT, options, force);
+		failures += !CompileVariant(directory, "Cull", Shaders::cullShader, ShaderCache::COMPUTE, options, force);
+		optionalFailures += !CompileVariant(directory, "Occlusion cull", Shaders::occlusionCullShader, ShaderCache::COMPUTE, options, force, "mainOcclusion");
+		optionalFailures += !CompileVariant(directory, "Depth reduce", Shaders::depthReduceShader, ShaderCache::COMPUTE, options, force);
+	}
+	if (optionalFailures)
+		std::cout << "Warning: " << optionalFailures << " occlusion culling variants did not compile, occlusion culling will stay off.\n";
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "GvkAllocator.h"
+#include "GvkUploader.h"
+#include "GvkRingBuffer.h"
+// Expects Gateware.h (with GVulkanSurface and GMath enabled) to be included first, like renderer.h
+
+// Owns the level's world matrices and their GPU copies. The DEVICE_LOCAL buffer holds
+// one slice per frame in flight, so a slice can be patched while the GPU still reads
+// the others. Writes mark index ranges dirty for every slice. Each frame only that
+// frame's dirty ranges are coalesced and copied, staged through the frame ring.
+class TransformStore
+{
+	struct Range {
+		uint32_t first, end;	// [first, end) in matrices
+	};
+
+	GvkAllocator* allocator = nullptr;
+	VkBuffer buffer = nullptr;
+	GvkAllocator::Allocation memory;
+	std::vector<GW::MATH::GMATRIXF> transforms;		// CPU copy, always current
+	std::vector<std::vector<Range>> dirty;			// per slice, unsorted until RecordUpdate
+	VkDeviceSize sliceSize = 0;
+	unsigned int frameCount = 0;
+	uint32_t mergeGap = 4;	// ranges closer than this many matrices go out as one copy
+
+	// Counters since Create or the last ResetStats
+	VkDeviceSize bytesUploaded = 0;
+	VkDeviceSize bytesSkipped = 0;
+	unsigned int rangesUploaded = 0;
+	unsigned int slicesUpdated = 0;
+
+public:
+	// Uploads _count matrices into every slice through _uploader; they are resident
+	// once the uploader's pending ticket completes
+	bool Create(VkPhysicalDevice _physicalDevice, GvkAllocator* _allocator, GvkUploader& _uploader,
+		const GW::MATH::GMATRIXF* _data, uint32_t _count, unsigned int _frameCount)
+	{
+		allocator = _allocator;
+		frameCount = _frameCount;
+		transforms.assign(_data, _data + _count);
+		dirty.assign(frameCount, std::vector<Range>());
+
+		// Slices are bound with dynamic offsets
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		VkDeviceSize alignment = std::max(properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize(16));
+		VkDeviceSize bytes = std::max<VkDeviceSize>(GetRange(), sizeof(GW::MATH::GMATRIXF));
+		sliceSize = (bytes + alignment - 1) / alignment * alignment;
+
+		if (!_uploader.CreateBuffer(sliceSize * frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, &buffer, &memory,
+			GvkAllocator::CATEGORY_TRANSFORM))
+			return false;
+		for (unsigned int i = 0; i < frameCount && _count > 0; ++i)
+			if (!_uploader.Upload(buffer, sliceSize * i, transforms.data(), GetRange()))
+				return false;
+		return true;
+	}
+
+	const GW::MATH::GMATRIXF& Get(uint32_t _index) const { return transforms[_index]; }
+	uint32_t GetCount() const { return static_cast<uint32_t>(transforms.size()); }
+
+	void Set(uint32_t _index, const GW::MATH::GMATRIXF& _transform)
+	{
+		transforms[_index] = _transform;
+		MarkDirty(_index, 1);
+	}
+
+	// Copies _count matrices starting at _first and marks them dirty
+	void Set(uint32_t _first, uint32_t _count, const GW::MATH::GMATRIXF* _transforms)
+	{
+		std::copy(_transforms, _transforms + _count, transforms.begin() + _first);
+		MarkDirty(_first, _count);
+	}
+
+	void MarkDirty(uint32_t _first, uint32_t _count)
+	{
+		if (_count == 0)
+			return;
+		for (std::vector<Range>& ranges : dirty) {
+			// Extending the last range is the common case for props written in order
+			if (!ranges.empty() && _first >= ranges.back().first && _first <= ranges.back().end + mergeGap)
+				ranges.back().end = std::max(ranges.back().end, _first + _count);
+			else
+				ranges.push_back({ _first, _first + _count });
+			if (ranges.size() > 1024)
+				Coalesce(ranges);	// keep scattered writes from piling up between frames
+		}
+	}
+
+	// Records copies of _slice's dirty ranges from _ring into the slice, followed by a
+	// barrier for shader reads. _ring must already be on this frame. Returns false when
+	// nothing needed recording.
+	bool RecordUpdate(unsigned int _slice, GvkRingBuffer& _ring, VkCommandBuffer _commandBuffer)
+	{
+		std::vector<Range>& ranges = dirty[_slice];
+		if (ranges.empty()) {
+			bytesSkipped += GetRange();
+			++slicesUpdated;
+			return false;
+		}
+		Coalesce(ranges);
+
+		// Stage every range back to back in one ring allocation
+		VkDeviceSize uploaded = 0;
+		for (const Range& range : ranges)
+			uploaded += VkDeviceSize(range.end - range.first) * sizeof(GW::MATH::GMATRIXF);
+		GvkRingBuffer::Allocation staging = _ring.Allocate(uploaded);
+		if (staging.pointer == nullptr)
+			return false;	// ring is full, the ranges stay dirty until this slice comes up again
+		std::vector<VkBufferCopy> regions;
+		regions.reserve(ranges.size());
+		VkDeviceSize stagingOffset = 0;
+		for (const Range& range : ranges) {
+			VkDeviceSize bytes = VkDeviceSize(range.end - range.first) * sizeof(GW::MATH::GMATRIXF);
+			memcpy(static_cast<char*>(staging.pointer) + stagingOffset, &transforms[range.first], static_cast<size_t>(bytes));
+			regions.push_back({ staging.offset + stagingOffset, sliceSize * _slice + VkDeviceSize(range.first) * sizeof(GW::MATH::GMATRIXF), bytes });
+			stagingOffset += bytes;
+		}
+		ranges.clear();
+		bytesUploaded += uploaded;
+		bytesSkipped += GetRange() - uploaded;
+		rangesUploaded += static_cast<unsigned int>(regions.size());
+		++slicesUpdated;
+
+		vkCmdCopyBuffer(_commandBuffer, _ring.GetBuffer(), buffer, static_cast<uint32_t>(regions.size()), regions.data());
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = buffer;
+		barrier.offset = sliceSize * _slice;
+		barrier.size = sliceSize;
+		vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return true;
+	}
+
+	VkBuffer GetBuffer() const { return buffer; }
+	VkDeviceSize GetRange() const { return VkDeviceSize(transforms.size()) * sizeof(GW::MATH::GMATRIXF); }	// one slice's matrices
+	uint32_t GetSliceOffset(unsigned int _slice) const { return static_cast<uint32_t>(sliceSize * _slice); }	// dynamic offset
+
+	void ReportStats(const char* _label) const
+	{
+		VkDeviceSize total = bytesUploaded + bytesSkipped;
+		std::cout << _label << ": uploaded " << bytesUploaded << " bytes in " << rangesUploaded << " range(s), skipped "
+			<< bytesSkipped << " bytes over " << slicesUpdated << " frame(s)";
+		if (total > 0)
+			std::cout << " (" << 100.0 * static_cast<double>(bytesUploaded) / static_cast<double>(total) << "% uploaded)";
+		std::cout << "\n";
+	}
+
+	void ResetStats()
+	{
+		bytesUploaded = 0;
+		bytesSkipped = 0;
+		rangesUploaded = 0;
+		slicesUpdated = 0;
+	}
+
+	void Destroy()
+	{
+		if (allocator == nullptr)
+			return;
+		allocator->DestroyBuffer(buffer, memory);
+		transforms.clear();
+		dirty.clear();
+		allocator = nullptr;
+	}
+
+private:
+	// Sorts and merges overlapping, touching and nearly touching ranges
+	void Coalesce(std::vector<Range>& _ranges) const
+	{
+		std::sort(_ranges.begin(), _ranges.end(), [](const Range& a, const Range& b) { return a.first < b.first; });
+		size_t out = 0;
+		for (size_t i = 1; i < _ranges.size(); ++i) {
+			if (_ranges[i].first <= _ranges[out].end + mergeGap)
+				_ranges[out].end = std::max(_ranges[out].end, _ranges[i].end);
+			else
+				_ranges[++out] = _ranges[i];
+		}
+		_ranges.resize(_ranges.empty() ? 0 : out + 1);
+	}
+};
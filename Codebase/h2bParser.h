@@ -3,6 +3,16 @@
 #include <fstream>
 #include <vector>
 #include <set>
+#include <cstring>
+#include <utility>
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 
 namespace H2B {
 
@@ -43,6 +53,15 @@ namespace H2B {
 		BATCH drawInfo;
 		unsigned materialIndex;
 	};
+	// Read-only view over a run of records that lives inside a mapped file
+	template<typename T>
+	struct Span {
+		const T* data = nullptr;
+		unsigned count = 0;
+		const T* begin() const { return data; }
+		const T* end() const { return data + count; }
+		const T& operator[](size_t i) const { return data[i]; }
+	};
 	class Parser
 	{
 		std::set<std::string> file_strings;
@@ -117,5 +136,245 @@ namespace H2B {
 			meshes.clear();
 		}
 	};
+
+	// Read-only memory mapping of a whole file
+	class MappedFile
+	{
+		const char* mapped = nullptr;
+		size_t mappedSize = 0;
+#ifdef _WIN32
+		HANDLE fileHandle = INVALID_HANDLE_VALUE;
+		HANDLE mappingHandle = nullptr;
+#endif
+	public:
+		MappedFile() = default;
+		~MappedFile() { Close(); }
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& _other) noexcept { *this = std::move(_other); }
+		MappedFile& operator=(MappedFile&& _other) noexcept
+		{
+			if (this != &_other) {
+				Close();
+				std::swap(mapped, _other.mapped);
+				std::swap(mappedSize, _other.mappedSize);
+#ifdef _WIN32
+				std::swap(fileHandle, _other.fileHandle);
+				std::swap(mappingHandle, _other.mappingHandle);
+#endif
+			}
+			return *this;
+		}
+		const char* Data() const { return mapped; }
+		size_t Size() const { return mappedSize; }
+		bool Open(const char* _path)
+		{
+			Close();
+#ifdef _WIN32
+			fileHandle = CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (fileHandle == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0) {
+				Close();
+				return false;
+			}
+			mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mappingHandle == nullptr) {
+				Close();
+				return false;
+			}
+			mapped = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+			mappedSize = static_cast<size_t>(size.QuadPart);
+#else
+			int fd = open(_path, O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0) {
+				close(fd);
+				return false;
+			}
+			void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd); // the mapping keeps its own reference to the file
+			if (view == MAP_FAILED)
+				return false;
+			madvise(view, info.st_size, MADV_SEQUENTIAL);
+			mapped = static_cast<const char*>(view);
+			mappedSize = static_cast<size_t>(info.st_size);
+#endif
+			if (mapped == nullptr) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+		void Close()
+		{
+#ifdef _WIN32
+			if (mapped)
+				UnmapViewOfFile(mapped);
+			if (mappingHandle)
+				CloseHandle(mappingHandle);
+			if (fileHandle != INVALID_HANDLE_VALUE)
+				CloseHandle(fileHandle);
+			mappingHandle = nullptr;
+			fileHandle = INVALID_HANDLE_VALUE;
+#else
+			if (mapped)
+				munmap(const_cast<char*>(mapped), mappedSize);
+#endif
+			mapped = nullptr;
+			mappedSize = 0;
+		}
+	};
+	// Same layout as Parser, but the file is memory mapped and the vertex, index
+	// and batch records are exposed as spans into the mapping instead of being
+	// read into vectors. Material and mesh names point straight into the mapping.
+	// The spans stay valid until the next Parse/Clear or until the parser dies.
+	class MappedParser
+	{
+		MappedFile file;
+		const char* mapped = nullptr;
+		size_t mappedSize = 0;
+		// Returns the string at _offset and steps past its terminator, nullptr if empty
+		const char* ReadString(size_t& _offset)
+		{
+			if (_offset >= mappedSize)
+				return nullptr;
+			const char* str = mapped + _offset;
+			const void* end = memchr(str, '\0', mappedSize - _offset);
+			if (end == nullptr)
+				return nullptr;
+			_offset = static_cast<const char*>(end) - mapped + 1;
+			return (str[0] != '\0') ? str : nullptr;
+		}
+	public:
+		char version[4];
+		unsigned vertexCount;
+		unsigned indexCount;
+		unsigned materialCount;
+		unsigned meshCount;
+		Span<VERTEX> vertices;
+		Span<unsigned> indices;
+		std::vector<MATERIAL> materials;
+		Span<BATCH> batches;
+		std::vector<MESH> meshes;
+
+		MappedParser() { Clear(); }
+		MappedParser(MappedParser&& _other) noexcept { *this = std::move(_other); }
+		MappedParser& operator=(MappedParser&& _other) noexcept
+		{
+			if (this != &_other) {
+				file = std::move(_other.file);
+				mapped = _other.mapped;
+				mappedSize = _other.mappedSize;
+				memcpy(version, _other.version, 4);
+				vertexCount = _other.vertexCount;
+				indexCount = _other.indexCount;
+				materialCount = _other.materialCount;
+				meshCount = _other.meshCount;
+				vertices = _other.vertices;
+				indices = _other.indices;
+				materials = std::move(_other.materials);
+				batches = _other.batches;
+				meshes = std::move(_other.meshes);
+				_other.Clear();
+			}
+			return *this;
+		}
+		bool Parse(const char* h2bPath)
+		{
+			Clear();
+			if (!file.Open(h2bPath) || file.Size() < 20) {
+				Clear();
+				return false;
+			}
+			mapped = file.Data();
+			mappedSize = file.Size();
+			memcpy(version, mapped, 4);
+			if (version[1] < '1' || version[2] < '9' || version[3] < 'd') {
+				Clear();
+				return false;
+			}
+			memcpy(&vertexCount, mapped + 4, 4);
+			memcpy(&indexCount, mapped + 8, 4);
+			memcpy(&materialCount, mapped + 12, 4);
+			memcpy(&meshCount, mapped + 16, 4);
+			size_t offset = 20;
+			// vertex and index records are used in place (4 byte aligned in the file)
+			if (offset + 36ull * vertexCount + 4ull * indexCount > mappedSize) {
+				Clear();
+				return false;
+			}
+			vertices.data = reinterpret_cast<const VERTEX*>(mapped + offset);
+			vertices.count = vertexCount;
+			offset += 36ull * vertexCount;
+			indices.data = reinterpret_cast<const unsigned*>(mapped + offset);
+			indices.count = indexCount;
+			offset += 4ull * indexCount;
+			// every material is at least its attributes and ten terminators, checked before
+			// anything is sized from the header
+			if (materialCount == 0 || materialCount > (mappedSize - offset) / 90) {
+				Clear();
+				return false;
+			}
+			materials.resize(materialCount);
+			for (unsigned i = 0; i < materialCount; ++i) {
+				if (offset + 80 > mappedSize) {
+					Clear();
+					return false;
+				}
+				memcpy(&materials[i].attrib, mapped + offset, 80);
+				offset += 80;
+				for (int j = 0; j < 10; ++j)
+					*((&materials[i].name) + j) = ReadString(offset);
+			}
+			if (offset + 8ull * materialCount > mappedSize) {
+				Clear();
+				return false;
+			}
+			batches.data = reinterpret_cast<const BATCH*>(mapped + offset);
+			batches.count = materialCount;
+			offset += 8ull * materialCount;
+			// and every mesh at least a terminator and its 12 byte record
+			if (meshCount > (mappedSize - offset) / 13) {
+				Clear();
+				return false;
+			}
+			meshes.resize(meshCount);
+			for (unsigned i = 0; i < meshCount; ++i) {
+				meshes[i].name = ReadString(offset);
+				if (offset + 12 > mappedSize) {
+					Clear();
+					return false;
+				}
+				memcpy(&meshes[i].drawInfo, mapped + offset, 8);
+				memcpy(&meshes[i].materialIndex, mapped + offset + 8, 4);
+				offset += 12;
+				// the renderer copies each mesh's index range and material straight out
+				if (static_cast<unsigned long long>(meshes[i].drawInfo.indexOffset) + meshes[i].drawInfo.indexCount > indexCount ||
+					meshes[i].materialIndex >= materialCount) {
+					Clear();
+					return false;
+				}
+			}
+			return true;
+		}
+		void Clear()
+		{
+			file.Close();
+			mapped = nullptr;
+			mappedSize = 0;
+			*reinterpret_cast<unsigned*>(version) = 0;
+			vertexCount = indexCount = materialCount = meshCount = 0;
+			vertices = Span<VERTEX>();
+			indices = Span<unsigned>();
+			materials.clear();
+			batches = Span<BATCH>();
+			meshes.clear();
+		}
+	};
 }
 #endif
\ No newline at end of file
@@ -44,7 +44,7 @@ int main()
 		};
 		if (+vulkan.Create(	win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT, 
 							sizeof(debugLayers)/sizeof(debugLayers[0]),
-							debugLayers, 0, nullptr, 0, nullptr, false))
+							debugLayers, 0, nullptr, 0, nullptr, true)) // all features, like release: indirect draws need them
 #else
 		if (+vulkan.Create(win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT))
 #endif
@@ -1,13 +1,29 @@
-#include "shaderc/shaderc.h" // needed for compiling shaders at runtime
-#ifdef _WIN32 // must use MT platform DLL libraries on windows
-	#pragma comment(lib, "shaderc_combined.lib") 
-#endif
 #include <chrono>
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <filesystem>
+#include <climits>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
 #include "shaders.h"
+#include "ShaderCache.h"
 #include "LevelData.h"
+#include "LevelFile.h"
+#include "SceneCache.h"
+#include "MeshOptimizer.h"
+#include "GvkAllocator.h"
+#include "GvkUploader.h"
+#include "GvkRingBuffer.h"
+#include "GvkPipelineCache.h"
+#include "TransformStore.h"
+#include "GeometryPool.h"
+#include "DrawList.h"
+#include "DepthPyramid.h"
+#include "FrustumCuller.h"
+#include "InstanceCuller.h"
+#include "InstanceBVH.h"
 #include "h2bParser.h"
 
 #define PI 3.14159265359f
@@ -16,6 +32,9 @@
 // Shaders	
 const char* vertexShaderSource = Shaders::vertexShader;
 const char* pixelShaderSource = Shaders::pixelShader;
+const char* cullShaderSource = Shaders::cullShader;
+const char* occlusionCullShaderSource = Shaders::occlusionCullShader;
+const char* depthReduceShaderSource = Shaders::depthReduceShader;
 
 
 // Creation, Rendering & Cleanup
@@ -28,11 +47,20 @@ class Renderer
 
 	// Level data
 	LevelData lvlData;
+	H2B::MappedFile sceneBlob;	// the baked scene stays mapped, the geometry pool streams out of it
+	SceneCache::Sections scene;	// lvlData's bulk sections, either in lvlData or in sceneBlob
+	std::vector<MeshOptimizer::PACKED_VERTEX> packedVertexData;	// what the geometry pool streams when packedVertices is on
 	std::string levelFilePath = "../../Assets/Levels/GameLevel.txt";
+	std::string binaryLevelFilePath = "../../Assets/Levels/GameLevel.lvl";	// written by LevelConverter
+	std::string sceneCacheFilePath = "../../Assets/Levels/GameLevel.scene";	// baked after the first load
+	std::string shaderCacheDirectory = "../../Assets/Shaders";	// SPIR-V written by ShaderCompiler
+	std::string pipelineCacheFilePath = "../../Assets/Shaders/Pipelines.cache";	// saved at shutdown
+	enum LoadOptions : uint64_t {
+		WELD_VERTICES = 1 << 0,	// collapse bit-identical vertices while merging
+		OPTIMIZE_MESHES = 1 << 1,	// reorder for vertex cache, overdraw and vertex fetch
+	};
+	uint64_t loadOptions = WELD_VERTICES | OPTIMIZE_MESHES;	// part of the scene cache key
 	
-	// Model data
-	H2B::Parser parser;
-
 	// User Input
 	GW::INPUT::GInput inputProxy;
 	GW::INPUT::GController controllerProxy;
@@ -48,14 +76,15 @@ class Renderer
 	GW::MATH::GMATRIXF projection;
 
 	// Shader data
-	std::vector<VkBuffer> transformsBuffer;
-	std::vector<VkBuffer> materialsBuffer;
-	std::vector<VkBuffer> sceneDataBuffer;
-	std::vector<VkDeviceMemory> transformsData;
-	std::vector<VkDeviceMemory> materialsData;
-	std::vector<VkDeviceMemory> sceneDataData;
-	std::vector<VkDescriptorSet> storageBuffersDescriptorSet;
-	VkDescriptorSetLayout storageBuffersDescriptorSetLayout = nullptr;
+	VkBuffer materialsBuffer = nullptr;	// static, set 0
+	GvkAllocator::Allocation materialsData;
+	TransformStore transformStore;	// a slice per frame, only dirty ranges are re-uploaded
+	GvkRingBuffer frameRing;	// per frame dynamic data, bound with dynamic offsets
+	VkDeviceSize frameRingBytesPerFrame = 64 * 1024;	// plus room for every transform to change in one frame
+	VkDescriptorSet staticDescriptorSet = nullptr;	// set 0: data that never changes after load
+	VkDescriptorSet frameDescriptorSet = nullptr;	// set 1: dynamic offsets into the frame ring and transform slices
+	VkDescriptorSetLayout staticDescriptorSetLayout = nullptr;
+	VkDescriptorSetLayout frameDescriptorSetLayout = nullptr;
 	VkDescriptorPool descriptorPool = nullptr;
 	unsigned int max_frames = 0;
 	struct SceneData {
@@ -66,22 +95,61 @@ class Renderer
 		GW::MATH::GVECTORF cameraPosition;
 	};
 	SceneData sceneData;
-	struct InstanceData {
-		unsigned int transformOffset;
-		unsigned int materialIndex;
-	};
-	InstanceData instanceData;
+
+	// Vertex format
+	bool packedVertices = true;	// upload MeshOptimizer::PACKED_VERTEX, decoded in the vertex shader
+	std::vector<MeshOptimizer::QuantizationParams> meshQuantization;	// per unique mesh
 
 	// Vulkan objects
 	VkDevice device = nullptr;
-	VkBuffer vertexHandle = nullptr;
-	VkBuffer indexHandle = nullptr;
-	VkDeviceMemory vertexData = nullptr;
-	VkDeviceMemory indexData = nullptr;
+	GeometryPool geometryPool;	// vertices and indices are streamed in around the camera
+	std::vector<uint32_t> meshGroups;	// per unique mesh, its model's geometry pool group
+	std::vector<float> groupRadius;		// per group, bounding sphere radius around the model origin
+	struct GroupBounds {
+		float min[3], max[3];
+	};
+	std::vector<GroupBounds> groupBounds;	// per group, world space box around all its instances, grows as they move
+	VkDeviceSize geometryVertexBudget = 32ull << 20;	// arena sizes, capped at the level's total
+	VkDeviceSize geometryIndexBudget = 16ull << 20;
+	float streamRadius = 100.0f;	// models with an instance this close are paged in (the far plane)
+	DrawList drawList;	// one indirect draw per unique mesh
+	std::vector<uint32_t> meshFirstInstance;	// per unique mesh, where its instances start in the instance stream
+	uint64_t drawListResidency = UINT64_MAX;	// geometry pool residency the draw commands were built for
+	bool indirectDraws = true;	// one vkCmdDrawIndexedIndirect for the scene, else a vkCmdDrawIndexed per mesh
+	uint32_t maxDrawIndirectCount = 1;
+	FrustumCuller frustumCuller;	// compacts each frame's draws to what the camera can see
+	bool frustumCulling = true;	// needs indirect draws
+	DepthPyramid depthPyramid;	// built each frame from a depth pass of what was visible last frame
+	bool occlusionCulling = false;	// opt in, needs frustum culling, re-tests the rest against depthPyramid
+	InstanceCuller instanceCuller;	// world bounds of the instance stream, culled on the CPU for direct draws
+	bool cpuCulling = true;	// direct draws only, indirect draws cull on the GPU
+	InstanceBVH instanceBVH;	// hierarchy over the same spheres, built at load
+	bool hierarchicalCulling = true;	// walk instanceBVH instead of testing every instance
+	std::vector<DrawList::InstanceData> instanceStream;	// what the draw list was created from
+	std::vector<uint32_t> visibleInstances;	// this frame's survivors, indices into instanceStream
+	GvkAllocator allocator;	// every buffer's memory is sub-allocated from here
+	float memoryLogSeconds = 10.0f;	// period of the one line memory summary, 0 turns it off
+	std::chrono::steady_clock::time_point lastMemoryLog;
+	bool memoryReportKeyDown = false;	// M prints the full memory report
+	unsigned int carriedTransform = UINT_MAX;	// while G is held, the transform nearest the camera follows it
+	GW::MATH::GMATRIXF carriedOffset;	// the carried transform relative to the camera
+	float budgetCheckSeconds = 1.0f;	// period of the memory pressure check
+	float budgetPressure = 0.9f;	// share of a device heap's budget past which empty blocks are released
+	std::chrono::steady_clock::time_point lastBudgetCheck;
+	GvkUploader uploader;	// stages everything that lives in DEVICE_LOCAL memory
+	uint64_t levelUploadTicket = 0;	// level geometry and static data are drawn once this is resident
+	VkQueue graphicsQueue = nullptr;
+	VkCommandPool prepassPool = nullptr;
+	std::vector<VkCommandBuffer> prepassCommands;	// per frame transfer work, submitted ahead of the draws
+	std::vector<VkFence> prepassFences;
 	VkShaderModule vertexShader = nullptr;
 	VkShaderModule pixelShader = nullptr;
+	VkShaderModule cullShader = nullptr;
+	VkShaderModule depthReduceShader = nullptr;
 	VkPipeline pipeline = nullptr;
+	VkPipeline depthPipeline = nullptr;	// vertex stage only, draws into depthPyramid's pass
 	VkPipelineLayout pipelineLayout = nullptr;
+	GvkPipelineCache pipelineCache;	// every pipeline is created through this
 
 public:
 	Renderer(GW::SYSTEM::GWindow _win, GW::GRAPHICS::GVulkanSurface _vlk)
@@ -105,171 +173,185 @@ public:
 		matrixProxy.LookAtLHF(eye, at, up, view);
 
 		/***************** LOAD LEVEL AND MODEL DATA ******************/
-		// Load level data
-		std::vector <std::string> filenames;
-		std::vector<GW::MATH::GMATRIXF> matrices;
-		if (!GetGameLevelData(filenames, matrices))
-			std::cout << "Level Loading Error: \"" << levelFilePath << "\" did not open properly.\n";
-		for (size_t i = 0; i < filenames.size(); i++)
+		// Warm start from the baked scene when none of its inputs changed
+		auto loadStart = std::chrono::steady_clock::now();
+		if (SceneCache::Read(sceneCacheFilePath.c_str(), sceneBlob, lvlData, scene, loadOptions))
+			std::cout << "Loaded baked scene \"" << sceneCacheFilePath << "\"";
+		else
 		{
-			lvlData.AddInstance(filenames[i], matrices[i]);
-		}
-
-		// Load model data
-		size_t uniqueMeshCount = lvlData.uniqueMeshes.size();
-		for (size_t uniqueMeshIndex = 0; uniqueMeshIndex < uniqueMeshCount; uniqueMeshIndex++)
-		{
-			// Parse h2b file
-			std::string modelFilePath = "../../Assets/Models/" + lvlData.uniqueMeshes[uniqueMeshIndex].name + ".h2b";
-			if (!parser.Parse(modelFilePath.c_str())) {
-				std::cout << "Model Loading Error: \"" << modelFilePath << "\" did not open properly.\n";
-				continue;
-			}
-
-			// Copy data over
-			if (parser.meshCount > 1) //group by material if submeshes exist
-			{
-				//push back submeshes, starting at submesh 2
-				for (size_t submeshIndex = 1; submeshIndex < parser.meshCount; submeshIndex++)
-				{
-					LevelData::UniqueMesh submesh = lvlData.uniqueMeshes[uniqueMeshIndex];
-					submesh.name += "_submesh" + std::to_string(submeshIndex + 1);
-					submesh.indexCount = parser.meshes[submeshIndex].drawInfo.indexCount;
-					submesh.firstIndex = lvlData.indices.size();
-					submesh.vertexOffset = lvlData.vertices.size();
-					submesh.materialIndex = lvlData.materials.size();
-					lvlData.uniqueMeshes.push_back(submesh);
-
-					//push back indices per submesh
-					int start = parser.meshes[submeshIndex].drawInfo.indexOffset;
-					int end = parser.meshes[submeshIndex].drawInfo.indexOffset + parser.meshes[submeshIndex].drawInfo.indexCount;
-					for (size_t i = start; i < end; i++)
-						lvlData.indices.push_back(parser.indices[i]);
-					
-					//push back material per submesh
-					int matIndex = parser.meshes[submeshIndex].materialIndex;
-					lvlData.materials.push_back(parser.materials[matIndex].attrib);
-				}
-
-				//then write the first submesh data to the original unique mesh spot
-				lvlData.uniqueMeshes[uniqueMeshIndex].name += "_submesh1";
-				lvlData.uniqueMeshes[uniqueMeshIndex].indexCount = parser.meshes[0].drawInfo.indexCount;
-				lvlData.uniqueMeshes[uniqueMeshIndex].firstIndex = lvlData.indices.size();
-				lvlData.uniqueMeshes[uniqueMeshIndex].vertexOffset = lvlData.vertices.size();
-				lvlData.uniqueMeshes[uniqueMeshIndex].materialIndex = lvlData.materials.size();
-				
-				//push back indices for first submest
-				int start = parser.meshes[0].drawInfo.indexOffset;
-				int end = parser.meshes[0].drawInfo.indexOffset + parser.meshes[0].drawInfo.indexCount;
-				for (size_t i = start; i < end; i++)
-					lvlData.indices.push_back(parser.indices[i]);
-				
-				//push back material per submesh
-				int matIndex = parser.meshes[0].materialIndex;
-				lvlData.materials.push_back(parser.materials[matIndex].attrib);
-
-				// Push back all vertices
-				for (size_t j = 0; j < parser.vertexCount; j++)
-					lvlData.vertices.push_back(parser.vertices[j]);
-			}
-			else //otherwise load data into existing unique mesh
-			{
-				lvlData.uniqueMeshes[uniqueMeshIndex].indexCount = parser.indexCount;
-				lvlData.uniqueMeshes[uniqueMeshIndex].firstIndex = lvlData.indices.size();
-				lvlData.uniqueMeshes[uniqueMeshIndex].vertexOffset = lvlData.vertices.size();
-				lvlData.uniqueMeshes[uniqueMeshIndex].materialIndex = lvlData.materials.size();
-				for (size_t i = 0; i < parser.vertexCount; i++)
-					lvlData.vertices.push_back(parser.vertices[i]);
-				for (size_t i = 0; i < parser.indexCount; i++)
-					lvlData.indices.push_back(parser.indices[i]);
-				lvlData.materials.push_back(parser.materials[0].attrib);
-			}
+			std::vector<std::string> inputFiles;
+			if (LoadLevelData(inputFiles) && !SceneCache::Write(sceneCacheFilePath.c_str(), lvlData, inputFiles, loadOptions))
+				std::cout << "Scene Cache Error: \"" << sceneCacheFilePath << "\" could not be written.\n";
+			scene = SceneCache::View(lvlData);
+			std::cout << "Loaded level \"" << levelFilePath << "\"";
 		}
+		std::chrono::duration<float, std::milli> loadTime = std::chrono::steady_clock::now() - loadStart;
+		std::cout << " in " << loadTime.count() << " ms\n";
 
 		/***************** BUFFER ALLOCATION ******************/
 		// Grab the device & physical device
 		VkPhysicalDevice physicalDevice = nullptr;
 		vlk.GetDevice((void**)&device);
 		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		allocator.Create(physicalDevice, device);
 		
-		// Transfer vertices to vertex buffer
-		GvkHelper::create_buffer(physicalDevice, device, lvlData.vertices.size() * sizeof(lvlData.vertices[0]),
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexHandle, &vertexData);
-		GvkHelper::write_to_buffer(device, vertexData, lvlData.vertices.data(), lvlData.vertices.size() * sizeof(lvlData.vertices[0]));
-
-		// Transfer indices to index buffer
-		GvkHelper::create_buffer(physicalDevice, device, lvlData.indices.size() * sizeof(lvlData.indices[0]),
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexHandle, &indexData);
-		GvkHelper::write_to_buffer(device, indexData, lvlData.indices.data(), lvlData.indices.size() * sizeof(lvlData.indices[0]));
+		// Pack vertices, quantizing each model's positions against its own bounds
+		const void* vertexSource = scene.vertices;
+		VkDeviceSize vertexBytes = scene.vertexCount * sizeof(H2B::VERTEX);
+		if (packedVertices)
+		{
+			PackVertices(packedVertexData);
+			vertexSource = packedVertexData.data();
+			vertexBytes = packedVertexData.size() * sizeof(packedVertexData[0]);
+			std::cout << "Packed vertices: " << scene.vertexCount * sizeof(H2B::VERTEX) << " -> " << vertexBytes << " bytes\n";
+		}
 
+		// Geometry lives in DEVICE_LOCAL memory, filled through the staging uploader.
+		// Gateware only creates graphics and present queues, so transfers share the graphics queue.
+		// The staging ring holds at least the biggest group so streaming never has to split one.
+		uint32_t vertexStride = static_cast<uint32_t>(packedVertices ? sizeof(MeshOptimizer::PACKED_VERTEX) : sizeof(H2B::VERTEX));
+		std::vector<GeometryPool::Group> geometryGroups = BuildGeometryGroups();
+		VkDeviceSize stagingBytes = 16ull << 20;
+		for (const GeometryPool::Group& group : geometryGroups)
+			stagingBytes = std::max(stagingBytes, VkDeviceSize(group.vertexCount) * vertexStride + VkDeviceSize(group.indexCount) * sizeof(uint32_t) + 32);
+		unsigned int graphicsFamily = 0, presentFamily = 0;
+		vlk.GetQueueFamilyIndices(graphicsFamily, presentFamily);
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		if (!uploader.Create(&allocator, device, graphicsFamily, graphicsQueue, stagingBytes))
+			std::cout << "Upload Error: staging buffer could not be created.\n";
 
-		// Get number of frames for descriptor sets
+		// Get number of frames in flight for the geometry pool, frame ring and transform slices
 		vlk.GetSwapchainImageCount(max_frames);
-		transformsBuffer.resize(max_frames);
-		materialsBuffer.resize(max_frames);
-		sceneDataBuffer.resize(max_frames);
-		transformsData.resize(max_frames);
-		materialsData.resize(max_frames);
-		sceneDataData.resize(max_frames);
-
-		for (size_t i = 0; i < max_frames; i++)
-		{
-			// Transfer transforms to storage buffer
-			GvkHelper::create_buffer(physicalDevice, device, sizeof(GW::MATH::GMATRIXF) * lvlData.transforms.size(),
-				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &transformsBuffer[i], &transformsData[i]);
-			GvkHelper::write_to_buffer(device, transformsData[i], lvlData.transforms.data(), sizeof(GW::MATH::GMATRIXF) * lvlData.transforms.size());
-			
-			// Transfer materials to storage buffer
-			GvkHelper::create_buffer(physicalDevice, device, sizeof(H2B::ATTRIBUTES)* lvlData.materials.size(),
-				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &materialsBuffer[i], &materialsData[i]);
-			GvkHelper::write_to_buffer(device, materialsData[i], lvlData.materials.data(), sizeof(H2B::ATTRIBUTES)* lvlData.materials.size());
 
-			// Transfer scene data to storage buffer
-			GvkHelper::create_buffer(physicalDevice, device, sizeof(SceneData),
-				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &sceneDataBuffer[i], &sceneDataData[i]);
-			GvkHelper::write_to_buffer(device, sceneDataData[i], &sceneData, sizeof(SceneData));
+		// Vertices and indices are paged into the geometry pool per model as the camera nears them
+		if (!geometryPool.Create(&allocator, &uploader, vertexSource, vertexStride, static_cast<uint32_t>(vertexBytes / vertexStride),
+			scene.indices, static_cast<uint32_t>(scene.indexCount), geometryGroups,
+			geometryVertexBudget, geometryIndexBudget, max_frames))
+			std::cout << "Geometry Pool Error: arenas could not be created.\n";
+
+		// Materials never change after load, one DEVICE_LOCAL copy is shared by every frame
+		uploader.CreateBuffer(sizeof(H2B::ATTRIBUTES) * scene.materialCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			scene.materials, &materialsBuffer, &materialsData, GvkAllocator::CATEGORY_MATERIAL);
+
+		// Transforms get a copy per frame in flight so moving props only patches the current one
+		if (!transformStore.Create(physicalDevice, &allocator, uploader, scene.transforms,
+			static_cast<uint32_t>(scene.transformCount), max_frames))
+			std::cout << "Upload Error: transform buffer could not be created.\n";
+
+		// Per draw data and the instance stream are static, the commands follow geometry residency
+		instanceStream = BuildInstanceStream();
+		if (!drawList.Create(physicalDevice, &allocator, uploader, BuildDrawData(), instanceStream, max_frames))
+			std::cout << "Upload Error: draw list buffers could not be created.\n";
+		VkPhysicalDeviceFeatures features;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		maxDrawIndirectCount = features.multiDrawIndirect ? properties.limits.maxDrawIndirectCount : 1;
+		if (indirectDraws && !features.drawIndirectFirstInstance) {
+			std::cout << "Indirect draws need drawIndirectFirstInstance, falling back to direct draws.\n";
+			indirectDraws = false;
+		}
+
+		// Direct draws submit only what the CPU finds inside the frustum
+		cpuCulling = cpuCulling && !indirectDraws;
+		if (cpuCulling)
+		{
+			std::vector<GW::MATH::GSPHEREF> spheres(instanceStream.size());
+			for (uint32_t i = 0; i < instanceStream.size(); i++)
+				spheres[i] = InstanceCuller::TransformSphere(transformStore.Get(instanceStream[i].transformIndex),
+					lvlData.uniqueMeshes[instanceStream[i].drawIndex].bounds);
+			if (hierarchicalCulling)
+				instanceBVH.Build(spheres);
+			else
+			{
+				instanceCuller.Create(static_cast<uint32_t>(spheres.size()));
+				for (uint32_t i = 0; i < spheres.size(); i++)
+					instanceCuller.SetInstance(i, spheres[i]);
+			}
+			frameRingBytesPerFrame += instanceStream.size() * sizeof(DrawList::InstanceData);
 		}
+		levelUploadTicket = uploader.Submit();	// Render skips drawing until this lands
+
+		// Scene data is written into the frame ring every frame, dirty transforms and draw commands are staged through it,
+		// CPU culled instances are read from it directly
+		frameRingBytesPerFrame += transformStore.GetRange() + drawList.GetCommandBytes();
+		if (!frameRing.Create(physicalDevice, &allocator, max_frames, frameRingBytesPerFrame,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT))
+			std::cout << "Ring Buffer Error: frame ring could not be created.\n";
+		allocator.PrintStats();
+		lastMemoryLog = std::chrono::steady_clock::now();
+
+		// Pre-pass command buffers, one per frame, each guarded by its own fence
+		VkCommandPoolCreateInfo prepass_pool_info = {};
+		prepass_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		prepass_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		prepass_pool_info.queueFamilyIndex = graphicsFamily;
+		vkCreateCommandPool(device, &prepass_pool_info, nullptr, &prepassPool);
+		prepassCommands.resize(max_frames);
+		VkCommandBufferAllocateInfo prepass_alloc_info = {};
+		prepass_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		prepass_alloc_info.commandPool = prepassPool;
+		prepass_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		prepass_alloc_info.commandBufferCount = max_frames;
+		vkAllocateCommandBuffers(device, &prepass_alloc_info, prepassCommands.data());
+		prepassFences.resize(max_frames);
+		VkFenceCreateInfo prepass_fence_info = {};
+		prepass_fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		prepass_fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		for (unsigned int i = 0; i < max_frames; ++i)
+			vkCreateFence(device, &prepass_fence_info, nullptr, &prepassFences[i]);
 
 		/***************** SHADER INTIALIZATION ******************/
-		// Intialize runtime shader compiler HLSL -> SPIRV
-		shaderc_compiler_t compiler = shaderc_compiler_initialize();
-		shaderc_compile_options_t options = shaderc_compile_options_initialize();
-		shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
-		shaderc_compile_options_set_invert_y(options, false);
+		// SPIR-V comes from the shader cache, only a miss pays for compiling
+		ShaderCache::Options shaderOptions;
+		shaderOptions.packedVertices = packedVertices; // selects the decode path in Shaders::vertexShader
 #ifndef NDEBUG
-		shaderc_compile_options_set_generate_debug_info(options);
+		shaderOptions.debugInfo = true;
 #endif
-		
-		// Create Vertex Shader
-		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, vertexShaderSource, strlen(vertexShaderSource),
-			shaderc_vertex_shader, "main.vert", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Vertex Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &vertexShader);
-		shaderc_result_release(result);
-		
-		// Create Pixel Shader
-		result = shaderc_compile_into_spv( // compile
-			compiler, pixelShaderSource, strlen(pixelShaderSource),
-			shaderc_fragment_shader, "main.frag", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Pixel Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &pixelShader);
-		shaderc_result_release(result);
-		
-		// Free runtime shader compiler resources
-		shaderc_compile_options_release(options);
-		shaderc_compiler_release(compiler);
+		bool vertexLoaded = LoadShader("Vertex", vertexShaderSource, ShaderCache::VERTEX, shaderOptions, &vertexShader);
+		bool pixelLoaded = LoadShader("Pixel", pixelShaderSource, ShaderCache::FRAGMENT, shaderOptions, &pixelShader);
+		frustumCulling = frustumCulling && indirectDraws;
+		occlusionCulling = occlusionCulling && frustumCulling;
+		if (occlusionCulling && DepthPyramid::FindDepthFormat(physicalDevice) == VK_FORMAT_UNDEFINED) {
+			std::cout << "Occlusion culling needs a depth format that can be sampled, culling the frustum only.\n";
+			occlusionCulling = false;
+		}
+		// The reduce shader decides the cull shader's entry point, so it loads first
+		if (occlusionCulling && !LoadShader("Depth reduce", depthReduceShaderSource, ShaderCache::COMPUTE, shaderOptions, &depthReduceShader)) {
+			std::cout << "Culling Error: depth reduce shader did not load, culling the frustum only.\n";
+			occlusionCulling = false;
+		}
+		if (occlusionCulling && !LoadShader("Occlusion cull", occlusionCullShaderSource, ShaderCache::COMPUTE, shaderOptions, &cullShader,
+			FrustumCuller::EntryPoint(true))) {
+			std::cout << "Culling Error: occlusion cull shader did not load, culling the frustum only.\n";
+			occlusionCulling = false;
+		}
+		if (frustumCulling && !occlusionCulling && !LoadShader("Cull", cullShaderSource, ShaderCache::COMPUTE, shaderOptions, &cullShader,
+			FrustumCuller::EntryPoint(false))) {
+			std::cout << "Culling Error: cull shader did not load, drawing everything.\n";
+			frustumCulling = false;
+		}
 
 		/***************** PIPELINE INTIALIZATION ******************/
+		// Driver compiled pipelines are kept across runs, the first launch fills the cache
+		pipelineCache.Create(physicalDevice, device, pipelineCacheFilePath);
+
+		// Compute pipeline for the culling pre-pass, its outputs replace the draw list's commands and instances.
+		// Occlusion adds a depth pass sized like the window and the pyramid built from it.
+		if (frustumCulling && !(frustumCuller.Create(physicalDevice, device, &allocator, transformStore, drawList,
+			cullShader, pipelineCache.Get(), max_frames, occlusionCulling) && (!occlusionCulling ||
+			(depthPyramid.Create(physicalDevice, device, &allocator, depthReduceShader, pipelineCache.Get()) &&
+			depthPyramid.Resize(width, height))))) {
+			std::cout << "Culling Error: frustum culler could not be created, drawing everything.\n";
+			frustumCuller.Destroy();
+			depthPyramid.Destroy();
+			frustumCulling = false;
+			occlusionCulling = false;
+		}
+		if (occlusionCulling)
+			frustumCuller.SetDepthPyramid(depthPyramid);
+
 		// Create Pipeline & Layout (Thanks Tiny!)
 		VkRenderPass renderPass;
 		vlk.GetRenderPass((void**)&renderPass);
@@ -294,20 +376,30 @@ public:
 		assembly_create_info.primitiveRestartEnable = false;
 		
 		// Vertex Input State
-		VkVertexInputBindingDescription vertex_binding_description = {};
-		vertex_binding_description.binding = 0;
-		vertex_binding_description.stride = sizeof(H2B::VERTEX);
-		vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		VkVertexInputAttributeDescription vertex_attribute_description[3] = {
+		VkVertexInputBindingDescription vertex_binding_description[2] = {};
+		vertex_binding_description[0].binding = 0;
+		vertex_binding_description[0].stride = packedVertices ? sizeof(MeshOptimizer::PACKED_VERTEX) : sizeof(H2B::VERTEX);
+		vertex_binding_description[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		vertex_binding_description[1].binding = 1;	// instance stream, a draw's firstInstance indexes into it
+		vertex_binding_description[1].stride = sizeof(DrawList::InstanceData);
+		vertex_binding_description[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		VkVertexInputAttributeDescription vertex_attribute_description[4] = {
 			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(H2B::VERTEX, pos) },
 			{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(H2B::VERTEX, uvw) },
-			{ 2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(H2B::VERTEX, nrm) }
+			{ 2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(H2B::VERTEX, nrm) },
+			{ 3, 1, VK_FORMAT_R32G32_UINT, 0 }	// transform index, draw index
 		};
+		if (packedVertices)
+		{
+			vertex_attribute_description[0] = { 0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(MeshOptimizer::PACKED_VERTEX, pos) };
+			vertex_attribute_description[1] = { 1, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(MeshOptimizer::PACKED_VERTEX, uv) };
+			vertex_attribute_description[2] = { 2, 0, VK_FORMAT_R16G16_SNORM, offsetof(MeshOptimizer::PACKED_VERTEX, nrm) };
+		}
 		VkPipelineVertexInputStateCreateInfo input_vertex_info = {};
 		input_vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		input_vertex_info.vertexBindingDescriptionCount = 1;
-		input_vertex_info.pVertexBindingDescriptions = &vertex_binding_description;
-		input_vertex_info.vertexAttributeDescriptionCount = 3;
+		input_vertex_info.vertexBindingDescriptionCount = 2;
+		input_vertex_info.pVertexBindingDescriptions = vertex_binding_description;
+		input_vertex_info.vertexAttributeDescriptionCount = 4;
 		input_vertex_info.pVertexAttributeDescriptions = vertex_attribute_description;
 		
 		// Viewport State 
@@ -390,101 +482,107 @@ public:
 
 		//layout = carton	/ set = egg
 
-		// Layout bindings: describes the kinds of descriptors in the set
-		VkDescriptorSetLayoutBinding descriptorLayoutBindings[3];
-		//binding 0 = tranforms storage buffer
-		descriptorLayoutBindings[0].binding = 0; //"which binding am I"
-		descriptorLayoutBindings[0].descriptorCount = 1;
-		descriptorLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorLayoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-		descriptorLayoutBindings[0].pImmutableSamplers = nullptr;
-		//binding 1 = materials storage buffer
-		descriptorLayoutBindings[1].binding = 1; //"which binding am I"
-		descriptorLayoutBindings[1].descriptorCount = 1;
-		descriptorLayoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorLayoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-		descriptorLayoutBindings[1].pImmutableSamplers = nullptr;
-		//binding 2 = scene data storage buffer
-		descriptorLayoutBindings[2].binding = 2; //"which binding am I"
-		descriptorLayoutBindings[2].descriptorCount = 1;
-		descriptorLayoutBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorLayoutBindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-		descriptorLayoutBindings[2].pImmutableSamplers = nullptr;
-
-		// Create layout: describes the kind of DescriptorSet coming to the pipeline
+		// Layout bindings: describes the kinds of descriptors in each set
+		// set 0 = static data shared by every frame
+		VkDescriptorSetLayoutBinding staticLayoutBindings[2];
+		//binding 0 = materials storage buffer
+		staticLayoutBindings[0].binding = 0; //"which binding am I"
+		staticLayoutBindings[0].descriptorCount = 1;
+		staticLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		staticLayoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		staticLayoutBindings[0].pImmutableSamplers = nullptr;
+		//binding 1 = per draw data, indexed by the instance stream's draw index
+		staticLayoutBindings[1].binding = 1; //"which binding am I"
+		staticLayoutBindings[1].descriptorCount = 1;
+		staticLayoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		staticLayoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;	// matches binding 0 so one write covers both
+		staticLayoutBindings[1].pImmutableSamplers = nullptr;
+		// set 1 = per frame data
+		VkDescriptorSetLayoutBinding frameLayoutBindings[2];
+		//binding 0 = scene data, a dynamic offset into the frame ring
+		frameLayoutBindings[0].binding = 0; //"which binding am I"
+		frameLayoutBindings[0].descriptorCount = 1;
+		frameLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		frameLayoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		frameLayoutBindings[0].pImmutableSamplers = nullptr;
+		//binding 1 = transforms, a dynamic offset picks the frame's slice
+		frameLayoutBindings[1].binding = 1; //"which binding am I"
+		frameLayoutBindings[1].descriptorCount = 1;
+		frameLayoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		frameLayoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		frameLayoutBindings[1].pImmutableSamplers = nullptr;
+
+		// Create layouts: describes the kind of DescriptorSets coming to the pipeline
 		VkDescriptorSetLayoutCreateInfo descriptorCreateInfo = {};
 		descriptorCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		descriptorCreateInfo.flags = 0;
-		descriptorCreateInfo.bindingCount = 3;
-		descriptorCreateInfo.pBindings = descriptorLayoutBindings;
+		descriptorCreateInfo.bindingCount = 2;
+		descriptorCreateInfo.pBindings = staticLayoutBindings;
 		descriptorCreateInfo.pNext = nullptr;
 		VkResult r = vkCreateDescriptorSetLayout(device, &descriptorCreateInfo,
-			nullptr, &storageBuffersDescriptorSetLayout);
+			nullptr, &staticDescriptorSetLayout);
+		descriptorCreateInfo.bindingCount = 2;
+		descriptorCreateInfo.pBindings = frameLayoutBindings;
+		r = vkCreateDescriptorSetLayout(device, &descriptorCreateInfo,
+			nullptr, &frameDescriptorSetLayout);
 
 		// Descriptor Pool: describes the space needed to hold all our descriptor sets
 		VkDescriptorPoolCreateInfo descriptorpool_create_info = {};
 		descriptorpool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		VkDescriptorPoolSize descriptorpool_size[3] = {			// All the descriptors for all the sets
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_frames },	// transforms storage buffer
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_frames },	// materials storage buffer
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_frames }	// scene data storage buffer
-																
+		VkDescriptorPoolSize descriptorpool_size[2] = {		// All the descriptors for all the sets
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 },			// materials & per draw data
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2 }	// scene data in the frame ring & transform slices
 		};
-		descriptorpool_create_info.poolSizeCount = 3;	
+		descriptorpool_create_info.poolSizeCount = 2;	
 		descriptorpool_create_info.pPoolSizes = descriptorpool_size;
-		descriptorpool_create_info.maxSets = max_frames * 3;
+		descriptorpool_create_info.maxSets = 2;
 		descriptorpool_create_info.flags = 0;
 		descriptorpool_create_info.pNext = nullptr;
 		vkCreateDescriptorPool(device, &descriptorpool_create_info, nullptr, &descriptorPool);
 
-		// Allocate descriptor sets: using the descriptor pool, allocate the descriptor sets
+		// Allocate descriptor sets: one of each, the ring's dynamic offset picks the frame
+		VkDescriptorSetLayout setLayouts[2] = { staticDescriptorSetLayout, frameDescriptorSetLayout };
+		VkDescriptorSet sets[2] = {};
 		VkDescriptorSetAllocateInfo svDescriptorset_allocate_info = {};
 		svDescriptorset_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		svDescriptorset_allocate_info.descriptorSetCount = 1;
-		svDescriptorset_allocate_info.pSetLayouts = &storageBuffersDescriptorSetLayout;			//this will include multiple layouts later
+		svDescriptorset_allocate_info.descriptorSetCount = 2;
+		svDescriptorset_allocate_info.pSetLayouts = setLayouts;
 		svDescriptorset_allocate_info.descriptorPool = descriptorPool;
 		svDescriptorset_allocate_info.pNext = nullptr;
-		storageBuffersDescriptorSet.resize(max_frames);
-		for (int i = 0; i < max_frames; ++i)
-		{
-			vkAllocateDescriptorSets(device, &svDescriptorset_allocate_info, &storageBuffersDescriptorSet[i]);	//can include more descriptor sets as you see
-		}
+		vkAllocateDescriptorSets(device, &svDescriptorset_allocate_info, sets);
+		staticDescriptorSet = sets[0];
+		frameDescriptorSet = sets[1];
 
 		// Write descriptor sets: use the pool to write buffer data
-		VkWriteDescriptorSet write_descriptorset = {};
-		write_descriptorset.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		write_descriptorset.descriptorCount = 3;
-		write_descriptorset.dstArrayElement = 0;
-		write_descriptorset.dstBinding = 0;
-		write_descriptorset.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		for (int i = 0; i < max_frames; ++i) {
-			write_descriptorset.dstSet = storageBuffersDescriptorSet[i];
-
-			VkDescriptorBufferInfo dbinfo[3] = { 
-				{transformsBuffer[i], 0, VK_WHOLE_SIZE},
-				{materialsBuffer[i], 0, VK_WHOLE_SIZE},
-				{sceneDataBuffer[i], 0, VK_WHOLE_SIZE}};
-			write_descriptorset.pBufferInfo = dbinfo;
-
-			vkUpdateDescriptorSets(device, 1, &write_descriptorset, 0, nullptr);
-		};
+		VkDescriptorBufferInfo staticInfo[2] = {
+			{materialsBuffer, 0, VK_WHOLE_SIZE},
+			{drawList.GetDrawDataBuffer(), 0, VK_WHOLE_SIZE}};
+		VkDescriptorBufferInfo frameInfo[2] = {	// offsets come at bind time
+			{ frameRing.GetBuffer(), 0, sizeof(SceneData) },
+			{ transformStore.GetBuffer(), 0, std::max<VkDeviceSize>(transformStore.GetRange(), sizeof(GW::MATH::GMATRIXF)) } };
+		VkWriteDescriptorSet write_descriptorset[2] = {};
+		write_descriptorset[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write_descriptorset[0].dstSet = staticDescriptorSet;
+		write_descriptorset[0].descriptorCount = 2;
+		write_descriptorset[0].dstArrayElement = 0;
+		write_descriptorset[0].dstBinding = 0;
+		write_descriptorset[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write_descriptorset[0].pBufferInfo = staticInfo;
+		write_descriptorset[1] = write_descriptorset[0];
+		write_descriptorset[1].dstSet = frameDescriptorSet;
+		write_descriptorset[1].descriptorCount = 2;
+		write_descriptorset[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		write_descriptorset[1].pBufferInfo = frameInfo;
+		vkUpdateDescriptorSets(device, 2, write_descriptorset, 0, nullptr);
 
 
-		// Scene Push constant
-		VkPushConstantRange pushConstantRange;
-		pushConstantRange.offset = 0;
-		pushConstantRange.size = sizeof(InstanceData);
-		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-
 		// Descriptor pipeline layout
 		VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
 		pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipeline_layout_create_info.setLayoutCount = 1;
-		/*VkDescriptorSetLayout layouts[2] = { vertexDescriptorLayout, pixelDescriptorLayout };
-		pipeline_layout_create_info.pSetLayouts = layouts;*/
-		pipeline_layout_create_info.pSetLayouts = &storageBuffersDescriptorSetLayout;
-		pipeline_layout_create_info.pushConstantRangeCount = 1;
-		pipeline_layout_create_info.pPushConstantRanges = &pushConstantRange;
+		pipeline_layout_create_info.setLayoutCount = 2;
+		pipeline_layout_create_info.pSetLayouts = setLayouts;
+		pipeline_layout_create_info.pushConstantRangeCount = 0;
+		pipeline_layout_create_info.pPushConstantRanges = nullptr;
 		vkCreatePipelineLayout(device, &pipeline_layout_create_info,
 			nullptr, &pipelineLayout);
 		
@@ -505,8 +603,33 @@ public:
 		pipeline_create_info.renderPass = renderPass;
 		pipeline_create_info.subpass = 0;
 		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-		vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
-			&pipeline_create_info, nullptr, &pipeline);
+		// Without both shaders there is nothing to draw with, Render then skips every frame
+		auto pipelineStart = std::chrono::steady_clock::now();
+		if (!vertexLoaded || !pixelLoaded)
+			std::cout << "Pipeline Error: vertex or pixel shader did not load, nothing will be drawn.\n";
+		else if (vkCreateGraphicsPipelines(device, pipelineCache.Get(), 1, &pipeline_create_info, nullptr, &pipeline) != VK_SUCCESS) {
+			std::cout << "Pipeline Error: graphics pipeline could not be created, nothing will be drawn.\n";
+			pipeline = nullptr;
+		}
+		else {
+			std::chrono::duration<float, std::milli> pipelineTime = std::chrono::steady_clock::now() - pipelineStart;
+			std::cout << "Graphics pipeline created in " << pipelineTime.count() << " ms\n";
+		}
+
+		// Same vertex stage and layout into the occlusion depth pass, without a pixel shader
+		if (occlusionCulling && pipeline != nullptr)
+		{
+			VkPipelineColorBlendStateCreateInfo depth_blend_create_info = {};
+			depth_blend_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+			pipeline_create_info.stageCount = 1;
+			pipeline_create_info.pColorBlendState = &depth_blend_create_info;
+			pipeline_create_info.renderPass = depthPyramid.GetRenderPass();
+			if (vkCreateGraphicsPipelines(device, pipelineCache.Get(), 1, &pipeline_create_info, nullptr, &depthPipeline) != VK_SUCCESS) {
+				std::cout << "Culling Error: depth pipeline could not be created, drawing everything.\n";
+				depthPipeline = nullptr;
+				DisableGpuCulling();
+			}
+		}
 
 		/***************** CLEANUP / SHUTDOWN ******************/
 		// GVulkanSurface will inform us when to release any allocated resources
@@ -518,11 +641,24 @@ public:
 	
 	void Render()
 	{
+		if (pipeline == nullptr)
+			return;	// the shaders failed to load, already reported
+		ReportMemory();
+		TrimMemory();
+
 		// Grab the current Vulkan commandBuffer
 		unsigned int currentBuffer;
 		vlk.GetSwapchainCurrentImage(currentBuffer);
 		VkCommandBuffer commandBuffer;
 		vlk.GetCommandBuffer(currentBuffer, (void**)&commandBuffer);
+
+		// Nothing to draw until the level's buffers are resident, never wait for them
+		bool wasResident = uploader.IsComplete(levelUploadTicket);
+		uploader.Poll();
+		if (!uploader.IsComplete(levelUploadTicket))
+			return;
+		if (!wasResident)
+			uploader.ReportStats("Static data");
 		
 		// Setup the pipeline's dynamic settings
 		unsigned int width, height;
@@ -547,25 +683,124 @@ public:
 		sceneData.lightDirection = { -1.0f, -1.0f, -2.0f };
 		sceneData.lightColor = { 0.9f, 0.9f, 1.0f, 1.0f };
 		sceneData.cameraPosition = camera.row4;
-		GvkHelper::write_to_buffer(device, sceneDataData[currentBuffer],
-			&sceneData, sizeof(SceneData));
+		frameRing.BeginFrame(currentBuffer);
+		GvkRingBuffer::Allocation sceneDataAllocation = frameRing.Push(&sceneData, sizeof(SceneData));
+
+		// Page in what is near the camera, the draw commands follow what is resident
+		StreamGeometry();
+		if (drawListResidency != geometryPool.GetResidencyVersion())
+			UpdateDrawCommands();
+
+		// The occlusion depth pass follows the window, nothing may still be using the old images
+		if (occlusionCulling && (std::max(width, 1u) != depthPyramid.GetWidth() || std::max(height, 1u) != depthPyramid.GetHeight()))
+		{
+			vkDeviceWaitIdle(device);
+			if (depthPyramid.Resize(width, height))
+				frustumCuller.SetDepthPyramid(depthPyramid);
+			else {
+				std::cout << "Culling Error: depth pyramid could not be resized, drawing everything.\n";
+				DisableGpuCulling();
+			}
+		}
+
+		// Patch this frame's transform and draw command slices with whatever changed since they were last used,
+		// then cull them. The culling counters from this frame's last use have landed once the fence is waited on.
+		uint32_t dynamicOffsets[2] = { sceneDataAllocation.offset, transformStore.GetSliceOffset(currentBuffer) };
+		VkCommandBuffer prepass = BeginPrepass(currentBuffer);
+		// Commands are staged right after the scene data so the ring space reserved for them is always free.
+		// A slice that still could not be updated points at freed geometry, the GPU must not read it this frame.
+		bool commandsRecorded = drawList.RecordUpdate(currentBuffer, frameRing, prepass);
+		bool commandsCurrent = drawList.IsCurrent(currentBuffer);
+		bool transformsRecorded = transformStore.RecordUpdate(currentBuffer, frameRing, prepass);
+		bool culled = false;
+		bool pyramidPrepared = occlusionCulling && depthPyramid.RecordFirstUse(prepass);
+		if (frustumCulling && commandsCurrent) {
+			frustumCuller.ReadCounters(currentBuffer);
+			culled = frustumCuller.Record(currentBuffer, prepass, sceneData.viewProjection);
+			if (culled && occlusionCulling)
+				RecordOcclusion(currentBuffer, prepass, dynamicOffsets);
+		}
+		SubmitPrepass(currentBuffer, transformsRecorded || commandsRecorded || pyramidPrepared || culled);
+
+		// Direct draws cull on the CPU, the survivors become this frame's instance stream in the frame ring
+		bool cpuCulled = false;
+		GvkRingBuffer::Allocation visibleAllocation;
+		if (cpuCulling)
+		{
+			float planes[6][4];
+			InstanceCuller::ExtractPlanes(sceneData.viewProjection, planes);
+			if (hierarchicalCulling)
+			{
+				instanceBVH.Refit();
+				instanceBVH.Cull(planes, visibleInstances);
+				std::sort(visibleInstances.begin(), visibleInstances.end());	// draws expect stream order
+			}
+			else
+				instanceCuller.Cull(planes, visibleInstances);
+			if (!visibleInstances.empty())
+				visibleAllocation = frameRing.Allocate(visibleInstances.size() * sizeof(DrawList::InstanceData));
+			cpuCulled = visibleInstances.empty() || visibleAllocation.pointer != nullptr;	// ring full draws everything
+			DrawList::InstanceData* visible = static_cast<DrawList::InstanceData*>(visibleAllocation.pointer);
+			for (size_t i = 0; visible != nullptr && i < visibleInstances.size(); i++)
+				visible[i] = instanceStream[visibleInstances[i]];
+		}
 
 		// Draw
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexHandle, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indexHandle, offsets[0], VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			pipelineLayout, 0, 1, &storageBuffersDescriptorSet[currentBuffer], 0, nullptr);
-		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
-		{	
-			instanceData.transformOffset = lvlData.uniqueMeshes[i].transformOffset;
-			instanceData.materialIndex = lvlData.uniqueMeshes[i].materialIndex;
-			vkCmdPushConstants(commandBuffer, pipelineLayout,
-				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(InstanceData), &instanceData);
+		if (culled)
+			BindScene(commandBuffer, frustumCuller.GetInstanceBuffer(), frustumCuller.GetInstanceOffset(currentBuffer), dynamicOffsets);
+		else if (visibleAllocation.pointer != nullptr)
+			BindScene(commandBuffer, frameRing.GetBuffer(), visibleAllocation.offset, dynamicOffsets);
+		else
+			BindScene(commandBuffer, drawList.GetInstanceBuffer(), 0, dynamicOffsets);
+		if (indirectDraws)
+		{
+			if (culled)
+				DrawIndirect(commandBuffer, frustumCuller.GetCommandBuffer(), frustumCuller.GetCommandOffset(currentBuffer));
+			else if (commandsCurrent)
+				DrawIndirect(commandBuffer, drawList.GetCommandBuffer(), drawList.GetCommandOffset(currentBuffer));
+		}
+		else
+		{
+			// Survivors keep stream order, so each draw's visible instances are the next run of them
+			uint32_t cursor = 0;
+			for (uint32_t i = 0; i < drawList.GetDrawCount(); i++)
+			{
+				const VkDrawIndexedIndirectCommand& draw = drawList.GetCommand(i);
+				uint32_t instanceCount = draw.instanceCount, firstInstance = draw.firstInstance;
+				if (cpuCulled)
+				{
+					uint32_t runEnd = meshFirstInstance[i] + lvlData.uniqueMeshes[i].instanceCount;
+					firstInstance = cursor;
+					while (cursor < visibleInstances.size() && visibleInstances[cursor] < runEnd)
+						cursor++;
+					instanceCount = draw.instanceCount > 0 ? cursor - firstInstance : 0;
+				}
+				if (instanceCount > 0)	// not paged in yet, pops in once its upload lands
+					vkCmdDrawIndexed(commandBuffer, draw.indexCount, instanceCount,
+						draw.firstIndex, draw.vertexOffset, firstInstance);
+			}
+		}
+	}
 
-			vkCmdDrawIndexed(commandBuffer, lvlData.uniqueMeshes[i].indexCount, 
-				lvlData.uniqueMeshes[i].instanceCount, lvlData.uniqueMeshes[i].firstIndex, 
-				lvlData.uniqueMeshes[i].vertexOffset, 0);
+	// Moves the instance using transform _index. Its draws and bounds follow on the next Render.
+	void MoveInstance(unsigned int _index, const GW::MATH::GMATRIXF& _world)
+	{
+		transformStore.Set(_index, _world);
+		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
+		{
+			// Submeshes share their model's transforms, so every mesh over _index moves
+			const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[i];
+			if (mesh.indexCount == 0 || _index < mesh.transformOffset || _index >= mesh.transformOffset + mesh.instanceCount)
+				continue;
+			GrowGroupBounds(meshGroups[i], _world);
+			if (!cpuCulling)
+				continue;
+			uint32_t instance = meshFirstInstance[i] + (_index - mesh.transformOffset);
+			GW::MATH::GSPHEREF sphere = InstanceCuller::TransformSphere(_world, mesh.bounds);
+			if (hierarchicalCulling)
+				instanceBVH.SetInstance(instance, sphere);
+			else
+				instanceCuller.SetInstance(instance, sphere);
 		}
 	}
 
@@ -639,109 +874,604 @@ public:
 		
 		// Apply to view matrix
 		matrixProxy.InverseF(camera, view);
+		CarryInstance();
 	}
 
 private:
-	// Loads model + transform level data from gameLevelFile
-	bool GetGameLevelData(std::vector<std::string>& _filenames, std::vector<GW::MATH::GMATRIXF>& _matrices) 
+	// Loads the level file and every model it uses, then merges them into lvlData.
+	// Fills _inputFiles with every file the result depends on.
+	bool LoadLevelData(std::vector<std::string>& _inputFiles)
 	{
-		std::string line;
-		std::ifstream file(levelFilePath, std::ios::in);
+		// Load level data
+		LevelFile::Level level;
+		bool loaded = GetGameLevelData(level);
+		if (!loaded)
+			std::cout << "Level Loading Error: \"" << levelFilePath << "\" did not open properly.\n";
+		_inputFiles.push_back(levelFilePath);
+		_inputFiles.push_back(binaryLevelFilePath);
+		std::vector<unsigned int> levelToMeshId(level.meshNames.size(), UINT_MAX);
+		for (size_t i = 0; i < level.meshIds.size(); i++)
+		{
+			unsigned int& meshId = levelToMeshId[level.meshIds[i]];
+			if (meshId == UINT_MAX)
+				meshId = lvlData.RegisterMesh(level.meshNames[level.meshIds[i]]);
+			lvlData.AddInstance(meshId, level.matrices[i]);
+		}
+		lvlData.CompactInstances();
 
-		// Failed to open
-		if (!file.is_open())
-			return false;
-		
-		// Read file
-		while (std::getline(file, line)) {
-			if (line.compare("MESH") == 0) {
-				// Get name
-				std::getline(file, line);
-				//trim off extra characters
-				auto index = line.find(".");
-				if (index != std::string::npos)
-					line = line.substr(0, index);
-				//push back name
-				_filenames.push_back(line);
-
-				// Get matrix
-				GW::MATH::GMATRIXF m;
-				std::string row1, row2, row3, row4;
-				std::getline(file, row1);
-				std::getline(file, row2);
-				std::getline(file, row3);
-				std::getline(file, row4);
-				//row1
-				std::string sub = row1.substr(row1.find("(") + 1, row1.length() - 1);
-				m.row1.data[0] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row1.data[1] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row1.data[2] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row1.data[3] = std::atof(sub.c_str());
-				//row2
-				sub = row2.substr(row2.find("(") + 1, row2.length() - 1);
-				m.row2.data[0] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row2.data[1] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row2.data[2] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row2.data[3] = std::atof(sub.c_str());
-				//row3
-				sub = row3.substr(row3.find("(") + 1, row3.length() - 1);
-				m.row3.data[0] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row3.data[1] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row3.data[2] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row3.data[3] = std::atof(sub.c_str());
-				//row4
-				sub = row4.substr(row4.find("(") + 1, row4.length() - 1);
-				m.row4.data[0] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row4.data[1] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row4.data[2] = std::atof(sub.c_str());
-				sub = sub.substr(sub.find(",") + 1, sub.length() - 1);
-				m.row4.data[3] = std::atof(sub.c_str());
-				//push back matrix
-				_matrices.push_back(m);
+		// Load model data, mapping every unique mesh's h2b file in parallel
+		size_t uniqueMeshCount = lvlData.uniqueMeshes.size();
+		std::vector<std::string> modelFilePaths(uniqueMeshCount);
+		std::vector<H2B::MappedParser> parsers(uniqueMeshCount);
+		std::vector<char> parsed(uniqueMeshCount, 0);
+		GW::SYSTEM::GConcurrent modelLoader;
+		modelLoader.Create(true);
+		for (size_t uniqueMeshIndex = 0; uniqueMeshIndex < uniqueMeshCount; uniqueMeshIndex++)
+		{
+			modelFilePaths[uniqueMeshIndex] = "../../Assets/Models/" + lvlData.uniqueMeshes[uniqueMeshIndex].name + ".h2b";
+			_inputFiles.push_back(modelFilePaths[uniqueMeshIndex]);
+			modelLoader.BranchSingular([&, uniqueMeshIndex]() {
+				parsed[uniqueMeshIndex] = parsers[uniqueMeshIndex].Parse(modelFilePaths[uniqueMeshIndex].c_str());
+			});
+		}
+		modelLoader.Converge(0);
+
+		// Size the level buffers once now that every file's counts are known
+		size_t totalVertices = 0, totalIndices = 0, totalMaterials = 0;
+		for (size_t i = 0; i < uniqueMeshCount; i++)
+		{
+			totalVertices += parsers[i].vertexCount;
+			totalIndices += parsers[i].indexCount;
+			totalMaterials += (parsers[i].meshCount > 1) ? parsers[i].meshCount : 1;
+		}
+		lvlData.vertices.reserve(totalVertices);
+		lvlData.indices.reserve(totalIndices);
+		lvlData.materials.reserve(totalMaterials);
+
+		// Merge in unique mesh order so the result does not depend on thread timing
+		std::vector<H2B::VERTEX> weldedVertices;
+		std::vector<unsigned> weldRemap;
+		size_t weldBytesSaved = 0;
+		MeshOptimizer::VertexCacheStats statsBefore, statsAfter;
+		size_t optimizedTriangles = 0;
+		for (size_t uniqueMeshIndex = 0; uniqueMeshIndex < uniqueMeshCount; uniqueMeshIndex++)
+		{
+			const H2B::MappedParser& parser = parsers[uniqueMeshIndex];
+			if (!parsed[uniqueMeshIndex]) {
+				// A missing model keeps its slot but draws nothing
+				std::cout << "Model Loading Error: \"" << modelFilePaths[uniqueMeshIndex] << "\" did not open properly.\n";
+				loaded = false;
+				LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[uniqueMeshIndex];
+				mesh.indexCount = 0;
+				mesh.firstIndex = static_cast<unsigned int>(lvlData.indices.size());
+				mesh.vertexOffset = static_cast<unsigned int>(lvlData.vertices.size());
+				mesh.materialIndex = 0;
+				continue;
+			}
+
+			// Optionally weld the model's vertices, its indices are remapped as they are copied
+			const H2B::VERTEX* vertices = parser.vertices.begin();
+			size_t vertexCount = parser.vertexCount;
+			weldRemap.clear();
+			if (loadOptions & WELD_VERTICES)
+			{
+				MeshOptimizer::WeldVertices(vertices, parser.vertexCount, weldedVertices, weldRemap);
+				size_t bytesSaved = (vertexCount - weldedVertices.size()) * sizeof(H2B::VERTEX);
+				if (bytesSaved > 0)
+					std::cout << "Welded \"" << modelFilePaths[uniqueMeshIndex] << "\": " << vertexCount << " -> "
+						<< weldedVertices.size() << " vertices, " << bytesSaved << " bytes saved\n";
+				weldBytesSaved += bytesSaved;
+				vertices = weldedVertices.data();
+				vertexCount = weldedVertices.size();
+			}
+
+			// Copy data over straight from the mapped file
+			size_t modelVertexStart = lvlData.vertices.size();
+			size_t modelIndexStart = lvlData.indices.size();
+			size_t modelExtraMeshStart = lvlData.uniqueMeshes.size();
+			bool indicesValid = true;
+			if (parser.meshCount > 1) //group by material if submeshes exist
+			{
+				//push back submeshes, starting at submesh 2
+				for (size_t submeshIndex = 1; submeshIndex < parser.meshCount; submeshIndex++)
+				{
+					unsigned int submeshId = lvlData.RegisterMesh(lvlData.uniqueMeshes[uniqueMeshIndex].name + "_submesh" + std::to_string(submeshIndex + 1));
+					LevelData::UniqueMesh& submesh = lvlData.uniqueMeshes[submeshId];
+					submesh.instanceCount = lvlData.uniqueMeshes[uniqueMeshIndex].instanceCount;
+					submesh.transformOffset = lvlData.uniqueMeshes[uniqueMeshIndex].transformOffset;
+					submesh.indexCount = parser.meshes[submeshIndex].drawInfo.indexCount;
+					submesh.firstIndex = lvlData.indices.size();
+					submesh.vertexOffset = lvlData.vertices.size();
+					submesh.materialIndex = lvlData.materials.size();
+
+					//push back indices per submesh
+					const unsigned* start = parser.indices.begin() + parser.meshes[submeshIndex].drawInfo.indexOffset;
+					indicesValid &= MeshOptimizer::AppendIndices(start, parser.meshes[submeshIndex].drawInfo.indexCount, parser.vertexCount, weldRemap, lvlData.indices);
+				
+					//push back material per submesh
+					int matIndex = parser.meshes[submeshIndex].materialIndex;
+					lvlData.materials.push_back(parser.materials[matIndex].attrib);
+				}
+
+				//then write the first submesh data to the original unique mesh spot
+				lvlData.RenameMesh(static_cast<unsigned int>(uniqueMeshIndex), lvlData.uniqueMeshes[uniqueMeshIndex].name + "_submesh1");
+				lvlData.uniqueMeshes[uniqueMeshIndex].indexCount = parser.meshes[0].drawInfo.indexCount;
+				lvlData.uniqueMeshes[uniqueMeshIndex].firstIndex = lvlData.indices.size();
+				lvlData.uniqueMeshes[uniqueMeshIndex].vertexOffset = lvlData.vertices.size();
+				lvlData.uniqueMeshes[uniqueMeshIndex].materialIndex = lvlData.materials.size();
+			
+				//push back indices for first submesh
+				const unsigned* start = parser.indices.begin() + parser.meshes[0].drawInfo.indexOffset;
+				indicesValid &= MeshOptimizer::AppendIndices(start, parser.meshes[0].drawInfo.indexCount, parser.vertexCount, weldRemap, lvlData.indices);
+			
+				//push back material per submesh
+				int matIndex = parser.meshes[0].materialIndex;
+				lvlData.materials.push_back(parser.materials[matIndex].attrib);
+
+				// Push back all vertices
+				lvlData.vertices.insert(lvlData.vertices.end(), vertices, vertices + vertexCount);
+			}
+			else //otherwise load data into existing unique mesh
+			{
+				lvlData.uniqueMeshes[uniqueMeshIndex].indexCount = parser.indexCount;
+				lvlData.uniqueMeshes[uniqueMeshIndex].firstIndex = lvlData.indices.size();
+				lvlData.uniqueMeshes[uniqueMeshIndex].vertexOffset = lvlData.vertices.size();
+				lvlData.uniqueMeshes[uniqueMeshIndex].materialIndex = lvlData.materials.size();
+				lvlData.vertices.insert(lvlData.vertices.end(), vertices, vertices + vertexCount);
+				indicesValid = MeshOptimizer::AppendIndices(parser.indices.begin(), parser.indexCount, parser.vertexCount, weldRemap, lvlData.indices);
+				lvlData.materials.push_back(parser.materials[0].attrib);
+			}
+
+			// A corrupt model keeps its slots but draws nothing
+			if (!indicesValid)
+			{
+				std::cout << "Model Loading Error: \"" << modelFilePaths[uniqueMeshIndex] << "\" has an index past its vertices.\n";
+				loaded = false;
+				lvlData.indices.resize(modelIndexStart);
+				for (size_t meshIndex = modelExtraMeshStart; meshIndex <= lvlData.uniqueMeshes.size(); meshIndex++)
+				{
+					LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[(meshIndex == lvlData.uniqueMeshes.size()) ? uniqueMeshIndex : meshIndex];
+					mesh.firstIndex = static_cast<unsigned int>(modelIndexStart);
+					mesh.indexCount = 0;
+				}
+				continue;
+			}
+
+			// Optimize each submesh's triangle order, then the model's vertex order
+			if (loadOptions & OPTIMIZE_MESHES)
+			{
+				H2B::VERTEX* modelVertices = lvlData.vertices.data() + modelVertexStart;
+				unsigned modelVertexCount = static_cast<unsigned>(lvlData.vertices.size() - modelVertexStart);
+				unsigned* modelIndices = lvlData.indices.data() + modelIndexStart;
+				size_t modelIndexCount = lvlData.indices.size() - modelIndexStart;
+				MeshOptimizer::VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(modelIndices, modelIndexCount, modelVertexCount);
+				for (size_t meshIndex = modelExtraMeshStart; meshIndex <= lvlData.uniqueMeshes.size(); meshIndex++)
+				{
+					// the model's first submesh lives in its original slot, the rest were appended
+					const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[(meshIndex == lvlData.uniqueMeshes.size()) ? uniqueMeshIndex : meshIndex];
+					unsigned* meshIndices = lvlData.indices.data() + mesh.firstIndex;
+					MeshOptimizer::OptimizeVertexCache(meshIndices, mesh.indexCount, modelVertexCount);
+					MeshOptimizer::OptimizeOverdraw(meshIndices, mesh.indexCount, modelVertices, modelVertexCount);
+				}
+				unsigned usedVertexCount = MeshOptimizer::OptimizeVertexFetch(modelIndices, modelIndexCount, modelVertices, modelVertexCount);
+				lvlData.vertices.resize(modelVertexStart + usedVertexCount);
+				MeshOptimizer::VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(modelIndices, modelIndexCount, usedVertexCount);
+				std::cout << "Optimized \"" << modelFilePaths[uniqueMeshIndex] << "\": ACMR " << before.acmr << " -> " << after.acmr
+					<< ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+
+				// Triangle weighted totals for the summary line
+				size_t triangles = modelIndexCount / 3;
+				statsBefore.acmr += before.acmr * triangles;
+				statsAfter.acmr += after.acmr * triangles;
+				statsBefore.atvr += before.atvr * triangles;
+				statsAfter.atvr += after.atvr * triangles;
+				optimizedTriangles += triangles;
 			}
 		}
-		file.close();
-		_filenames.shrink_to_fit();
-		_matrices.shrink_to_fit();
+		if (loadOptions & WELD_VERTICES)
+			std::cout << "Vertex welding saved " << weldBytesSaved << " bytes\n";
+		if (optimizedTriangles > 0)
+			std::cout << "Mesh optimization: ACMR " << statsBefore.acmr / optimizedTriangles << " -> " << statsAfter.acmr / optimizedTriangles
+				<< ", ATVR " << statsBefore.atvr / optimizedTriangles << " -> " << statsAfter.atvr / optimizedTriangles << "\n";
+		parsers.clear(); // release the mappings
+		lvlData.ComputeMeshBounds();
+		return loaded;
+	}
 
-		// Sort by filename, sorry.
-		SortByNameWithMatrix(_filenames, _matrices);
+	// Sorted distinct mesh vertexOffsets, one per model, followed by the vertex count.
+	// Models without vertices share the final start with the end.
+	std::vector<unsigned int> VertexRangeStarts() const
+	{
+		std::vector<unsigned int> rangeStarts;
+		rangeStarts.reserve(lvlData.uniqueMeshes.size() + 1);
+		for (const LevelData::UniqueMesh& mesh : lvlData.uniqueMeshes)
+			rangeStarts.push_back(mesh.vertexOffset);
+		std::sort(rangeStarts.begin(), rangeStarts.end());
+		rangeStarts.erase(std::unique(rangeStarts.begin(), rangeStarts.end()), rangeStarts.end());
+		rangeStarts.push_back(static_cast<unsigned int>(scene.vertexCount));
+		return rangeStarts;
+	}
 
-		// File read successfully
-		return true;
+	// One geometry pool group per model: its vertex range plus the index range its submeshes
+	// were appended into. Also fills meshGroups, groupRadius and groupBounds.
+	std::vector<GeometryPool::Group> BuildGeometryGroups()
+	{
+		// Every group is built from its meshes' ranges, so a mesh outside the level geometry
+		// would size the staging ring and arenas from garbage. Such a mesh draws nothing.
+		for (LevelData::UniqueMesh& mesh : lvlData.uniqueMeshes)
+		{
+			if (mesh.vertexOffset <= scene.vertexCount && uint64_t(mesh.firstIndex) + mesh.indexCount <= scene.indexCount)
+				continue;
+			std::cout << "Geometry Pool Error: \"" << mesh.name << "\" lies outside the level geometry, it will not be drawn.\n";
+			mesh.indexCount = 0;
+			mesh.firstIndex = 0;
+			mesh.vertexOffset = static_cast<unsigned int>(scene.vertexCount);
+		}
+		std::vector<unsigned int> rangeStarts = VertexRangeStarts();
+		std::vector<GeometryPool::Group> groups(rangeStarts.size() - 1, { 0, 0, UINT_MAX, 0 });
+		meshGroups.resize(lvlData.uniqueMeshes.size());
+		groupRadius.assign(groups.size(), 0.0f);
+		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
+		{
+			const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[i];
+			uint32_t group = static_cast<uint32_t>(std::lower_bound(rangeStarts.begin(), rangeStarts.end(), mesh.vertexOffset) - rangeStarts.begin());
+			meshGroups[i] = group;
+			if (mesh.indexCount == 0)
+				continue;
+			GeometryPool::Group& range = groups[group];
+			uint32_t indexEnd = std::max(range.indexStart == UINT_MAX ? 0 : range.indexStart + range.indexCount, mesh.firstIndex + mesh.indexCount);
+			range.indexStart = std::min(range.indexStart, mesh.firstIndex);
+			range.indexCount = indexEnd - range.indexStart;
+			const GW::MATH::GSPHEREF& bounds = mesh.bounds;
+			float reach = std::sqrt(bounds.x * bounds.x + bounds.y * bounds.y + bounds.z * bounds.z) + bounds.radius;
+			groupRadius[group] = std::max(groupRadius[group], reach);
+		}
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			groups[g].vertexStart = rangeStarts[g];
+			groups[g].vertexCount = rangeStarts[g + 1] - rangeStarts[g];
+			if (groups[g].indexStart == UINT_MAX)
+				groups[g].indexStart = 0;
+		}
+
+		// Streaming distances are measured to a box around every instance of a group
+		groupBounds.assign(groups.size(), { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } });
+		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
+		{
+			const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[i];
+			if (mesh.indexCount > 0)
+				for (unsigned int t = mesh.transformOffset; t < mesh.transformOffset + mesh.instanceCount; t++)
+					GrowGroupBounds(meshGroups[i], scene.transforms[t]);
+		}
+		return groups;
 	}
 
-	// Terrible terrible terrible solution to a problem that I don't have time to fix over in LevelData.h
-	void SortByNameWithMatrix(std::vector<std::string>& _filenames, std::vector<GW::MATH::GMATRIXF>& _matrices) 
+	// Widens _group's streaming box to take in an instance placed at _world
+	void GrowGroupBounds(uint32_t _group, const GW::MATH::GMATRIXF& _world)
 	{
-		std::vector<GW::MATH::GMATRIXF> mats;
-		
-		std::vector<std::pair<std::string, int>> pairs;
-		for (int i = 0; i < _filenames.size(); i++)
+		float scale = 0.0f;
+		for (int row = 0; row < 3; row++)
+			scale = std::max(scale, _world.data[row * 4] * _world.data[row * 4] + _world.data[row * 4 + 1] * _world.data[row * 4 + 1] +
+				_world.data[row * 4 + 2] * _world.data[row * 4 + 2]);
+		float radius = groupRadius[_group] * std::sqrt(scale);
+		const float* center = &_world.row4.x;
+		GroupBounds& bounds = groupBounds[_group];
+		for (int axis = 0; axis < 3; axis++)
 		{
-			std::pair<std::string, int> pair = { _filenames[i], i };
-			pairs.push_back(pair);
+			bounds.min[axis] = std::min(bounds.min[axis], center[axis] - radius);
+			bounds.max[axis] = std::max(bounds.max[axis], center[axis] + radius);
+		}
+	}
 
-			mats.push_back(_matrices[i]);
+	// Requests every group whose instances come within streamRadius, nearest first, and
+	// lets the pool start this frame's uploads
+	void StreamGeometry()
+	{
+		geometryPool.BeginFrame();
+		const float* eye = &camera.row4.x;
+		for (uint32_t g = 0; g < groupBounds.size(); g++)
+		{
+			const GroupBounds& bounds = groupBounds[g];
+			if (bounds.min[0] > bounds.max[0])
+				continue;	// no instances
+			float distanceSquared = 0.0f;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float outside = std::max(std::max(bounds.min[axis] - eye[axis], eye[axis] - bounds.max[axis]), 0.0f);
+				distanceSquared += outside * outside;
+			}
+			float distance = std::sqrt(distanceSquared);
+			if (distance <= streamRadius)
+				geometryPool.Request(g, distance);
 		}
-		std::sort(pairs.begin(), pairs.end());
-		
-		for (size_t i = 0; i < _filenames.size(); i++)
+		geometryPool.Update();
+	}
+
+	// One draw per unique mesh, what the shaders look up by draw index
+	std::vector<DrawList::DrawData> BuildDrawData() const
+	{
+		std::vector<DrawList::DrawData> draws(lvlData.uniqueMeshes.size());
+		for (size_t i = 0; i < draws.size(); i++)
+		{
+			DrawList::DrawData& draw = draws[i];
+			draw = {};
+			draw.transformOffset = lvlData.uniqueMeshes[i].transformOffset;
+			draw.materialIndex = lvlData.uniqueMeshes[i].materialIndex;
+			draw.quantScale[0] = draw.quantScale[1] = draw.quantScale[2] = 1.0f;
+			const GW::MATH::GSPHEREF& bounds = lvlData.uniqueMeshes[i].bounds;
+			std::copy(&bounds.x, &bounds.x + 4, draw.bounds);
+			if (packedVertices)
+			{
+				const MeshOptimizer::QuantizationParams& quant = meshQuantization[i];
+				std::copy(quant.offset, quant.offset + 3, draw.quantOffset);
+				std::copy(quant.scale, quant.scale + 3, draw.quantScale);
+			}
+		}
+		return draws;
+	}
+
+	// Every draw's instances back to back. Submeshes of one model share its transforms,
+	// so each draw gets its own run. Also fills meshFirstInstance.
+	std::vector<DrawList::InstanceData> BuildInstanceStream()
+	{
+		std::vector<DrawList::InstanceData> instances;
+		meshFirstInstance.resize(lvlData.uniqueMeshes.size());
+		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
 		{
-			_filenames[i] = pairs[i].first;
-			_matrices[i] = mats[pairs[i].second];
+			const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[i];
+			meshFirstInstance[i] = static_cast<uint32_t>(instances.size());
+			for (unsigned int t = mesh.transformOffset; t < mesh.transformOffset + mesh.instanceCount; t++)
+				instances.push_back({ t, static_cast<uint32_t>(i) });
 		}
+		return instances;
+	}
+
+	// Points every draw at where its geometry sits in the pool, draws that are not
+	// resident get no instances
+	void UpdateDrawCommands()
+	{
+		for (uint32_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
+		{
+			const LevelData::UniqueMesh& mesh = lvlData.uniqueMeshes[i];
+			uint32_t group = meshGroups[i];
+			VkDrawIndexedIndirectCommand command = { mesh.indexCount, 0, 0, 0, meshFirstInstance[i] };
+			if (geometryPool.IsResident(group))
+			{
+				command.instanceCount = mesh.instanceCount;
+				command.firstIndex = geometryPool.GetFirstIndex(group, mesh.firstIndex);
+				command.vertexOffset = static_cast<int32_t>(geometryPool.GetVertexOffset(group));
+			}
+			drawList.SetCommand(i, command);
+		}
+		drawListResidency = geometryPool.GetResidencyVersion();
+	}
+
+	// Builds the packed vertex stream. Submeshes of one model share its vertices, so
+	// each distinct vertex range is quantized once and its params shared by its meshes.
+	void PackVertices(std::vector<MeshOptimizer::PACKED_VERTEX>& _packed)
+	{
+		std::vector<unsigned int> rangeStarts = VertexRangeStarts();
+
+		std::vector<MeshOptimizer::QuantizationParams> rangeParams(rangeStarts.size() - 1);
+		_packed.reserve(scene.vertexCount);
+		_packed.assign(rangeStarts[0], MeshOptimizer::PACKED_VERTEX{});
+		for (size_t i = 0; i + 1 < rangeStarts.size(); i++)
+		{
+			const H2B::VERTEX* first = scene.vertices + rangeStarts[i];
+			size_t count = rangeStarts[i + 1] - rangeStarts[i];
+			rangeParams[i] = MeshOptimizer::ComputeQuantization(first, count);
+			MeshOptimizer::PackVertices(first, count, rangeParams[i], _packed);
+		}
+
+		meshQuantization.resize(lvlData.uniqueMeshes.size());
+		for (size_t i = 0; i < lvlData.uniqueMeshes.size(); i++)
+		{
+			size_t range = std::lower_bound(rangeStarts.begin(), rangeStarts.end(), lvlData.uniqueMeshes[i].vertexOffset) - rangeStarts.begin();
+			if (range < rangeParams.size()) // empty models sit at the very end
+				meshQuantization[i] = rangeParams[range];
+		}
+	}
+
+	// Loads model + transform level data, preferring the compiled level when it is up to date
+	bool GetGameLevelData(LevelFile::Level& _level) 
+	{
+		std::error_code error;
+		bool binaryIsCurrent = std::filesystem::exists(binaryLevelFilePath, error) &&
+			!(std::filesystem::last_write_time(levelFilePath, error) > std::filesystem::last_write_time(binaryLevelFilePath, error));
+		if (binaryIsCurrent && LevelFile::ReadBinary(binaryLevelFilePath.c_str(), _level))
+			return true;
+
+		// Fall back to the exporter's text format
+		return LevelFile::ReadText(levelFilePath.c_str(), _level);
+	}
+
+	// Creates _module from the shader cache. A miss is compiled and written back when the
+	// runtime compiler is built in, otherwise the ShaderCompiler tool has to run first.
+	bool LoadShader(const char* _name, const char* _source, ShaderCache::Stage _stage, const ShaderCache::Options& _options,
+		VkShaderModule* _module, const char* _entryPoint = "main")
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t key = ShaderCache::Key(_source, _stage, _options, _entryPoint);
+		std::vector<uint32_t> code;
+		bool cached = ShaderCache::Read(shaderCacheDirectory, key, code);
+		if (!cached)
+		{
+#ifdef ENABLE_SHADERC
+			std::string errors;
+			if (!ShaderCache::Compile(_source, _stage, _options, code, errors, _entryPoint)) {
+				std::cout << _name << " Shader Errors: " << errors << std::endl;
+				return false;
+			}
+			if (!ShaderCache::Write(shaderCacheDirectory, key, code))
+				std::cout << "Shader Cache Error: \"" << ShaderCache::FilePath(shaderCacheDirectory, key) << "\" could not be written.\n";
+#else
+			std::cout << _name << " Shader Error: \"" << ShaderCache::FilePath(shaderCacheDirectory, key)
+				<< "\" is missing, build the CompileShaders target.\n";
+			return false;
+#endif
+		}
+		if (GvkHelper::create_shader_module(device, code.size() * sizeof(uint32_t), reinterpret_cast<char*>(code.data()), _module) != VK_SUCCESS) {
+			std::cout << _name << " Shader Error: module could not be created.\n";
+			*_module = nullptr;
+			return false;
+		}
+		std::chrono::duration<float, std::milli> loadTime = std::chrono::steady_clock::now() - start;
+		std::cout << _name << " shader " << (cached ? "loaded from cache" : "compiled") << " in " << loadTime.count() << " ms\n";
+		return true;
+	}
+
+	// Full allocator report when M is pressed, a summary line every memoryLogSeconds
+	void ReportMemory()
+	{
+		float memoryKey = 0;
+		inputProxy.GetState(G_KEY_M, memoryKey);
+		if (memoryKey > 0 && !memoryReportKeyDown)
+			allocator.PrintStats();
+		memoryReportKeyDown = memoryKey > 0;
+
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<float> sinceLog = now - lastMemoryLog;
+		if (memoryLogSeconds > 0 && sinceLog.count() >= memoryLogSeconds) {
+			allocator.LogSummary();
+			geometryPool.ReportStats("Geometry pool");
+			if (frustumCulling)
+				frustumCuller.ReportStats(occlusionCulling ? "Frustum and occlusion culling" : "Frustum culling");
+			if (cpuCulling)
+				ReportCpuCulling();
+			lastMemoryLog = now;
+		}
+	}
+
+	// While G is held the transform nearest the camera keeps its place relative to it
+	void CarryInstance()
+	{
+		float carryKey = 0;
+		inputProxy.GetState(G_KEY_G, carryKey);
+		if (carryKey <= 0 || transformStore.GetCount() == 0) {
+			carriedTransform = UINT_MAX;
+			return;
+		}
+		if (carriedTransform == UINT_MAX) {
+			float nearest = FLT_MAX;
+			for (uint32_t i = 0; i < transformStore.GetCount(); i++) {
+				const GW::MATH::GVECTORF& position = transformStore.Get(i).row4;
+				float dx = position.x - camera.row4.x, dy = position.y - camera.row4.y, dz = position.z - camera.row4.z;
+				float distance = dx * dx + dy * dy + dz * dz;
+				if (distance < nearest) {
+					nearest = distance;
+					carriedTransform = i;
+				}
+			}
+			GW::MATH::GMATRIXF inverseCamera;
+			matrixProxy.InverseF(camera, inverseCamera);
+			matrixProxy.MultiplyMatrixF(transformStore.Get(carriedTransform), inverseCamera, carriedOffset);
+		}
+		GW::MATH::GMATRIXF world;
+		matrixProxy.MultiplyMatrixF(carriedOffset, camera, world);
+		MoveInstance(carriedTransform, world);
+	}
+
+	// Hands empty allocator blocks back to the driver once device memory nears its budget
+	void TrimMemory()
+	{
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<float> sinceCheck = now - lastBudgetCheck;
+		if (sinceCheck.count() < budgetCheckSeconds)
+			return;
+		lastBudgetCheck = now;
+		if (!allocator.OverBudget(budgetPressure))
+			return;
+		VkDeviceSize released = allocator.Trim();
+		if (released > 0)
+			std::cout << "Memory pressure: released " << released / 1024 << " KB of empty blocks\n";
+	}
+
+	// Binds the geometry, _instances at _instanceOffset as the instance stream and both descriptor sets
+	void BindScene(VkCommandBuffer _commandBuffer, VkBuffer _instances, VkDeviceSize _instanceOffset, const uint32_t _dynamicOffsets[2])
+	{
+		VkDeviceSize offsets[] = { 0, _instanceOffset };
+		VkBuffer vertexBuffers[2] = { geometryPool.GetVertexBuffer(), _instances };
+		vkCmdBindVertexBuffers(_commandBuffer, 0, 2, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(_commandBuffer, geometryPool.GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		VkDescriptorSet descriptorSets[2] = { staticDescriptorSet, frameDescriptorSet };
+		vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			pipelineLayout, 0, 2, descriptorSets, 2, _dynamicOffsets);
+	}
+
+	// The whole scene in one call, split only if the device caps the draw count
+	void DrawIndirect(VkCommandBuffer _commandBuffer, VkBuffer _commands, VkDeviceSize _commandOffset)
+	{
+		uint32_t drawCount = drawList.GetDrawCount();
+		for (uint32_t first = 0; first < drawCount; first += maxDrawIndirectCount)
+		{
+			uint32_t count = std::min(maxDrawIndirectCount, drawCount - first);
+			vkCmdDrawIndexedIndirect(_commandBuffer, _commands,
+				_commandOffset + VkDeviceSize(first) * sizeof(VkDrawIndexedIndirectCommand), count, sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
+
+	// Draws what the first culling phase kept into the depth pass, reduces it into the
+	// pyramid and records the second phase against it. The frame's draws get both phases.
+	void RecordOcclusion(unsigned int _frame, VkCommandBuffer _prepass, const uint32_t _dynamicOffsets[2])
+	{
+		depthPyramid.BeginDepthPass(_prepass);
+		if (depthPipeline != nullptr)
+		{
+			vkCmdBindPipeline(_prepass, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipeline);
+			BindScene(_prepass, frustumCuller.GetInstanceBuffer(), frustumCuller.GetInstanceOffset(_frame), _dynamicOffsets);
+			DrawIndirect(_prepass, frustumCuller.GetCommandBuffer(), frustumCuller.GetCommandOffset(_frame));
+		}
+		depthPyramid.EndDepthPass(_prepass);
+		depthPyramid.RecordReduce(_prepass);
+		frustumCuller.RecordLate(_frame, _prepass);
+	}
+
+	// Drops the culling pre-pass for good and frees what it held, the draw list is drawn as is from then on.
+	// The culler's pipeline was made for occlusion, so it cannot carry on without the pyramid.
+	void DisableGpuCulling()
+	{
+		vkDeviceWaitIdle(device);
+		frustumCuller.Destroy();
+		depthPyramid.Destroy();
+		vkDestroyPipeline(device, depthPipeline, nullptr);
+		depthPipeline = nullptr;
+		frustumCulling = false;
+		occlusionCulling = false;
+		allocator.Trim();
+	}
+
+	void ReportCpuCulling() const
+	{
+		if (hierarchicalCulling)
+			instanceBVH.ReportStats("CPU frustum culling (BVH)");
+		else
+			instanceCuller.ReportStats("CPU frustum culling");
+	}
+
+	// Starts recording _frame's pre-pass. Its last submission went out ahead of the same
+	// frame's draws, which StartFrame already waited on, so the fence is signaled.
+	VkCommandBuffer BeginPrepass(unsigned int _frame)
+	{
+		vkWaitForFences(device, 1, &prepassFences[_frame], VK_TRUE, UINT64_MAX);
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(prepassCommands[_frame], &begin_info);
+		return prepassCommands[_frame];
+	}
+
+	// Submits _frame's pre-pass ahead of the draws EndFrame submits, if anything was recorded
+	void SubmitPrepass(unsigned int _frame, bool _recorded)
+	{
+		vkEndCommandBuffer(prepassCommands[_frame]);
+		if (!_recorded)
+			return;
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &prepassCommands[_frame];
+		vkResetFences(device, 1, &prepassFences[_frame]);
+		vkQueueSubmit(graphicsQueue, 1, &submit_info, prepassFences[_frame]);
 	}
 
 	void CleanUp()
@@ -751,34 +1481,43 @@ private:
 		// Clean up shaders
 		vkDestroyShaderModule(device, vertexShader, nullptr);
 		vkDestroyShaderModule(device, pixelShader, nullptr);
+		vkDestroyShaderModule(device, cullShader, nullptr);
+		vkDestroyShaderModule(device, depthReduceShader, nullptr);
 		
 		// Clean up buffers
-		vkDestroyBuffer(device, vertexHandle, nullptr);
-		vkFreeMemory(device, vertexData, nullptr);
-		vkDestroyBuffer(device, indexHandle, nullptr);
-		vkFreeMemory(device, indexData, nullptr);
-		for (size_t i = 0; i < max_frames; i++)
-		{
-			vkDestroyBuffer(device, transformsBuffer[i], nullptr);
-			vkDestroyBuffer(device, materialsBuffer[i], nullptr);
-			vkDestroyBuffer(device, sceneDataBuffer[i], nullptr);
-			vkFreeMemory(device, transformsData[i], nullptr);
-			vkFreeMemory(device, materialsData[i], nullptr);
-			vkFreeMemory(device, sceneDataData[i], nullptr);
-		}
-		transformsBuffer.clear();
-		materialsBuffer.clear();
-		sceneDataBuffer.clear();
-		transformsData.clear();
-		materialsData.clear();
-		sceneDataData.clear();
+		uploader.Destroy();
+		geometryPool.ReportStats("Geometry pool");
+		geometryPool.Destroy();
+		transformStore.ReportStats("Transforms");
+		transformStore.Destroy();
+		drawList.ReportStats("Draw list");
+		drawList.Destroy();
+		if (frustumCulling)
+			frustumCuller.ReportStats(occlusionCulling ? "Frustum and occlusion culling" : "Frustum culling");
+		frustumCuller.Destroy();
+		depthPyramid.Destroy();
+		if (cpuCulling)
+			ReportCpuCulling();
+		allocator.DestroyBuffer(materialsBuffer, materialsData);
+		frameRing.Destroy();
+		allocator.Destroy();	// releases the blocks, after every resource is gone
+
+		// Clean up pre-pass
+		for (VkFence fence : prepassFences)
+			vkDestroyFence(device, fence, nullptr);
+		vkDestroyCommandPool(device, prepassPool, nullptr);
 
 		// Clean up layouts and pools
-		vkDestroyDescriptorSetLayout(device, storageBuffersDescriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, staticDescriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, frameDescriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 
 		// Clean up pipeline
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipeline(device, depthPipeline, nullptr);
+		if (!pipelineCache.Save())
+			std::cout << "Pipeline Cache Error: \"" << pipelineCacheFilePath << "\" could not be written.\n";
+		pipelineCache.Destroy();
 	}
 };
\ No newline at end of file
@@ -18,11 +18,11 @@ namespace Shaders
         float3 Ke;          // emissive reflectivity
         int illum;          // illumination model
     };
-    [[vk::binding(1, 0)]]
+    [[vk::binding(0, 0)]]
     StructuredBuffer<MAT_ATTRIBUTES> materials; //indexing offsets by the size of the templated type
 
-    [[vk::binding(0, 0)]]
-    StructuredBuffer<matrix> transforms; //indexing offsets by the size of the templated type
+    [[vk::binding(1, 1)]]
+    StructuredBuffer<matrix> transforms; //this frame's slice, picked by dynamic offset
 
     struct SCENE_DATA
     {
@@ -32,23 +32,48 @@ namespace Shaders
         float4 ambientTerm;
         float4 cameraPosition;
     };
-    [[vk::binding(2, 0)]]
-    StructuredBuffer<SCENE_DATA> sceneData;
+    [[vk::binding(0, 1)]]
+    StructuredBuffer<SCENE_DATA> sceneData; //set 1 changes every frame, set 0 is static
 
-    [[vk::push_constant]]
-    cbuffer INSTANCE_DATA
+    struct DRAW_DATA
     {
-        int transformOffset;
-        int materialIndex;
+        uint transformOffset;
+        uint materialIndex;
+        uint2 padding;
+        float4 quantOffset;     // packed positions: pos = unorm * quantScale + quantOffset
+        float4 quantScale;
+        float4 bounds;          // model space bounding sphere, read by the cull shader
     };
+    [[vk::binding(1, 0)]]
+    StructuredBuffer<DRAW_DATA> drawData; //one per draw, indexed by the instance stream
 
 
+#ifdef PACKED_VERTICES
+    struct VERTEX_IN
+    {
+        float4 pos : POSITION;  // R16G16B16A16_UNORM
+        float2 uv : TEXCOORD;   // R16G16_SFLOAT
+        float2 nrm : NORMAL;    // R16G16_SNORM octahedral
+        uint2 instance : INSTANCE;  // binding 1: transform index, draw index
+    };
+
+    float3 OctDecode(float2 e)
+    {
+        float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+        float t = saturate(-n.z);
+        n.x += (n.x >= 0.0f) ? -t : t;
+        n.y += (n.y >= 0.0f) ? -t : t;
+        return normalize(n);
+    }
+#else
     struct VERTEX_IN
     {
         float3 pos : POSITION;
         float3 uvw;
         float3 nrm : NORMAL;
+        uint2 instance : INSTANCE;  // binding 1: transform index, draw index
     };
+#endif
 
     struct VERTEX_OUT
     {
@@ -56,17 +81,28 @@ namespace Shaders
         float3 nrmW : NORMAL;
         float3 posW : WORLD;
         float2 uv : TEXCOORD;
+        nointerpolation uint materialIndex : MATERIAL;
     };
 
-    VERTEX_OUT main(VERTEX_IN input, int instanceId : SV_InstanceID) : SV_POSITION
+    VERTEX_OUT main(VERTEX_IN input) : SV_POSITION
     {
         VERTEX_OUT result;
     
-        matrix world = transforms[transformOffset + instanceId];
-        result.posW = mul(float4(input.pos, 1), world);
-        result.posH = mul(float4(result.posW, 1), sceneData[0].viewProjection);
-        result.nrmW = mul(float4(input.nrm, 0), world);
+        matrix world = transforms[input.instance.x];
+        DRAW_DATA draw = drawData[input.instance.y];
+        result.materialIndex = draw.materialIndex;
+#ifdef PACKED_VERTICES
+        float3 pos = input.pos.xyz * draw.quantScale.xyz + draw.quantOffset.xyz;
+        float3 nrm = OctDecode(input.nrm);
+        result.uv = input.uv;
+#else
+        float3 pos = input.pos;
+        float3 nrm = input.nrm;
         result.uv = float2(input.uvw[0], input.uvw[1]);
+#endif
+        result.posW = mul(float4(pos, 1), world);
+        result.posH = mul(float4(result.posW, 1), sceneData[0].viewProjection);
+        result.nrmW = mul(float4(nrm, 0), world);
     
 	    return result;
     }
@@ -88,11 +124,11 @@ namespace Shaders
         float3 Ke;          // emissive reflectivity
         int illum;          // illumination model
     };
-    [[vk::binding(1, 0)]]
+    [[vk::binding(0, 0)]]
     StructuredBuffer<MAT_ATTRIBUTES> materials; //indexing offsets by the size of the templated type
     
-    [[vk::binding(0, 0)]]
-    StructuredBuffer<matrix> transforms; //indexing offsets by the size of the templated type
+    [[vk::binding(1, 1)]]
+    StructuredBuffer<matrix> transforms; //this frame's slice, picked by dynamic offset
     
     struct SCENE_DATA
     {
@@ -102,15 +138,8 @@ namespace Shaders
         float4 ambientTerm;
         float4 cameraPosition;
     };
-    [[vk::binding(2, 0)]]
-    StructuredBuffer<SCENE_DATA> sceneData;
-    
-    [[vk::push_constant]]
-    cbuffer INSTANCE_DATA
-    {
-        int transformOffset;
-        int materialIndex;
-    };
+    [[vk::binding(0, 1)]]
+    StructuredBuffer<SCENE_DATA> sceneData; //set 1 changes every frame, set 0 is static
     
     struct VERTEX_IN
     {
@@ -118,6 +147,7 @@ namespace Shaders
         float3 nrmW : NORMAL;
         float3 posW : WORLD;
         float2 uv : TEXCOORD;
+        nointerpolation uint materialIndex : MATERIAL;
     };
     
     float4 main(VERTEX_IN input) : SV_TARGET
@@ -128,7 +158,7 @@ namespace Shaders
         // TODO: Part 4c
         finalColor = saturate(dot(-sceneData[0].lightDirection, float4(input.nrmW, 0)));
         finalColor = saturate(finalColor + sceneData[0].ambientTerm);
-        finalColor *= sceneData[0].lightColor * float4(materials[materialIndex].Kd, 1);
+        finalColor *= sceneData[0].lightColor * float4(materials[input.materialIndex].Kd, 1);
     
         // TODO: Part 4g (half-vector or reflect method your choice)
         float3 viewDir = normalize((float3)sceneData[0].cameraPosition - input.posW);
@@ -137,15 +167,362 @@ namespace Shaders
         max(
             pow(
                 saturate(dot(input.nrmW, halfVec)),
-                materials[materialIndex].Ns
+                materials[input.materialIndex].Ns
             ),
             0
         );
-        float3 reflectedLight = (float3)sceneData[0].lightColor * materials[materialIndex].Ks * intensity;
+        float3 reflectedLight = (float3)sceneData[0].lightColor * materials[input.materialIndex].Ks * intensity;
         finalColor += float4(reflectedLight, 1);
     
         return finalColor;
     }
     )";
 
+
+    // Frustum and occlusion culling are separate sources so the opt-in occlusion pass can
+    // never break the default frustum cull. Both match FrustumCuller's descriptor layout.
+    const char* cullShader = R"(
+    #pragma pack_matrix(row_major)
+    struct DRAW_DATA
+    {
+        uint transformOffset;
+        uint materialIndex;
+        uint2 padding;
+        float4 quantOffset;
+        float4 quantScale;
+        float4 bounds;          // model space bounding sphere: center xyz, radius w
+    };
+    struct DRAW_COMMAND         // VkDrawIndexedIndirectCommand
+    {
+        uint indexCount;
+        uint instanceCount;
+        uint firstIndex;
+        int vertexOffset;
+        uint firstInstance;
+    };
+    [[vk::binding(0, 0)]]
+    StructuredBuffer<matrix> transforms; //this frame's slice
+    [[vk::binding(1, 0)]]
+    StructuredBuffer<DRAW_DATA> drawData;
+    [[vk::binding(2, 0)]]
+    StructuredBuffer<uint2> instances; //every instance: transform index, draw index
+    [[vk::binding(3, 0)]]
+    StructuredBuffer<DRAW_COMMAND> commands; //this frame's draws, no instances when not resident
+    [[vk::binding(4, 0)]]
+    RWStructuredBuffer<uint> visibleCommands; //commands as 5 uints each, instanceCount patched
+    [[vk::binding(5, 0)]]
+    RWStructuredBuffer<uint2> visibleInstances; //compacted per draw from its firstInstance
+    [[vk::binding(6, 0)]]
+    RWStructuredBuffer<uint> counters; //visible, culled, occluded
+
+    [[vk::push_constant]]
+    cbuffer CULL_DATA
+    {
+        matrix viewProjection;
+        uint instanceCount;
+        uint drawCount;
+        uint pass;              // 0 resets the commands and counters, 1 culls
+        uint pyramidLevels;     // occlusionCullShader only
+        uint2 viewportSize;
+        uint2 padding;
+    };
+
+    void Reset(uint id)
+    {
+        if (id < drawCount)
+        {
+            DRAW_COMMAND command = commands[id];
+            visibleCommands[id * 5 + 0] = command.indexCount;
+            visibleCommands[id * 5 + 1] = 0;
+            visibleCommands[id * 5 + 2] = command.firstIndex;
+            visibleCommands[id * 5 + 3] = asuint(command.vertexOffset);
+            visibleCommands[id * 5 + 4] = command.firstInstance;
+        }
+        if (id == 0)
+        {
+            counters[0] = 0;
+            counters[1] = 0;
+            counters[2] = 0;
+        }
+    }
+
+    // World space sphere, the radius grows with the largest axis scale
+    void WorldSphere(uint2 instance, out float3 center, out float radius)
+    {
+        matrix world = transforms[instance.x];
+        float4 bounds = drawData[instance.y].bounds;
+        center = mul(float4(bounds.xyz, 1), world).xyz;
+        float scale = max(dot(world[0].xyz, world[0].xyz), max(dot(world[1].xyz, world[1].xyz), dot(world[2].xyz, world[2].xyz)));
+        radius = bounds.w * sqrt(scale);
+    }
+
+    // Planes come from viewProjection's columns, like InstanceCuller::ExtractPlanes
+    bool InFrustum(float3 center, float radius)
+    {
+        matrix columns = transpose(viewProjection);
+        float4 planes[6] = { columns[3] + columns[0], columns[3] - columns[0], columns[3] + columns[1],
+            columns[3] - columns[1], columns[2], columns[3] - columns[2] };
+        bool visible = true;
+        for (uint p = 0; p < 6; ++p)
+            visible = visible && dot(planes[p].xyz, center) + planes[p].w >= -radius * length(planes[p].xyz);
+        return visible;
+    }
+
+    void Append(uint2 instance, DRAW_COMMAND command)
+    {
+        uint slot;
+        InterlockedAdd(visibleCommands[instance.y * 5 + 1], 1, slot);
+        visibleInstances[command.firstInstance + slot] = instance;
+    }
+
+    // Frustum culling only
+    [numthreads(64, 1, 1)]
+    void main(uint3 id : SV_DispatchThreadID)
+    {
+        if (pass == 0)
+        {
+            Reset(id.x);
+            return;
+        }
+        if (id.x >= instanceCount)
+            return;
+        uint2 instance = instances[id.x];
+        DRAW_COMMAND command = commands[instance.y];
+        if (command.instanceCount == 0)
+            return; // not resident, counts as neither
+
+        float3 center;
+        float radius;
+        WorldSphere(instance, center, radius);
+        uint slot;
+        if (InFrustum(center, radius))
+        {
+            Append(instance, command);
+            InterlockedAdd(counters[0], 1, slot);
+        }
+        else
+            InterlockedAdd(counters[1], 1, slot);
+    }
+    )";
+
+
+    const char* occlusionCullShader = R"(
+    #pragma pack_matrix(row_major)
+    struct DRAW_DATA
+    {
+        uint transformOffset;
+        uint materialIndex;
+        uint2 padding;
+        float4 quantOffset;
+        float4 quantScale;
+        float4 bounds;          // model space bounding sphere: center xyz, radius w
+    };
+    struct DRAW_COMMAND         // VkDrawIndexedIndirectCommand
+    {
+        uint indexCount;
+        uint instanceCount;
+        uint firstIndex;
+        int vertexOffset;
+        uint firstInstance;
+    };
+    [[vk::binding(0, 0)]]
+    StructuredBuffer<matrix> transforms; //this frame's slice
+    [[vk::binding(1, 0)]]
+    StructuredBuffer<DRAW_DATA> drawData;
+    [[vk::binding(2, 0)]]
+    StructuredBuffer<uint2> instances; //every instance: transform index, draw index
+    [[vk::binding(3, 0)]]
+    StructuredBuffer<DRAW_COMMAND> commands; //this frame's draws, no instances when not resident
+    [[vk::binding(4, 0)]]
+    RWStructuredBuffer<uint> visibleCommands; //commands as 5 uints each, instanceCount patched
+    [[vk::binding(5, 0)]]
+    RWStructuredBuffer<uint2> visibleInstances; //compacted per draw from its firstInstance
+    [[vk::binding(6, 0)]]
+    RWStructuredBuffer<uint> counters; //visible, culled, occluded
+    [[vk::binding(7, 0)]]
+    Texture2D<float> pyramid; //farthest depth per texel
+    [[vk::binding(8, 0)]]
+    RWStructuredBuffer<uint> visibility; //per instance, visible last frame
+
+    [[vk::push_constant]]
+    cbuffer CULL_DATA
+    {
+        matrix viewProjection;
+        uint instanceCount;
+        uint drawCount;
+        uint pass;              // 0 resets the commands and counters, 1 culls, 2 re-tests against the pyramid
+        uint pyramidLevels;
+        uint2 viewportSize;     // of the depth pass, pyramid level 0 is half of it
+        uint2 padding;
+    };
+
+    void Reset(uint id)
+    {
+        if (id < drawCount)
+        {
+            DRAW_COMMAND command = commands[id];
+            visibleCommands[id * 5 + 0] = command.indexCount;
+            visibleCommands[id * 5 + 1] = 0;
+            visibleCommands[id * 5 + 2] = command.firstIndex;
+            visibleCommands[id * 5 + 3] = asuint(command.vertexOffset);
+            visibleCommands[id * 5 + 4] = command.firstInstance;
+        }
+        if (id == 0)
+        {
+            counters[0] = 0;
+            counters[1] = 0;
+            counters[2] = 0;
+        }
+    }
+
+    // World space sphere, the radius grows with the largest axis scale
+    void WorldSphere(uint2 instance, out float3 center, out float radius)
+    {
+        matrix world = transforms[instance.x];
+        float4 bounds = drawData[instance.y].bounds;
+        center = mul(float4(bounds.xyz, 1), world).xyz;
+        float scale = max(dot(world[0].xyz, world[0].xyz), max(dot(world[1].xyz, world[1].xyz), dot(world[2].xyz, world[2].xyz)));
+        radius = bounds.w * sqrt(scale);
+    }
+
+    // Planes come from viewProjection's columns, like InstanceCuller::ExtractPlanes
+    bool InFrustum(float3 center, float radius)
+    {
+        matrix columns = transpose(viewProjection);
+        float4 planes[6] = { columns[3] + columns[0], columns[3] - columns[0], columns[3] + columns[1],
+            columns[3] - columns[1], columns[2], columns[3] - columns[2] };
+        bool visible = true;
+        for (uint p = 0; p < 6; ++p)
+            visible = visible && dot(planes[p].xyz, center) + planes[p].w >= -radius * length(planes[p].xyz);
+        return visible;
+    }
+
+    // The box around the sphere is projected, its nearest depth has to be farther than every
+    // pyramid texel under its screen rectangle. Boxes crossing the near plane are never occluded.
+    bool Occluded(float3 center, float radius)
+    {
+        float4 clipCenter = mul(float4(center, 1), viewProjection);
+        float4 axes[3] = { viewProjection[0] * radius, viewProjection[1] * radius, viewProjection[2] * radius };
+        float2 minNdc = 1.0f, maxNdc = -1.0f;
+        float nearest = 1.0f;
+        for (uint corner = 0; corner < 8; ++corner)
+        {
+            float4 clip = clipCenter + ((corner & 1) ? axes[0] : -axes[0]) + ((corner & 2) ? axes[1] : -axes[1]) +
+                ((corner & 4) ? axes[2] : -axes[2]);
+            if (clip.z < 0)
+                return false;
+            float3 ndc = clip.xyz / clip.w;
+            minNdc = min(minNdc, ndc.xy);
+            maxNdc = max(maxNdc, ndc.xy);
+            nearest = min(nearest, ndc.z);
+        }
+        int2 lastPixel = int2(viewportSize) - 1;
+        uint2 minPixel = clamp(int2((minNdc * 0.5f + 0.5f) * viewportSize), 0, lastPixel);
+        uint2 maxPixel = clamp(int2((maxNdc * 0.5f + 0.5f) * viewportSize), 0, lastPixel);
+
+        // The level where the rectangle spans at most two texels each way, so four loads cover it
+        uint2 extent = maxPixel - minPixel;
+        uint level = min(firstbithigh(max(max(extent.x, extent.y), 1u)), pyramidLevels - 1);
+        uint2 levelSize = max(viewportSize >> (level + 1), 1u);
+        uint2 first = min(minPixel >> (level + 1), levelSize - 1);
+        uint2 last = min(maxPixel >> (level + 1), levelSize - 1);
+        float farthest = max(max(pyramid.Load(int3(first, level)), pyramid.Load(int3(last.x, first.y, level))),
+            max(pyramid.Load(int3(first.x, last.y, level)), pyramid.Load(int3(last, level))));
+        return nearest > farthest;
+    }
+
+    void Append(uint2 instance, DRAW_COMMAND command)
+    {
+        uint slot;
+        InterlockedAdd(visibleCommands[instance.y * 5 + 1], 1, slot);
+        visibleInstances[command.firstInstance + slot] = instance;
+    }
+
+    // Two phase occlusion culling. Pass 1 keeps what was visible last frame and is still in
+    // the frustum, the renderer draws those into the depth pass the pyramid is built from.
+    // Pass 2 tests every instance against that pyramid, appends the ones pass 1 skipped that
+    // turn out visible, and records who is visible for next frame's pass 1.
+    [numthreads(64, 1, 1)]
+    void mainOcclusion(uint3 id : SV_DispatchThreadID)
+    {
+        if (pass == 0)
+        {
+            Reset(id.x);
+            return;
+        }
+        if (id.x >= instanceCount)
+            return;
+        uint2 instance = instances[id.x];
+        DRAW_COMMAND command = commands[instance.y];
+        if (command.instanceCount == 0)
+        {
+            if (pass == 2)
+                visibility[id.x] = 0;
+            return; // not resident, counts as neither
+        }
+
+        float3 center;
+        float radius;
+        WorldSphere(instance, center, radius);
+        bool inFrustum = InFrustum(center, radius);
+        bool wasVisible = visibility[id.x] != 0;
+        if (pass == 1)
+        {
+            if (inFrustum && wasVisible)
+                Append(instance, command);
+            return;
+        }
+
+        bool occluded = inFrustum && Occluded(center, radius);
+        visibility[id.x] = (inFrustum && !occluded) ? 1 : 0;
+        uint slot;
+        if (!inFrustum)
+            InterlockedAdd(counters[1], 1, slot);
+        else if (wasVisible)
+            InterlockedAdd(counters[0], 1, slot); // drawn by pass 1 either way
+        else if (occluded)
+            InterlockedAdd(counters[2], 1, slot);
+        else
+        {
+            Append(instance, command);
+            InterlockedAdd(counters[0], 1, slot);
+        }
+    }
+    )";
+
+
+    const char* depthReduceShader = R"(
+    [[vk::binding(0, 0)]]
+    Texture2D<float> source; //the depth pass for level 0, else the level above
+    [[vk::binding(1, 0)]]
+    RWTexture2D<float> destination;
+
+    [[vk::push_constant]]
+    cbuffer REDUCE_DATA
+    {
+        uint2 sourceSize;
+        uint2 destinationSize;
+    };
+
+    // Each texel keeps the farthest depth under it. Odd sizes fold their last row and
+    // column into the last texel, so no source texel is skipped.
+    [numthreads(8, 8, 1)]
+    void main(uint3 id : SV_DispatchThreadID)
+    {
+        if (id.x >= destinationSize.x || id.y >= destinationSize.y)
+            return;
+        uint2 first = id.xy * 2;
+        uint2 end = min(first + 2, sourceSize);
+        if (id.x == destinationSize.x - 1)
+            end.x = sourceSize.x;
+        if (id.y == destinationSize.y - 1)
+            end.y = sourceSize.y;
+        float farthest = 0.0f;
+        for (uint y = first.y; y < end.y; ++y)
+            for (uint x = first.x; x < end.x; ++x)
+                farthest = max(farthest, source.Load(int3(x, y, 0)));
+        destination[id.xy] = farthest;
+    }
+    )";
+
 }
\ No newline at end of file